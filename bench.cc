@@ -0,0 +1,524 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Microbenchmarks for the hot paths of Replication Booster. Each result
+  is printed as one JSON object per line so that runs can be collected
+  and compared across releases.
+*/
+
+#include "replication_booster.h"
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+static uint64_t bench_iterations= 200000;
+static uint bench_batch= 100;
+static std::vector<uint> bench_threads;
+static const char *bench_filter= NULL;
+static const char *bench_tmpdir= "/tmp";
+
+typedef struct corpus
+{
+  const char *name;
+  const char *db;
+  std::vector<std::string> queries;
+} corpus_t;
+
+typedef struct result
+{
+  double seconds;
+  uint64_t ops;
+  std::vector<double> latencies_ns;
+} result_t;
+
+static inline uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool bench_enabled(const char *name)
+{
+  return !bench_filter || strstr(name, bench_filter);
+}
+
+static double percentile(std::vector<double> &samples, double pct)
+{
+  if (samples.empty())
+    return 0;
+  size_t n= (size_t)(pct / 100.0 * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+  return samples[n];
+}
+
+static void print_result(const char *bench, const char *corpus, uint threads,
+                         result_t *result)
+{
+  printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"threads\":%u,"
+         "\"ops\":%lu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+         "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f}\n",
+         bench, corpus, threads, result->ops, result->seconds,
+         result->seconds > 0 ? result->ops / result->seconds : 0,
+         percentile(result->latencies_ns, 50),
+         percentile(result->latencies_ns, 99),
+         percentile(result->latencies_ns, 100));
+  fflush(stdout);
+}
+
+static std::string make_in_list(uint n)
+{
+  std::string query("UPDATE user_items SET cnt=cnt+1 WHERE item_id IN (");
+  char buf[32];
+  for (uint i= 0; i < n; i++)
+  {
+    sprintf(buf, i ? ",%u" : "%u", i * 7919);
+    query.append(buf);
+  }
+  query.append(")");
+  return query;
+}
+
+/*
+  Statement corpora modelled on typical OLTP relay logs: point updates and
+  deletes by primary key, range changes, and the transaction control and
+  INSERT statements which are rejected up front.
+*/
+static std::vector<corpus_t> make_corpora()
+{
+  std::vector<corpus_t> corpora;
+  corpus_t c;
+
+  c.name= "update_pk";
+  c.db= "app";
+  c.queries.clear();
+  c.queries.push_back("UPDATE users SET last_login=1318000000, login_count=login_count+1 WHERE user_id=123456");
+  c.queries.push_back("update `app`.`users` set nickname='foo bar' where user_id = 987654");
+  c.queries.push_back("UPDATE LOW_PRIORITY user_items SET cnt=cnt-1 WHERE user_id=42 AND item_id=7");
+  corpora.push_back(c);
+
+  c.name= "update_range";
+  c.queries.clear();
+  c.queries.push_back("UPDATE messages SET status=2 WHERE user_id=99 AND created_at < '2011-10-01 00:00:00' LIMIT 100");
+  c.queries.push_back("UPDATE IGNORE sessions SET expired=1 WHERE last_access BETWEEN 1317000000 AND 1318000000");
+  c.queries.push_back(make_in_list(200));
+  corpora.push_back(c);
+
+  c.name= "delete";
+  c.queries.clear();
+  c.queries.push_back("DELETE FROM sessions WHERE session_id='a4f1c2d3e4b5a6978812'");
+  c.queries.push_back("delete from `app`.`user_items` where user_id=42 and item_id=7");
+  c.queries.push_back("DELETE LOW_PRIORITY QUICK FROM messages WHERE created_at < '2011-01-01' LIMIT 1000");
+  corpora.push_back(c);
+
+  c.name= "non_candidate";
+  c.queries.clear();
+  c.queries.push_back("BEGIN");
+  c.queries.push_back("COMMIT");
+  c.queries.push_back("INSERT INTO messages (user_id, body) VALUES (1, 'hello')");
+  c.queries.push_back("CREATE TABLE t1 (id int primary key)");
+  corpora.push_back(c);
+
+  return corpora;
+}
+
+/*
+  Runs fn over the corpus for bench_iterations calls, timing batches of
+  bench_batch calls so that clock overhead does not dominate nanosecond
+  scale operations.
+*/
+template <typename F>
+static void run_corpus(const char *bench, corpus_t *corpus, F fn)
+{
+  result_t result;
+  size_t n= corpus->queries.size();
+  uint64_t begin= now_ns();
+  result.ops= 0;
+  while (result.ops < bench_iterations)
+  {
+    uint64_t t0= now_ns();
+    for (uint i= 0; i < bench_batch; i++)
+      fn(corpus->queries[(result.ops + i) % n], corpus->db);
+    uint64_t t1= now_ns();
+    result.latencies_ns.push_back((double)(t1 - t0) / bench_batch);
+    result.ops+= bench_batch;
+  }
+  result.seconds= (now_ns() - begin) / 1e9;
+  print_result(bench, corpus->name, 1, &result);
+}
+
+static volatile uint64_t sink;
+
+static void do_is_convert_candidate(const std::string &query, const char *)
+{
+  sink+= is_convert_candidate(query.c_str());
+}
+
+static void do_convert_to_select(const std::string &query, const char *db)
+{
+  uint length= 0;
+  rewrite_info_t info;
+  char *select= convert_to_select(query, db, &length, &info);
+  sink+= length;
+  delete[] select;
+}
+
+static void bench_rewriter(std::vector<corpus_t> &corpora)
+{
+  for (size_t i= 0; i < corpora.size(); i++)
+  {
+    if (bench_enabled("is_convert_candidate"))
+      run_corpus("is_convert_candidate", &corpora[i], do_is_convert_candidate);
+    if (bench_enabled("convert_to_select"))
+      run_corpus("convert_to_select", &corpora[i], do_convert_to_select);
+  }
+}
+
+/* query_queue: one producer (the relay log reader), one queue per worker */
+
+typedef struct queue_consumer_arg
+{
+  query_queue *queue;
+  std::vector<double> latencies_ns;
+} queue_consumer_arg_t;
+
+static void *queue_consumer(void *arg)
+{
+  queue_consumer_arg_t *consumer= (queue_consumer_arg_t*)arg;
+  uint64_t n= 0;
+  while (1)
+  {
+    query_t *query= consumer->queue->wait_and_pop();
+    if (query->shutdown)
+    {
+      delete query;
+      break;
+    }
+    if (n++ % bench_batch == 0)
+      consumer->latencies_ns.push_back((double)(now_ns() - query->pos));
+    delete query;
+  }
+  return NULL;
+}
+
+static void bench_query_queue(uint threads)
+{
+  result_t result;
+  std::vector<pthread_t> tids(threads);
+  std::vector<queue_consumer_arg_t> consumers(threads);
+
+  for (uint i= 0; i < threads; i++)
+  {
+    consumers[i].queue= new query_queue();
+    pthread_create(&tids[i], NULL, queue_consumer, &consumers[i]);
+  }
+  uint64_t begin= now_ns();
+  for (uint64_t i= 0; i < bench_iterations; i++)
+  {
+    query_t *query= new query_t;
+    memset(query, 0, sizeof(query_t));
+    query->pos= now_ns();
+    consumers[i % threads].queue->push(query);
+  }
+  for (uint i= 0; i < threads; i++)
+  {
+    query_t *query= new query_t;
+    memset(query, 0, sizeof(query_t));
+    query->shutdown= true;
+    consumers[i].queue->push(query);
+  }
+  for (uint i= 0; i < threads; i++)
+  {
+    pthread_join(tids[i], NULL);
+    result.latencies_ns.insert(result.latencies_ns.end(),
+                               consumers[i].latencies_ns.begin(),
+                               consumers[i].latencies_ns.end());
+    delete consumers[i].queue;
+  }
+  result.seconds= (now_ns() - begin) / 1e9;
+  result.ops= bench_iterations;
+  print_result("query_queue", "push_pop", threads, &result);
+}
+
+/* update_stats: contention on worker_mutex */
+
+typedef struct stats_arg
+{
+  uint64_t ops;
+  std::vector<double> latencies_ns;
+} stats_arg_t;
+
+static void *stats_worker(void *arg)
+{
+  stats_arg_t *s= (stats_arg_t*)arg;
+  worker_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  for (uint64_t i= 0; i < s->ops; i+= bench_batch)
+  {
+    uint64_t t0= now_ns();
+    for (uint j= 0; j < bench_batch; j++)
+    {
+      stats.popped_queries++;
+      stats.converted_queries++;
+      stats.executed_selects++;
+      update_stats(&stats);
+    }
+    s->latencies_ns.push_back((double)(now_ns() - t0) / bench_batch);
+  }
+  return NULL;
+}
+
+static void bench_update_stats(uint threads)
+{
+  result_t result;
+  std::vector<pthread_t> tids(threads);
+  std::vector<stats_arg_t> args(threads);
+  uint64_t begin= now_ns();
+  for (uint i= 0; i < threads; i++)
+  {
+    args[i].ops= bench_iterations / threads;
+    pthread_create(&tids[i], NULL, stats_worker, &args[i]);
+  }
+  result.ops= 0;
+  for (uint i= 0; i < threads; i++)
+  {
+    pthread_join(tids[i], NULL);
+    result.ops+= args[i].ops;
+    result.latencies_ns.insert(result.latencies_ns.end(),
+                               args[i].latencies_ns.begin(),
+                               args[i].latencies_ns.end());
+  }
+  result.seconds= (now_ns() - begin) / 1e9;
+  print_result("update_stats", "counters", threads, &result);
+}
+
+/* Event decoding: a synthetic relay log read through the Binlog API */
+
+static void put_int(std::string *buf, uint64_t value, uint bytes)
+{
+  for (uint i= 0; i < bytes; i++)
+    buf->append(1, (char)((value >> (8 * i)) & 0xff));
+}
+
+static void write_event(FILE *fp, uint type, uint32_t timestamp,
+                        const std::string &body, uint64_t *pos)
+{
+  std::string header;
+  uint32_t length= 19 + body.length();
+  put_int(&header, timestamp, 4);
+  put_int(&header, type, 1);
+  put_int(&header, 1, 4);
+  put_int(&header, length, 4);
+  put_int(&header, *pos + length, 4);
+  put_int(&header, 0, 2);
+  fwrite(header.data(), 1, header.length(), fp);
+  fwrite(body.data(), 1, body.length(), fp);
+  *pos+= length;
+}
+
+static void write_format_description(FILE *fp, uint64_t *pos)
+{
+  static const uint8_t post_header_len[]= {
+    56, 13, 0, 8, 0, 18, 0, 4, 4, 4, 4, 18, 0, 0, 84, 0, 4, 26, 8,
+    0, 0, 0, 8, 8, 8, 2, 0 };
+  std::string body;
+  char version[50];
+  memset(version, 0, sizeof(version));
+  strcpy(version, "5.1.73-bench");
+  put_int(&body, 4, 2);
+  body.append(version, sizeof(version));
+  put_int(&body, 0, 4);
+  put_int(&body, 19, 1);
+  body.append((const char*)post_header_len, sizeof(post_header_len));
+  write_event(fp, mysql::FORMAT_DESCRIPTION_EVENT, 0, body, pos);
+}
+
+static void write_query_event(FILE *fp, const char *db, const std::string &query,
+                              uint32_t timestamp, uint64_t *pos)
+{
+  std::string status_vars, body;
+  put_int(&status_vars, 0, 1);  /* Q_FLAGS2_CODE */
+  put_int(&status_vars, 0, 4);
+  put_int(&status_vars, 1, 1);  /* Q_SQL_MODE_CODE */
+  put_int(&status_vars, 0, 8);
+  put_int(&status_vars, 4, 1);  /* Q_CHARSET_CODE */
+  put_int(&status_vars, 33, 2);
+  put_int(&status_vars, 33, 2);
+  put_int(&status_vars, 8, 2);
+  put_int(&body, 1, 4);
+  put_int(&body, 0, 4);
+  put_int(&body, strlen(db), 1);
+  put_int(&body, 0, 2);
+  put_int(&body, status_vars.length(), 2);
+  body.append(status_vars);
+  body.append(db);
+  body.append(1, '\0');
+  body.append(query);
+  write_event(fp, mysql::QUERY_EVENT, timestamp, body, pos);
+}
+
+static std::string write_relay_log(std::vector<corpus_t> &corpora)
+{
+  std::string path(bench_tmpdir);
+  path.append("/replication_booster_bench.XXXXXX");
+  char *buf= strdup(path.c_str());
+  int fd= mkstemp(buf);
+  path= buf;
+  free(buf);
+  if (fd < 0)
+  {
+    print_log("ERROR: Could not create %s: %d", path.c_str(), errno);
+    return "";
+  }
+  FILE *fp= fdopen(fd, "w");
+  uint64_t pos= 4;
+  fwrite("\xfe" "bin", 1, 4, fp);
+  write_format_description(fp, &pos);
+  for (uint64_t i= 0; i < bench_iterations; i++)
+  {
+    corpus_t *c= &corpora[i % corpora.size()];
+    write_query_event(fp, c->db, c->queries[(i / corpora.size()) % c->queries.size()],
+                      1318000000 + i / 1000, &pos);
+  }
+  fclose(fp);
+  return path;
+}
+
+static void bench_event_decoding(std::vector<corpus_t> &corpora)
+{
+  result_t result;
+  std::string path= write_relay_log(corpora);
+  if (path.empty())
+    return;
+  std::string url("file://");
+  url.append(path);
+  Binary_log_driver *drv= create_transport(url.c_str());
+  Binary_log *log= new Binary_log(drv);
+  if (log->connect())
+  {
+    print_log("ERROR: Could not open %s", path.c_str());
+    goto end;
+  }
+  {
+    Binary_log_event *event;
+    uint64_t begin= now_ns(), t0= begin;
+    result.ops= 0;
+    log->set_position(4);
+    while (log->wait_for_next_event(&event) == ERR_OK)
+    {
+      sink+= event->header()->event_length;
+      delete event;
+      if (++result.ops % bench_batch == 0)
+      {
+        uint64_t t1= now_ns();
+        result.latencies_ns.push_back((double)(t1 - t0) / bench_batch);
+        t0= t1;
+      }
+    }
+    result.seconds= (now_ns() - begin) / 1e9;
+    print_result("event_decoding", "mixed", 1, &result);
+  }
+  drv->disconnect();
+end:
+  delete log;
+  delete drv;
+  unlink(path.c_str());
+}
+
+static void bench_usage()
+{
+  printf("Usage: \n");
+  printf(" replication_booster_bench [OPTIONS]\n\n");
+  printf("Options:\n");
+  printf(" -n, --iterations=N    :Operations per benchmark. Default is 200000.\n");
+  printf(" -b, --batch=N         :Operations timed together for latency samples. Default is 100.\n");
+  printf(" -t, --threads=N[,N..] :Thread counts for the contention benchmarks. Default is 1,2,4,8.\n");
+  printf(" -f, --filter=name     :Only run benchmarks whose name contains this string.\n");
+  printf(" -d, --tmpdir=dir      :Where to write the synthetic relay log. Default is /tmp.\n");
+  exit(1);
+}
+
+static void parse_threads(const char *arg)
+{
+  char *buf= strdup(arg);
+  char *save= NULL;
+  bench_threads.clear();
+  for (char *tok= strtok_r(buf, ",", &save); tok; tok= strtok_r(NULL, ",", &save))
+  {
+    int value= atoi(tok);
+    bench_threads.push_back(value < 1 ? 1 : value);
+  }
+  free(buf);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option bench_options[]=
+  {
+    {"help", no_argument, 0, '?'},
+    {"iterations", required_argument, 0, 'n'},
+    {"batch", required_argument, 0, 'b'},
+    {"threads", required_argument, 0, 't'},
+    {"filter", required_argument, 0, 'f'},
+    {"tmpdir", required_argument, 0, 'd'},
+    {0,0,0,0}
+  };
+  int c, opt_ind= 0;
+
+  parse_threads("1,2,4,8");
+  while ((c= getopt_long(argc, argv, "?n:b:t:f:d:", bench_options, &opt_ind)) != EOF)
+  {
+    switch (c)
+    {
+      case 'n': bench_iterations= strtoull(optarg, NULL, 10); break;
+      case 'b': bench_batch= atoi(optarg); break;
+      case 't': parse_threads(optarg); break;
+      case 'f': bench_filter= optarg; break;
+      case 'd': bench_tmpdir= optarg; break;
+      default: bench_usage(); break;
+    }
+  }
+  if (bench_batch < 1)
+    bench_batch= 1;
+  if (bench_iterations < bench_batch)
+    bench_iterations= bench_batch;
+
+  pthread_mutex_init(&worker_mutex, NULL);
+  std::vector<corpus_t> corpora= make_corpora();
+
+  bench_rewriter(corpora);
+  for (size_t i= 0; i < bench_threads.size(); i++)
+  {
+    if (bench_enabled("query_queue"))
+      bench_query_queue(bench_threads[i]);
+    if (bench_enabled("update_stats"))
+      bench_update_stats(bench_threads[i]);
+  }
+  if (bench_enabled("event_decoding"))
+    bench_event_decoding(corpora);
+
+  pthread_mutex_destroy(&worker_mutex);
+  return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --coalesce-max: bursts of "UPDATE t SET ... WHERE id = N" for many N
+  are prefetched with one "SELECT ... WHERE id IN (...)" instead of a
+  round trip and a parse per statement.
+*/
+
+#include "coalesce.h"
+#include "handler_read.h"
+#include "replication_filter.h"
+#include <ctype.h>
+#include <strings.h>
+
+lookup_coalescer *coalescer= NULL;
+uint64_t stat_coalesced_batches= 0;
+uint64_t stat_coalesced_queries= 0;
+
+const char *find_where_clause(const char *query)
+{
+  int depth= 0;
+  const char *p= query;
+  while (*p)
+  {
+    if (is_quote_start(p))
+    {
+      if (!(p= skip_quoted(p)))
+        return NULL;
+      continue;
+    }
+    if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    else if (!depth && !strncasecmp(p, "where", 5) &&
+             (p == query || !is_identifier_char(p[-1])) &&
+             !is_identifier_char(p[5]))
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+bool find_single_key_lookup(const char *query, std::string *column,
+                            std::string *value)
+{
+  equalities_t equalities;
+  const char *where= find_where_clause(query);
+  if (!where || !parse_point_predicate(where, &equalities) ||
+      equalities.size() != 1)
+    return false;
+  *column= equalities[0].first;
+  *value= equalities[0].second;
+  return true;
+}
+
+lookup_coalescer::~lookup_coalescer()
+{
+  std::map<std::string, batch_t>::iterator it;
+  for (it= batches.begin(); it != batches.end(); it++)
+    free_query(it->second.head);
+}
+
+bool lookup_coalescer::add(query_t *query)
+{
+  std::string db, table, column, value;
+  const char *text= query->qev->query.c_str();
+  /* The WHERE of REPLACE ... SELECT is on the source table */
+  enum statement_class stmt_class= classify_statement(text, NULL);
+  if ((stmt_class != STMT_UPDATE && stmt_class != STMT_DELETE) ||
+      !find_target_table(text, query->qev->db_name, &db, &table) ||
+      !find_single_key_lookup(text, &column, &value))
+    return false;
+
+  std::string key(db);
+  key.append(1, '\0');
+  key.append(table);
+  key.append(1, '\0');
+  for (size_t i= 0; i < column.length(); i++)
+    key.append(1, tolower((unsigned char)column[i]));
+  std::map<std::string, batch_t>::iterator it= batches.find(key);
+  if (it == batches.end())
+  {
+    batch_t batch= { query, query, 1, now_usec() };
+    it= batches.insert(std::make_pair(key, batch)).first;
+  } else
+  {
+    it->second.tail->next= query;
+    it->second.tail= query;
+    it->second.count++;
+  }
+  if (it->second.count >= opt_coalesce_max)
+    flush(it);
+  return true;
+}
+
+void lookup_coalescer::flush(std::map<std::string, batch_t>::iterator it)
+{
+  if (it->second.count > 1)
+  {
+    stat_coalesced_batches++;
+    stat_coalesced_queries+= it->second.count;
+  }
+  push_query(it->second.head);
+  batches.erase(it);
+}
+
+void lookup_coalescer::flush_expired(uint64_t now)
+{
+  uint64_t window= opt_coalesce_window_ms * 1000ULL;
+  std::map<std::string, batch_t>::iterator it= batches.begin();
+  while (it != batches.end())
+  {
+    std::map<std::string, batch_t>::iterator next= it;
+    next++;
+    if (now - it->second.first_usec >= window)
+      flush(it);
+    it= next;
+  }
+}
+
+void lookup_coalescer::flush_all()
+{
+  while (!batches.empty())
+    flush(batches.begin());
+}
+
+char *make_in_probe(const char *select, const query_t *query, uint *length)
+{
+  std::string column, value;
+  const char *where= find_where_clause(select);
+  if (!where || !find_single_key_lookup(select, &column, &value))
+    return NULL;
+
+  std::string probe(select, where - select);
+  probe.append("where `");
+  probe.append(column);
+  probe.append("` in (");
+  probe.append(value);
+  for (const query_t *q= query->next; q; q= q->next)
+  {
+    std::string other_column;
+    if (!find_single_key_lookup(q->qev->query.c_str(), &other_column, &value))
+      return NULL;
+    probe.append(",");
+    probe.append(value);
+  }
+  probe.append(")");
+
+  char *buf= new char[probe.length() + 1];
+  memcpy(buf, probe.c_str(), probe.length() + 1);
+  *length= probe.length();
+  return buf;
+}
@@ -0,0 +1,80 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __coalesce_h_
+#define __coalesce_h_
+
+#include <string>
+#include <map>
+#include "replication_booster.h"
+
+/*
+  Start of the top level WHERE clause of a statement, skipping quoted
+  strings, identifiers, comments and parentheses. NULL if there is none.
+*/
+const char *find_where_clause(const char *query);
+
+/*
+  Column and value of a WHERE clause that is a single "column = literal"
+  term, optionally with LIMIT.
+*/
+bool find_single_key_lookup(const char *query, std::string *column,
+                            std::string *value);
+
+/*
+  Collects single key lookups on the same table and column in the relay
+  log reader, chained through query_t::next, and pushes them to a worker
+  as one query when --coalesce-max are collected or the oldest has waited
+  --coalesce-window-ms. Used by the reader thread only.
+*/
+class lookup_coalescer
+{
+private:
+  typedef struct batch
+  {
+    query_t *head;
+    query_t *tail;
+    uint count;
+    uint64_t first_usec;
+  } batch_t;
+  std::map<std::string, batch_t> batches;
+
+  void flush(std::map<std::string, batch_t>::iterator it);
+
+public:
+  ~lookup_coalescer();
+
+  /* Returns false if the query is not a single key lookup */
+  bool add(query_t *query);
+  void flush_expired(uint64_t now);
+  void flush_all();
+};
+
+extern lookup_coalescer *coalescer;
+
+/*
+  Rewrites the SELECT of the first query of a chain into an IN-list
+  probe for the values of all queries in the chain. Returns NULL if a
+  value can not be found.
+*/
+char *make_in_probe(const char *select, const query_t *query, uint *length);
+
+#endif
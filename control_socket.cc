@@ -0,0 +1,239 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Unix domain control socket. The protocol is line based: each command is
+  one line, and each response ends with a line "OK" or "ERROR: <reason>".
+
+    status                  current status and statistics
+    stats                   statistics only
+    get                     current tuning parameters
+    set <name> <value>      threads, seconds-prefetch, offset-events,
+                            offset-bytes, offset-seconds, millis-sleep
+    pause / resume          stop and restart reading the relay log
+    flush                   discard all queued queries
+    trace                   write the trace rings to --trace-file
+    quit                    close the connection
+
+  For example: echo status | socat - UNIX-CONNECT:/tmp/replication_booster.sock
+*/
+
+#include "replication_booster.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static int listen_fd= -1;
+static pthread_t control_thread_id;
+
+static void print_parameters(FILE *out)
+{
+  fprintf(out, "threads %u\n", opt_workers);
+  fprintf(out, "seconds-prefetch %u\n", opt_read_ahead_seconds);
+  fprintf(out, "offset-events %u\n", opt_skip_events);
+  fprintf(out, "offset-bytes %lu\n", opt_skip_bytes);
+  fprintf(out, "offset-seconds %u\n", opt_skip_seconds);
+  fprintf(out, "millis-sleep %u\n", opt_sleep_millis_at_read_limit / 1000);
+  fprintf(out, "paused %s\n", prefetch_paused ? "true" : "false");
+}
+
+static const char *set_parameter(const char *name, const char *arg)
+{
+  char *end;
+  long value= strtol(arg, &end, 10);
+  if (end == arg || *end || value < 0)
+    return "invalid value";
+
+  if (!strcmp(name, "threads"))
+  {
+    if (value < 1 || value > MAX_WORKERS)
+      return "threads out of range";
+    if (resize_worker_pool(value))
+      return "could not start all worker threads";
+  } else if (!strcmp(name, "seconds-prefetch"))
+  {
+    if (value < 1)
+      return "seconds-prefetch must be at least 1";
+    opt_read_ahead_seconds= value;
+  } else if (!strcmp(name, "offset-events"))
+    opt_skip_events= value;
+  else if (!strcmp(name, "offset-bytes"))
+    opt_skip_bytes= value;
+  else if (!strcmp(name, "offset-seconds"))
+    opt_skip_seconds= value;
+  else if (!strcmp(name, "millis-sleep"))
+    opt_sleep_millis_at_read_limit= value * 1000;
+  else
+    return "unknown parameter";
+  print_log("Control socket: set %s to %ld.", name, value);
+  return NULL;
+}
+
+/* Returns false when the client asked to close the connection */
+static bool handle_command(char *line, FILE *out)
+{
+  char *save= NULL;
+  char *cmd= strtok_r(line, " \t\r\n", &save);
+  const char *error= NULL;
+
+  if (!cmd)
+    return true;
+  if (!strcmp(cmd, "status"))
+  {
+    print_status(out);
+    print_statistics(out);
+  } else if (!strcmp(cmd, "stats"))
+    print_statistics(out);
+  else if (!strcmp(cmd, "get"))
+    print_parameters(out);
+  else if (!strcmp(cmd, "set"))
+  {
+    char *name= strtok_r(NULL, " \t\r\n", &save);
+    char *value= strtok_r(NULL, " \t\r\n", &save);
+    error= name && value ? set_parameter(name, value) : "usage: set <name> <value>";
+  } else if (!strcmp(cmd, "pause"))
+  {
+    prefetch_paused= true;
+    print_log("Control socket: prefetching paused.");
+  } else if (!strcmp(cmd, "resume"))
+  {
+    prefetch_paused= false;
+    print_log("Control socket: prefetching resumed.");
+  } else if (!strcmp(cmd, "flush"))
+    clear_worker_queues();
+  else if (!strcmp(cmd, "trace"))
+  {
+    const char *path;
+    if (!tracing)
+      error= "tracing is not enabled, see --trace";
+    else if (dump_trace(&path))
+      error= "could not write the trace file";
+    else
+      fprintf(out, "%s\n", path);
+  } else if (!strcmp(cmd, "quit"))
+    return false;
+  else if (!strcmp(cmd, "help"))
+    fprintf(out, "status, stats, get, set <name> <value>, pause, resume, flush, trace, quit\n");
+  else
+    error= "unknown command";
+
+  if (error)
+    fprintf(out, "ERROR: %s\n", error);
+  else
+    fprintf(out, "OK\n");
+  fflush(out);
+  return true;
+}
+
+static void handle_client(int fd)
+{
+  char line[1024];
+  FILE *in= fdopen(fd, "r");
+  FILE *out= fdopen(dup(fd), "w");
+  if (!in || !out)
+  {
+    if (in)
+      fclose(in);
+    else
+      close(fd);
+    if (out)
+      fclose(out);
+    return;
+  }
+  while (!shutdown_program && fgets(line, sizeof(line), in))
+  {
+    if (!handle_command(line, out))
+      break;
+  }
+  fclose(in);
+  fclose(out);
+}
+
+static void* control_thread(void*)
+{
+  struct pollfd pfd;
+  pfd.fd= listen_fd;
+  pfd.events= POLLIN;
+  while (!shutdown_program)
+  {
+    if (poll(&pfd, 1, 500) <= 0)
+      continue;
+    int fd= accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    /* Do not let a stuck client block shutdown forever */
+    struct timeval tv= { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    handle_client(fd);
+  }
+  return NULL;
+}
+
+int start_control_socket()
+{
+  struct sockaddr_un addr;
+  if (!opt_control_socket)
+    return 0;
+  if (strlen(opt_control_socket) >= sizeof(addr.sun_path))
+  {
+    print_log("ERROR: Control socket path is too long: %s", opt_control_socket);
+    return 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family= AF_UNIX;
+  strcpy(addr.sun_path, opt_control_socket);
+  unlink(opt_control_socket);
+
+  if ((listen_fd= socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    goto err;
+  {
+    mode_t old_mask= umask(077);
+    int rc= bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc || listen(listen_fd, 4))
+      goto err;
+  }
+  if (pthread_create(&control_thread_id, NULL, control_thread, NULL))
+    goto err;
+  print_log("Listening on control socket %s", opt_control_socket);
+  return 0;
+
+err:
+  print_log("ERROR: Could not create control socket %s: %d %s",
+            opt_control_socket, errno, strerror(errno));
+  if (listen_fd >= 0)
+    close(listen_fd);
+  listen_fd= -1;
+  return 1;
+}
+
+void stop_control_socket()
+{
+  if (listen_fd < 0)
+    return;
+  pthread_join(control_thread_id, NULL);
+  close(listen_fd);
+  listen_fd= -1;
+  unlink(opt_control_socket);
+}
@@ -0,0 +1,189 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#include "gtid.h"
+#include <ctype.h>
+#include <algorithm>
+
+#define SID_LENGTH 16
+
+bool gtid_mode_on= false;
+
+static gtid_set_ptr executed_gtids;
+static pthread_mutex_t executed_gtids_mutex= PTHREAD_MUTEX_INITIALIZER;
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c= tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/* Parses "3E11FA47-71CA-11E1-9E33-C80AA9429562" into 16 bytes */
+static bool parse_uuid(const char *text, size_t length, std::string *sid)
+{
+  sid->clear();
+  for (size_t i= 0; i < length; i++)
+  {
+    if (text[i] == '-')
+      continue;
+    if (i + 1 >= length)
+      return false;
+    int hi= hex_value(text[i]), lo= hex_value(text[i+1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    sid->append(1, (char)(hi << 4 | lo));
+    i++;
+  }
+  return sid->length() == SID_LENGTH;
+}
+
+/*
+  Parses the text form "uuid:1-5:7,uuid2:1-100". Tagged intervals
+  (uuid:tag:1-5) are skipped, they have no untagged GTID events.
+*/
+bool gtid_set::parse(const char *text)
+{
+  intervals.clear();
+  const char *p= text;
+  while (*p)
+  {
+    while (isspace((unsigned char)*p) || *p == ',')
+      p++;
+    if (!*p)
+      break;
+    const char *colon= strchr(p, ':');
+    if (!colon)
+      return false;
+    std::string sid;
+    if (!parse_uuid(p, colon - p, &sid))
+      return false;
+    std::vector<interval_t> &list= intervals[sid];
+    p= colon;
+    bool tagged= false;
+    while (*p == ':')
+    {
+      p++;
+      if (!isdigit((unsigned char)*p))
+      {
+        /* A tag applies to the intervals following it */
+        tagged= true;
+        while (*p && *p != ':' && *p != ',')
+          p++;
+        continue;
+      }
+      char *end;
+      int64_t start= strtoll(p, &end, 10), last= start;
+      p= end;
+      if (*p == '-')
+      {
+        last= strtoll(p + 1, &end, 10);
+        p= end;
+      }
+      if (!tagged)
+        list.push_back(interval_t(start, last));
+    }
+    std::sort(list.begin(), list.end());
+    if (list.empty())
+      intervals.erase(sid);
+  }
+  return true;
+}
+
+bool gtid_set::contains(const unsigned char *sid, int64_t gno) const
+{
+  std::map<std::string, std::vector<interval_t> >::const_iterator it=
+    intervals.find(std::string((const char*)sid, SID_LENGTH));
+  if (it == intervals.end())
+    return false;
+  const std::vector<interval_t> &list= it->second;
+  /* First interval starting after gno, the one before may contain it */
+  std::vector<interval_t>::const_iterator i=
+    std::upper_bound(list.begin(), list.end(), interval_t(gno, INT64_MAX));
+  if (i == list.begin())
+    return false;
+  --i;
+  return gno >= i->first && gno <= i->second;
+}
+
+size_t gtid_set::get_interval_count() const
+{
+  size_t count= 0;
+  std::map<std::string, std::vector<interval_t> >::const_iterator it;
+  for (it= intervals.begin(); it != intervals.end(); it++)
+    count+= it->second.size();
+  return count;
+}
+
+gtid_set_ptr get_executed_gtids()
+{
+  gtid_set_ptr set;
+  pthread_mutex_lock(&executed_gtids_mutex);
+  set= executed_gtids;
+  pthread_mutex_unlock(&executed_gtids_mutex);
+  return set;
+}
+
+void set_executed_gtids(gtid_set_ptr set)
+{
+  pthread_mutex_lock(&executed_gtids_mutex);
+  executed_gtids= set;
+  pthread_mutex_unlock(&executed_gtids_mutex);
+}
+
+/*
+  Reads sid and gno from a Gtid_log_event, which the Binlog API does not
+  decode. Body: flags (1), sid (16), gno (8), ... Anonymous GTID events
+  have no identity and return false.
+*/
+bool read_gtid_event(int fd, uint64_t pos, uint32_t length,
+                     unsigned char *sid, int64_t *gno)
+{
+  static std::string buf;
+  if (length < EVENT_HEADER_LENGTH + 1 + SID_LENGTH + 8 ||
+      !read_relay_log(fd, pos, EVENT_HEADER_LENGTH + 1 + SID_LENGTH + 8, &buf))
+    return false;
+  const unsigned char *p= (const unsigned char*)buf.data() + EVENT_HEADER_LENGTH;
+  if ((unsigned char)buf[4] != GTID_LOG_EVENT)
+    return false;
+  memcpy(sid, p + 1, SID_LENGTH);
+  *gno= 0;
+  for (int i= 0; i < 8; i++)
+    *gno|= (int64_t)p[1 + SID_LENGTH + i] << (8 * i);
+  return *gno > 0;
+}
+
+void format_gtid(const unsigned char *sid, int64_t gno, char *buf, size_t size)
+{
+  char uuid[37];
+  char *p= uuid;
+  for (int i= 0; i < SID_LENGTH; i++)
+  {
+    if (i == 4 || i == 6 || i == 8 || i == 10)
+      *p++= '-';
+    sprintf(p, "%02x", sid[i]);
+    p+= 2;
+  }
+  snprintf(buf, size, "%s:%ld", uuid, gno);
+}
@@ -0,0 +1,59 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __gtid_h_
+#define __gtid_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include "replication_booster.h"
+
+#define GTID_LOG_EVENT 33
+#define ANONYMOUS_GTID_LOG_EVENT 34
+
+/* Set of executed transactions, as in @@global.gtid_executed */
+class gtid_set
+{
+private:
+  typedef std::pair<int64_t, int64_t> interval_t;
+  /* Key is the 16 byte binary server uuid, intervals are sorted */
+  std::map<std::string, std::vector<interval_t> > intervals;
+
+public:
+  bool parse(const char *text);
+  bool contains(const unsigned char *sid, int64_t gno) const;
+  bool empty() const { return intervals.empty(); }
+  size_t get_interval_count() const;
+};
+
+typedef boost::shared_ptr<const gtid_set> gtid_set_ptr;
+
+extern bool gtid_mode_on;
+
+gtid_set_ptr get_executed_gtids();
+void set_executed_gtids(gtid_set_ptr set);
+bool read_gtid_event(int fd, uint64_t pos, uint32_t length,
+                     unsigned char *sid, int64_t *gno);
+void format_gtid(const unsigned char *sid, int64_t gno, char *buf, size_t size);
+
+#endif
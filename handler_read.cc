@@ -0,0 +1,273 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --handler-reads: primary and unique key lookups are prefetched with
+  HANDLER ... READ, which goes to the storage engine without the parser
+  and optimizer work of a SELECT.
+*/
+
+#include "handler_read.h"
+#include <ctype.h>
+#include <strings.h>
+
+/* Column name, possibly quoted and qualified; the last part is kept */
+static bool read_column(const char **p, std::string *name)
+{
+  while (1)
+  {
+    std::string part;
+    if (isdigit((unsigned char)**p) || !read_identifier(p, &part))
+      return false;
+    *name= part;
+    if (**p != '.')
+      return true;
+    (*p)++;
+  }
+}
+
+/* Number or quoted string, returned as written */
+static bool read_literal(const char **p, std::string *value)
+{
+  const char *start= *p;
+  if (**p == '\'' || **p == '"')
+  {
+    const char *end= skip_quoted(*p);
+    if (!end)
+      return false;
+    *p= end;
+  } else
+  {
+    if (**p == '-' || **p == '+')
+      (*p)++;
+    if (!isdigit((unsigned char)**p))
+      return false;
+    if (**p == '0' && ((*p)[1] == 'x' || (*p)[1] == 'X'))
+    {
+      *p+= 2;
+      while (isxdigit((unsigned char)**p))
+        (*p)++;
+    } else
+    {
+      while (isdigit((unsigned char)**p) || **p == '.')
+        (*p)++;
+      if (**p == 'e' || **p == 'E')
+      {
+        (*p)++;
+        if (**p == '-' || **p == '+')
+          (*p)++;
+        while (isdigit((unsigned char)**p))
+          (*p)++;
+      }
+    }
+    if (is_identifier_char(**p))
+      return false;
+  }
+  value->assign(start, *p - start);
+  return true;
+}
+
+bool parse_point_predicate(const std::string &where, equalities_t *equalities)
+{
+  const char *p= skip_comments(where.c_str());
+  int depth= 0;
+
+  equalities->clear();
+  match_keyword(&p, "where");
+  while (1)
+  {
+    std::string column, value;
+    while (*p == '(')
+    {
+      depth++;
+      p= skip_comments(p + 1);
+    }
+    if (!read_column(&p, &column))
+      return false;
+    p= skip_comments(p);
+    if (*p != '=')
+      return false;
+    p= skip_comments(p + 1);
+    if (!read_literal(&p, &value))
+      return false;
+    p= skip_comments(p);
+    while (*p == ')' && depth)
+    {
+      depth--;
+      p= skip_comments(p + 1);
+    }
+    equalities->push_back(std::make_pair(column, value));
+    if (!match_keyword(&p, "and"))
+      break;
+  }
+  if (depth)
+    return false;
+  if (match_keyword(&p, "limit"))
+  {
+    while (isdigit((unsigned char)*p) || *p == ',' || isspace((unsigned char)*p))
+      p++;
+  }
+  if (*p == ';')
+    p= skip_comments(p + 1);
+  return *p == '\0';
+}
+
+static const std::string *find_value(const equalities_t &equalities,
+                                     const std::string &column)
+{
+  for (size_t i= 0; i < equalities.size(); i++)
+  {
+    if (!strcasecmp(equalities[i].first.c_str(), column.c_str()))
+      return &equalities[i].second;
+  }
+  return NULL;
+}
+
+bool find_point_lookup(const table_meta_t *meta, const std::string &where,
+                       rewrite_info_t *info)
+{
+  equalities_t equalities;
+  if (!parse_point_predicate(where, &equalities))
+    return false;
+  /* The primary key first, then unique keys */
+  for (int pass= 0; pass < 2; pass++)
+  {
+    for (size_t i= 0; i < meta->indexes.size(); i++)
+    {
+      const index_info_t &index= meta->indexes[i];
+      if (pass == 0 ? !index.primary : (index.primary || !index.unique))
+        continue;
+      std::vector<std::string> values;
+      for (size_t j= 0; j < index.columns.size(); j++)
+      {
+        const std::string *value= find_value(equalities, index.columns[j]);
+        if (!value)
+          break;
+        values.push_back(*value);
+      }
+      if (values.empty() || values.size() != index.columns.size())
+        continue;
+      info->lookup_index= index.name;
+      info->lookup_values= values;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string make_handler_read(const std::string &alias,
+                              const rewrite_info_t &info)
+{
+  std::string sql("HANDLER `");
+  sql.append(alias);
+  sql.append("` READ `");
+  sql.append(info.lookup_index);
+  sql.append("` = (");
+  for (size_t i= 0; i < info.lookup_values.size(); i++)
+  {
+    if (i)
+      sql.append(",");
+    sql.append(info.lookup_values[i]);
+  }
+  sql.append(")");
+  return sql;
+}
+
+bool handler_cache::open(MYSQL *mysql, const rewrite_info_t &info,
+                         std::string *alias)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "rb_h%u", next_alias++);
+  std::string sql("HANDLER `");
+  sql.append(info.db);
+  sql.append("`.`");
+  sql.append(info.table);
+  sql.append("` OPEN AS `");
+  sql.append(name);
+  sql.append("`");
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    DBUG_PRINT("HANDLER OPEN failed: %d %s", mysql_errno(mysql), mysql_error(mysql));
+    return false;
+  }
+  alias->assign(name);
+  return true;
+}
+
+bool handler_cache::read(MYSQL *mysql, const rewrite_info_t &info,
+                         worker_stats_t *stats)
+{
+  if (ddl_generation_seen != ddl_generation)
+  {
+    close_all(mysql);
+    failed.clear();
+    ddl_generation_seen= ddl_generation;
+  }
+
+  std::string key(info.db);
+  key.append(1, '\0');
+  key.append(info.table);
+  std::map<std::string, std::string>::iterator it= aliases.find(key);
+  if (it == aliases.end())
+  {
+    std::string alias;
+    if (failed.count(key))
+      return false;
+    if (!open(mysql, info, &alias))
+    {
+      stats->handler_errors++;
+      failed.insert(key);
+      return false;
+    }
+    stats->handler_opens++;
+    it= aliases.insert(std::make_pair(key, alias)).first;
+  }
+
+  std::string sql= make_handler_read(it->second, info);
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    DBUG_PRINT("HANDLER READ failed: %d %s", mysql_errno(mysql), mysql_error(mysql));
+    stats->handler_errors++;
+    std::string close_sql("HANDLER `");
+    close_sql.append(it->second);
+    close_sql.append("` CLOSE");
+    mysql_real_query(mysql, close_sql.c_str(), close_sql.length());
+    aliases.erase(it);
+    return false;
+  }
+  MYSQL_RES *result= mysql_store_result(mysql);
+  mysql_free_result(result);
+  stats->handler_reads++;
+  return true;
+}
+
+void handler_cache::close_all(MYSQL *mysql)
+{
+  std::map<std::string, std::string>::iterator it;
+  for (it= aliases.begin(); it != aliases.end(); it++)
+  {
+    std::string sql("HANDLER `");
+    sql.append(it->second);
+    sql.append("` CLOSE");
+    mysql_real_query(mysql, sql.c_str(), sql.length());
+  }
+  aliases.clear();
+}
@@ -0,0 +1,78 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __handler_read_h_
+#define __handler_read_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "replication_booster.h"
+#include "schema_cache.h"
+
+typedef std::vector<std::pair<std::string, std::string> > equalities_t;
+
+/*
+  Parses a WHERE clause that is only "column = literal" terms joined by
+  AND, optionally followed by LIMIT. Columns may be quoted and qualified,
+  literals are numbers or strings. Returns false for anything else.
+*/
+bool parse_point_predicate(const std::string &where, equalities_t *equalities);
+
+/*
+  Fills info->lookup_index and info->lookup_values if the WHERE clause
+  fixes all columns of the primary key or of a unique key of the table.
+*/
+bool find_point_lookup(const table_meta_t *meta, const std::string &where,
+                       rewrite_info_t *info);
+
+/* HANDLER statement for a point lookup, as written by --dry-run */
+std::string make_handler_read(const std::string &alias,
+                              const rewrite_info_t &info);
+
+/*
+  HANDLER tables opened by one worker connection. HANDLER OPEN holds a
+  metadata lock on the table, so all handlers are closed when the relay
+  log reader has seen DDL (before the SQL thread gets to it) and when the
+  worker runs out of work.
+*/
+class handler_cache
+{
+private:
+  std::map<std::string, std::string> aliases;
+  /* Tables HANDLER OPEN failed on, e.g. views, until the next DDL */
+  std::set<std::string> failed;
+  uint next_alias;
+  uint ddl_generation_seen;
+
+  bool open(MYSQL *mysql, const rewrite_info_t &info, std::string *alias);
+
+public:
+  handler_cache() : next_alias(0), ddl_generation_seen(0) {}
+
+  /* Returns false if the caller should fall back to SELECT */
+  bool read(MYSQL *mysql, const rewrite_info_t &info, worker_stats_t *stats);
+  void close_all(MYSQL *mysql);
+  bool empty() const { return aliases.empty(); }
+};
+
+#endif
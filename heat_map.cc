@@ -0,0 +1,122 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#include "heat_map.h"
+#include <algorithm>
+
+table_heat_map *heat_map= NULL;
+
+static bool by_select_time(const table_heat_t &a, const table_heat_t &b)
+{
+  if (a.select_usec != b.select_usec)
+    return a.select_usec > b.select_usec;
+  return a.dispatched > b.dispatched;
+}
+
+table_heat_map::table_heat_map(size_t capacity) : capacity(capacity)
+{
+  entries.reserve(capacity);
+  pthread_mutex_init(&mutex, NULL);
+}
+
+table_heat_map::~table_heat_map()
+{
+  pthread_mutex_destroy(&mutex);
+}
+
+/* Must be called with mutex held */
+table_heat_t *table_heat_map::find_or_evict(const std::string &name)
+{
+  std::map<std::string, size_t>::iterator it= index.find(name);
+  if (it != index.end())
+    return &entries[it->second];
+
+  table_heat_t entry;
+  entry.name= name;
+  entry.dispatched= entry.overestimate= 0;
+  entry.executed= entry.errors= entry.stale= entry.missing= 0;
+  entry.select_usec= 0;
+  if (entries.size() < capacity)
+  {
+    index[name]= entries.size();
+    entries.push_back(entry);
+    return &entries.back();
+  }
+
+  size_t victim= 0;
+  for (size_t i= 1; i < entries.size(); i++)
+  {
+    if (entries[i].dispatched < entries[victim].dispatched)
+      victim= i;
+  }
+  index.erase(entries[victim].name);
+  entry.dispatched= entry.overestimate= entries[victim].dispatched;
+  entries[victim]= entry;
+  index[name]= victim;
+  return &entries[victim];
+}
+
+void table_heat_map::add(const std::string &db, const std::string &table,
+                         enum table_outcome outcome, uint64_t select_usec)
+{
+  if (table.empty())
+    return;
+  std::string name(db);
+  name.append(".");
+  name.append(table);
+
+  pthread_mutex_lock(&mutex);
+  table_heat_t *entry= find_or_evict(name);
+  entry->dispatched++;
+  switch (outcome)
+  {
+  case TABLE_EXECUTED: entry->executed++; break;
+  case TABLE_ERROR: entry->errors++; break;
+  case TABLE_STALE: entry->stale++; break;
+  case TABLE_MISSING: entry->missing++; break;
+  }
+  entry->select_usec+= select_usec;
+  pthread_mutex_unlock(&mutex);
+}
+
+void table_heat_map::get_top(size_t limit, std::vector<table_heat_t> *top)
+{
+  pthread_mutex_lock(&mutex);
+  *top= entries;
+  pthread_mutex_unlock(&mutex);
+  std::sort(top->begin(), top->end(), by_select_time);
+  if (top->size() > limit)
+    top->resize(limit);
+}
+
+void table_heat_map::print(FILE *stream, size_t limit)
+{
+  std::vector<table_heat_t> top;
+  get_top(limit, &top);
+  fprintf(stream, "Tables by SELECT time (dispatched executed errors stale missing seconds):\n");
+  for (size_t i= 0; i < top.size(); i++)
+  {
+    const table_heat_t &t= top[i];
+    fprintf(stream, "  %s: %lu%s %lu %lu %lu %lu %.3f\n", t.name.c_str(),
+            t.dispatched, t.overestimate ? "*" : "", t.executed, t.errors,
+            t.stale, t.missing, t.select_usec / 1e6);
+  }
+}
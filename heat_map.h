@@ -0,0 +1,85 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __heat_map_h_
+#define __heat_map_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include "replication_booster.h"
+
+/* Tables shown in the status output */
+#define HEAT_MAP_PRINT_LIMIT 20
+
+enum table_outcome
+{
+  TABLE_EXECUTED= 0,
+  TABLE_ERROR,
+  TABLE_STALE,
+  TABLE_MISSING,
+};
+
+typedef struct table_heat
+{
+  std::string name;
+  /* Queries for the table that reached a worker */
+  uint64_t dispatched;
+  /* Upper bound of dispatched queries counted for evicted tables */
+  uint64_t overestimate;
+  uint64_t executed;
+  uint64_t errors;
+  uint64_t stale;
+  uint64_t missing;
+  uint64_t select_usec;
+} table_heat_t;
+
+/*
+  Per table counters of the tables workers see most, bounded to a fixed
+  number of entries with the Space-Saving algorithm: a table that is not
+  tracked replaces the entry with the fewest dispatched queries and
+  inherits its count as overestimate. Tables dispatched more often than
+  1/capacity of all queries are always tracked.
+*/
+class table_heat_map
+{
+private:
+  std::vector<table_heat_t> entries;
+  std::map<std::string, size_t> index;
+  size_t capacity;
+  pthread_mutex_t mutex;
+
+  table_heat_t *find_or_evict(const std::string &name);
+
+public:
+  table_heat_map(size_t capacity);
+  ~table_heat_map();
+
+  void add(const std::string &db, const std::string &table,
+           enum table_outcome outcome, uint64_t select_usec);
+  /* Copy of the tracked tables, by descending SELECT time */
+  void get_top(size_t limit, std::vector<table_heat_t> *top);
+  void print(FILE *stream, size_t limit);
+};
+
+extern table_heat_map *heat_map;
+
+#endif
@@ -0,0 +1,283 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --instances: supervises one booster process per mysqld instance on the
+  host. Each line of the file is an instance name followed by the
+  options for that instance, e.g.
+
+    # name  options
+    db1     --socket=/var/lib/mysql1/mysql.sock --threads=8
+    db2     --socket=/var/lib/mysql2/mysql.sock --threads=4 --max-threads=8
+
+  Options on the command line apply to all instances, the options of a
+  line override them, so per instance caps such as --threads,
+  --max-threads or --throttle go there. Every instance runs in a child
+  process forked from this one and has its own reader, workers, caches
+  and connections; nothing is shared between instances beyond the pages
+  inherited from the fork. The status file, control socket and shared
+  memory names get ".<name>" appended so that instances do not overwrite
+  each other, and so do --state-file and --dry-run files of the command
+  line.
+  A child that fails is started again after INSTANCE_RESTART_DELAY_SEC.
+*/
+
+#include "replication_booster.h"
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <ctype.h>
+
+/* Wait before restarting a failed instance */
+#define INSTANCE_RESTART_DELAY_SEC 10
+#define MAX_INSTANCES 64
+
+typedef struct instance
+{
+  std::string name;
+  std::vector<std::string> args;
+  pid_t pid;
+  time_t restart_at;
+} instance_t;
+
+static volatile sig_atomic_t stop_instances= 0;
+
+extern "C" {
+  static void set_stop_instances(int);
+}
+
+static void set_stop_instances(int)
+{
+  stop_instances= 1;
+}
+
+static bool is_valid_name(const std::string &name)
+{
+  for (size_t i= 0; i < name.length(); i++)
+  {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-')
+      return false;
+  }
+  return !name.empty();
+}
+
+static bool read_instances(const char *path, std::vector<instance_t> *instances)
+{
+  char line[4096];
+  uint line_no= 0;
+  FILE *fp= fopen(path, "r");
+  if (!fp)
+  {
+    print_log("ERROR: Could not open instances file %s (%d)", path, errno);
+    return false;
+  }
+  while (fgets(line, sizeof(line), fp))
+  {
+    char *save= NULL, *token;
+    instance_t instance;
+    line_no++;
+    if (!(token= strtok_r(line, " \t\r\n", &save)) || *token == '#')
+      continue;
+    instance.name= token;
+    instance.pid= 0;
+    instance.restart_at= 0;
+    if (!is_valid_name(instance.name))
+    {
+      print_log("ERROR: %s:%u: invalid instance name %s", path, line_no, token);
+      fclose(fp);
+      return false;
+    }
+    for (size_t i= 0; i < instances->size(); i++)
+    {
+      if ((*instances)[i].name == instance.name)
+      {
+        print_log("ERROR: %s:%u: duplicate instance %s", path, line_no, token);
+        fclose(fp);
+        return false;
+      }
+    }
+    while ((token= strtok_r(NULL, " \t\r\n", &save)))
+      instance.args.push_back(token);
+    instances->push_back(instance);
+  }
+  fclose(fp);
+  if (instances->empty() || instances->size() > MAX_INSTANCES)
+  {
+    print_log("ERROR: %s must list 1 to %d instances.", path, MAX_INSTANCES);
+    return false;
+  }
+  return true;
+}
+
+/*
+  Command line of an instance: the shared options without --instances,
+  the per instance file names, then the options of its line.
+*/
+static std::vector<std::string> make_instance_args(int argc, char **argv,
+                                                   const instance_t &instance)
+{
+  /* Options replaced by per instance file names below */
+  static const char *per_instance[]= {"--instances", "--state-file", "--dry-run"};
+  std::vector<std::string> args;
+  std::string suffix= "." + instance.name;
+  args.push_back(argv[0]);
+  for (int i= 1; i < argc; i++)
+  {
+    bool skip= false;
+    for (size_t j= 0; j < sizeof(per_instance)/sizeof(char*) && !skip; j++)
+    {
+      size_t len= strlen(per_instance[j]);
+      if (!strncmp(argv[i], per_instance[j], len) &&
+          (!argv[i][len] || argv[i][len] == '='))
+      {
+        /* --dry-run takes its file only as --dry-run=file */
+        if (!argv[i][len] && j < 2)
+          i++;
+        skip= true;
+      }
+    }
+    if (!skip)
+      args.push_back(argv[i]);
+  }
+  if (opt_state_file)
+    args.push_back(std::string("--state-file=") + opt_state_file + suffix);
+  if (opt_dry_run)
+  {
+    if (!opt_dry_run_file)
+      args.push_back("--dry-run");
+    else if (!strcmp(opt_dry_run_file, "-"))
+      args.push_back("--dry-run=-");
+    else
+      args.push_back(std::string("--dry-run=") + opt_dry_run_file + suffix);
+  }
+  args.push_back(std::string("--status=") + opt_status_file + suffix);
+  if (opt_control_socket)
+    args.push_back(std::string("--control-socket=") + opt_control_socket + suffix);
+  if (opt_stats_shm)
+    args.push_back(std::string("--stats-shm=") + opt_stats_shm + suffix);
+  args.push_back(std::string("--trace-file=") + opt_trace_file + suffix);
+  args.insert(args.end(), instance.args.begin(), instance.args.end());
+  return args;
+}
+
+static pid_t start_instance(int argc, char **argv, instance_t *instance)
+{
+  std::vector<std::string> args= make_instance_args(argc, argv, *instance);
+  /* Buffered output would be written by both processes */
+  fflush(NULL);
+  pid_t pid= fork();
+  if (pid < 0)
+  {
+    print_log("ERROR: Could not start instance %s (%d)", instance->name.c_str(),
+              errno);
+    return pid;
+  }
+  if (pid)
+  {
+    print_log("Started instance %s, pid %d.", instance->name.c_str(), pid);
+    return pid;
+  }
+
+  /* Child: parse the instance's command line from scratch */
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  char **child_argv= new char*[args.size() + 1];
+  for (size_t i= 0; i < args.size(); i++)
+    child_argv[i]= strdup(args[i].c_str());
+  child_argv[args.size()]= NULL;
+  opt_instances_file= NULL;
+  opt_include_tables.clear();
+  opt_exclude_tables.clear();
+  optind= 0;
+  exit(replication_booster_main(args.size(), child_argv));
+}
+
+int supervise_instances(int argc, char **argv)
+{
+  std::vector<instance_t> instances;
+  if (!read_instances(opt_instances_file, &instances))
+    return 1;
+
+  signal(SIGINT, set_stop_instances);
+  signal(SIGTERM, set_stop_instances);
+  for (size_t i= 0; i < instances.size(); i++)
+  {
+    if ((instances[i].pid= start_instance(argc, argv, &instances[i])) < 0)
+      instances[i].restart_at= time(NULL) + INSTANCE_RESTART_DELAY_SEC;
+  }
+
+  uint running= instances.size();
+  while (running)
+  {
+    int status;
+    pid_t pid= waitpid(-1, &status, WNOHANG);
+    if (pid > 0)
+    {
+      for (size_t i= 0; i < instances.size(); i++)
+      {
+        if (instances[i].pid != pid)
+          continue;
+        instances[i].pid= 0;
+        if (stop_instances || (WIFEXITED(status) && !WEXITSTATUS(status)))
+        {
+          print_log("Instance %s stopped.", instances[i].name.c_str());
+          running--;
+        } else
+        {
+          print_log("ERROR: Instance %s failed (status %d), restarting in %d seconds.",
+                    instances[i].name.c_str(), status, INSTANCE_RESTART_DELAY_SEC);
+          instances[i].restart_at= time(NULL) + INSTANCE_RESTART_DELAY_SEC;
+        }
+      }
+      continue;
+    }
+
+    if (stop_instances == 1)
+    {
+      print_log("Stopping %u instances..", running);
+      stop_instances= 2;
+      for (size_t i= 0; i < instances.size(); i++)
+      {
+        if (instances[i].pid > 0)
+          kill(instances[i].pid, SIGTERM);
+        else if (instances[i].restart_at)
+        {
+          instances[i].restart_at= 0;
+          running--;
+        }
+      }
+      continue;
+    }
+    time_t now= time(NULL);
+    for (size_t i= 0; i < instances.size() && !stop_instances; i++)
+    {
+      if (!instances[i].restart_at || now < instances[i].restart_at)
+        continue;
+      if ((instances[i].pid= start_instance(argc, argv, &instances[i])) > 0)
+        instances[i].restart_at= 0;
+      else
+        instances[i].restart_at= now + INSTANCE_RESTART_DELAY_SEC;
+    }
+    usleep(100000);
+  }
+  return 0;
+}
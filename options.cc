@@ -24,10 +24,16 @@
 #include <string.h>
 #include <getopt.h>
 #include "options.h"
+#include "trace.h"
 
 uint opt_workers= 10;
+/* Bounds of the elastic worker pool, disabled if opt_max_workers is 0 */
+uint opt_min_workers= 1;
+uint opt_max_workers= 0;
 uint opt_skip_events= 500;
 uint opt_read_ahead_seconds= 3;
+uint64_t opt_skip_bytes= 0;
+uint opt_skip_seconds= 0;
 uint opt_sleep_millis_at_read_limit= 10000; // microseconds
 char *opt_slave_user= "root";
 char *opt_slave_password= "";
@@ -39,6 +45,62 @@ char *opt_slave_socket= NULL;
 const char default_status_file[]= "/var/spool/replication_booster.log";
 const char *opt_status_file= default_status_file;
 uint opt_status_update_freq= 30;
+bool opt_schema_cache= true;
+const char *opt_replay_file= NULL;
+bool opt_dry_run= false;
+bool opt_deadline_drop= true;
+const char *opt_state_file= NULL;
+const char *opt_instances_file= NULL;
+bool opt_state_file_enabled= true;
+const char *opt_dry_run_file= NULL;
+const char *opt_control_socket= NULL;
+const char *opt_stats_shm= NULL;
+uint opt_heat_map_size= 64;
+bool opt_handler_reads= false;
+uint opt_trace_records= 0;
+const char *opt_trace_file= "/tmp/replication_booster.trace";
+uint opt_relay_log_readahead_mb= 0;
+uint opt_coalesce_max= 0;
+uint opt_coalesce_window_ms= 5;
+bool opt_throttle= false;
+uint opt_throttle_util= 80;
+uint opt_throttle_pending_reads= 16;
+uint opt_explain_max_rows= 0;
+bool opt_explain_cap= false;
+std::vector<std::string> opt_include_tables;
+std::vector<std::string> opt_exclude_tables;
+
+/* Options without a short name */
+enum long_option_codes
+{
+  OPT_NO_SCHEMA_CACHE= 256,
+  OPT_REPLAY,
+  OPT_DRY_RUN,
+  OPT_NO_DEADLINE_DROP,
+  OPT_CONTROL_SOCKET,
+  OPT_STATS_SHM,
+  OPT_MIN_THREADS,
+  OPT_MAX_THREADS,
+  OPT_HEAT_MAP_SIZE,
+  OPT_TRACE,
+  OPT_TRACE_FILE,
+  OPT_HANDLER_READS,
+  OPT_INCLUDE,
+  OPT_EXCLUDE,
+  OPT_EXPLAIN_MAX_ROWS,
+  OPT_EXPLAIN_CAP,
+  OPT_RELAY_LOG_READAHEAD,
+  OPT_THROTTLE,
+  OPT_THROTTLE_UTIL,
+  OPT_THROTTLE_PENDING_READS,
+  OPT_COALESCE_MAX,
+  OPT_COALESCE_WINDOW_MS,
+  OPT_OFFSET_BYTES,
+  OPT_OFFSET_SECONDS,
+  OPT_STATE_FILE,
+  OPT_NO_STATE_FILE,
+  OPT_INSTANCES,
+};
 
 struct option long_options[] =
 {
@@ -46,6 +108,8 @@ struct option long_options[] =
   {"version", no_argument, 0, 'v'},
   {"threads", required_argument, 0, 't'},
   {"offset-events", required_argument, 0, 'o'},
+  {"offset-bytes", required_argument, 0, OPT_OFFSET_BYTES},
+  {"offset-seconds", required_argument, 0, OPT_OFFSET_SECONDS},
   {"seconds-prefetch", required_argument, 0, 's'},
   {"mlllis-sleep", required_argument, 0, 'm'},
   {"user", required_argument, 0, 'u'},
@@ -57,6 +121,31 @@ struct option long_options[] =
   {"socket", required_argument, 0, 'S'},
   {"status", required_argument, 0, 'f'},
   {"status-freq", required_argument, 0, 'F'},
+  {"no-schema-cache", no_argument, 0, OPT_NO_SCHEMA_CACHE},
+  {"replay", required_argument, 0, OPT_REPLAY},
+  {"dry-run", optional_argument, 0, OPT_DRY_RUN},
+  {"no-deadline-drop", no_argument, 0, OPT_NO_DEADLINE_DROP},
+  {"state-file", required_argument, 0, OPT_STATE_FILE},
+  {"no-state-file", no_argument, 0, OPT_NO_STATE_FILE},
+  {"instances", required_argument, 0, OPT_INSTANCES},
+  {"control-socket", required_argument, 0, OPT_CONTROL_SOCKET},
+  {"stats-shm", optional_argument, 0, OPT_STATS_SHM},
+  {"min-threads", required_argument, 0, OPT_MIN_THREADS},
+  {"max-threads", required_argument, 0, OPT_MAX_THREADS},
+  {"heat-map-size", required_argument, 0, OPT_HEAT_MAP_SIZE},
+  {"trace", optional_argument, 0, OPT_TRACE},
+  {"trace-file", required_argument, 0, OPT_TRACE_FILE},
+  {"handler-reads", no_argument, 0, OPT_HANDLER_READS},
+  {"include", required_argument, 0, OPT_INCLUDE},
+  {"exclude", required_argument, 0, OPT_EXCLUDE},
+  {"explain-max-rows", required_argument, 0, OPT_EXPLAIN_MAX_ROWS},
+  {"explain-cap", no_argument, 0, OPT_EXPLAIN_CAP},
+  {"relay-log-readahead", optional_argument, 0, OPT_RELAY_LOG_READAHEAD},
+  {"throttle", no_argument, 0, OPT_THROTTLE},
+  {"coalesce-max", required_argument, 0, OPT_COALESCE_MAX},
+  {"coalesce-window-ms", required_argument, 0, OPT_COALESCE_WINDOW_MS},
+  {"throttle-util", required_argument, 0, OPT_THROTTLE_UTIL},
+  {"throttle-pending-reads", required_argument, 0, OPT_THROTTLE_PENDING_READS},
   {0,0,0,0}
 };
 
@@ -70,6 +159,8 @@ void usage()
   printf("Options (short name):\n");
   printf(" -t, --threads=N                :Number of worker threads. Each worker thread converts binlog events and executes SELECT statements. Default is 10 (threads).\n");
   printf(" -o, --offset-events=N          :Number of binlog events that main thread (relay log reader thread) skips initially when reading relay logs. This number should be high when you have faster storage devices such as SSD. Default is 500 (events).\n");
+  printf("     --offset-bytes=N           :Also skip at least N bytes of relay log initially. Skipped events are located by their headers only, without decoding them. Default is 0.\n");
+  printf("     --offset-seconds=N         :Also skip events until their timestamp is N seconds past the SQL thread's. Jumps close to the target using positions remembered while reading the relay log. Default is 0.\n");
   printf(" -s, --seconds-prefetch=N       :Main thread stops reading relay log events when the event's timestamp is --seconds-prefetch seconds ahead of current SQL thread's timestamp. After that the main thread starts reading relay logs from SQL threads's position again. If this value is too high, worker threads will execute many more SELECT statements than necessary. Default value is 3 (seconds).\n");
   printf(" -m, --millis-sleep=N           :If --seconds-prefetch condition is met, main thread sleeps --millis-sleep milliseconds before starting reading relay log. Default is 10 milliseconds.\n");
   printf(" -u, --user=mysql_user          :MySQL slave user name. This user should have at least SELECT privilege on all application tables (default: root)\n");
@@ -82,6 +173,31 @@ void usage()
   printf(" -f, --status=file              :Where to store the current status\n");
   printf(" -F, --status-freq=sec          :How often (in seconds) the status file is updated\n");
   printf("                                 Default is 30 seconds, 0 to disable.\n");
+  printf("     --no-schema-cache          :Do not load table definitions from information_schema. Without them, prefetches for dropped tables are executed (and fail) and DELETE statements are converted to \"select *\".\n");
+  printf("     --replay=relay_log_file    :Offline mode. Reads the relay log file (and the relay logs it rotates to) at full speed without connecting to MySQL, and implies --dry-run. Used for measuring reader and rewriter throughput.\n");
+  printf("     --dry-run[=file]           :Do not execute SELECT statements. If a file is given (\"-\" for stdout), each statement is written as relay log position, database and SELECT separated by tabs, otherwise they are only counted.\n");
+  printf("     --no-deadline-drop         :Execute queued queries even if the SQL thread is expected to reach them before the SELECT finishes. By default such queries are dropped, based on the SQL thread's recent apply rate and the average SELECT time.\n");
+  printf("     --state-file=path          :Where the reader position, cached EXPLAIN plans, the names of tables with cached definitions and tuned values (worker count, throttle rate, latency and apply rate estimates) are saved at most once a minute when the status file is updated and at shutdown, and loaded from at startup. Default is the status file name with \".state\" appended.\n");
+  printf("     --no-state-file            :Do not save or load the state file.\n");
+  printf("     --instances=file           :Supervise one replication_booster process per local mysqld instance. Each line of the file is an instance name followed by options for that instance, which override the options on the command line (e.g. --socket, --threads, --max-threads, --throttle). Instances share no workers or caches. Each runs in its own child process, which is restarted if it fails. \".<name>\" is appended to the status file, control socket and shared memory names.\n");
+  printf("     --control-socket=path      :Listen on a Unix domain socket for commands: status, stats, get, set threads|seconds-prefetch|offset-events|offset-bytes|offset-seconds|millis-sleep N, pause, resume, flush. Changes take effect without restarting.\n");
+  printf("     --min-threads=N            :Lower bound of the worker pool when --max-threads is set. Default is 1.\n");
+  printf("     --max-threads=N            :Grow and shrink the worker pool between --min-threads and N, based on queue depth, SELECT latency and the share of queries that are too late to prefetch. --threads is the initial size. Disabled by default.\n");
+  printf("     --heat-map-size=N          :Number of tables to keep per table statistics for (queries, executed, errors, stale, missing table, SELECT time). The busiest tables are kept when there are more. Default is 64, 0 to disable.\n");
+  printf("     --handler-reads            :Prefetch statements whose WHERE clause fixes the primary key or a unique key with HANDLER ... READ instead of SELECT, skipping the server's parser and optimizer. Workers keep the HANDLER tables open while they are busy. Needs table definitions, so not with --no-schema-cache.\n");
+  printf("     --coalesce-max=N           :Merge up to N statements whose WHERE clause is a single \"column = constant\" on the same table and column into one SELECT ... WHERE column IN (...). Disabled (0) by default.\n");
+  printf("     --coalesce-window-ms=N     :Longest time the first statement of such a group waits for others. Default is 5.\n");
+  printf("     --throttle                 :Limit the rate of prefetch SELECTs while the server is overloaded, so that they do not compete with the SQL thread's reads. Checked every 2 seconds from InnoDB pending reads, buffer pool free page waits and the utilization of the data directory's disk in /proc/diskstats. The rate is halved while overloaded and raised again by a quarter while not.\n");
+  printf("     --throttle-util=PCT        :Disk utilization above which the server counts as overloaded. Default is 80.\n");
+  printf("     --throttle-pending-reads=N :InnoDB pending reads above which the server counts as overloaded, 0 to ignore them. Default is 16.\n");
+  printf("     --relay-log-readahead[=MB] :Ask the kernel to read the relay logs from the SQL thread position to MB (default 16) megabytes past the prefetch position into the page cache, including the following relay log files, and to drop the parts the SQL thread has applied. Disabled by default.\n");
+  printf("     --explain-max-rows=N       :EXPLAIN each new statement template once and skip SELECTs whose plan is a range or scan estimated to read more than N rows, so that prefetching does not evict the pages the SQL thread needs. Point lookups are never skipped. Disabled (0) by default.\n");
+  printf("     --explain-cap              :With --explain-max-rows, run such SELECTs with LIMIT N instead of skipping them, unless they already have a LIMIT.\n");
+  printf("     --include=db.table         :Only prefetch statements on matching tables. %% and _ are wildcards as in replicate-wild-do-table. May be given more than once.\n");
+  printf("     --exclude=db.table         :Do not prefetch statements on matching tables, checked before --include. May be given more than once. Statements the SQL thread skips because of replicate-* options are never prefetched.\n");
+  printf("     --trace[=N]                :Record the last N (default %d) pipeline steps of each thread: event read, queued, popped, dropped, rewritten, SELECT start and end, and SQL thread positions. The records are written to --trace-file on SIGUSR1 or the control socket \"trace\" command. Convert them with replication_booster_trace.\n", TRACE_DEFAULT_RECORDS);
+  printf("     --trace-file=path          :Where to write traces. Default is /tmp/replication_booster.trace.\n");
+  printf("     --stats-shm[=name]         :Publish statistics, positions, queue depths and a SELECT latency histogram in a POSIX shared memory segment (default name %s), updated every 100 milliseconds. Read it with replication_booster_stat.\n", STATS_SHM_DEFAULT_NAME);
   exit(1);
 }
 
@@ -101,7 +217,7 @@ void get_options(int argc, char **argv)
       case '?': usage(); break;
       case 'v': print_version(); break;
       case 't': value= atoi(optarg);
-        opt_workers= value < 1 ? 1 : value;
+        opt_workers= value < 1 ? 1 : value > MAX_WORKERS ? MAX_WORKERS : value;
         break;
       case 'o': value= atoi(optarg);
         opt_skip_events= value < 0 ? 0 : value;
@@ -121,8 +237,76 @@ void get_options(int argc, char **argv)
       case 'F': value= atoi(optarg);
         opt_status_update_freq= value < 1 ? 0 : value;
         break;
+      case OPT_NO_SCHEMA_CACHE: opt_schema_cache= false; break;
+      case OPT_REPLAY: opt_replay_file= optarg; opt_dry_run= true; break;
+      case OPT_DRY_RUN: opt_dry_run= true;
+        opt_dry_run_file= optarg;
+        break;
+      case OPT_NO_DEADLINE_DROP: opt_deadline_drop= false; break;
+      case OPT_STATE_FILE: opt_state_file= optarg; break;
+      case OPT_NO_STATE_FILE: opt_state_file_enabled= false; break;
+      case OPT_INSTANCES: opt_instances_file= optarg; break;
+      case OPT_CONTROL_SOCKET: opt_control_socket= optarg; break;
+      case OPT_MIN_THREADS: value= atoi(optarg);
+        opt_min_workers= value < 1 ? 1 : value > MAX_WORKERS ? MAX_WORKERS : value;
+        break;
+      case OPT_MAX_THREADS: value= atoi(optarg);
+        opt_max_workers= value < 0 ? 0 : value > MAX_WORKERS ? MAX_WORKERS : value;
+        break;
+      case OPT_HEAT_MAP_SIZE: value= atoi(optarg);
+        opt_heat_map_size= value < 0 ? 0 : value;
+        break;
+      case OPT_TRACE:
+        value= optarg ? atoi(optarg) : TRACE_DEFAULT_RECORDS;
+        opt_trace_records= value < 0 ? 0 : value;
+        break;
+      case OPT_TRACE_FILE: opt_trace_file= optarg; break;
+      case OPT_HANDLER_READS: opt_handler_reads= true; break;
+      case OPT_EXPLAIN_MAX_ROWS: value= atoi(optarg);
+        opt_explain_max_rows= value < 0 ? 0 : value;
+        break;
+      case OPT_EXPLAIN_CAP: opt_explain_cap= true; break;
+      case OPT_OFFSET_BYTES: opt_skip_bytes= strtoull(optarg, NULL, 10); break;
+      case OPT_OFFSET_SECONDS: value= atoi(optarg);
+        opt_skip_seconds= value < 0 ? 0 : value;
+        break;
+      case OPT_COALESCE_MAX: value= atoi(optarg);
+        opt_coalesce_max= value < 0 ? 0 : value;
+        break;
+      case OPT_COALESCE_WINDOW_MS: value= atoi(optarg);
+        opt_coalesce_window_ms= value < 0 ? 0 : value;
+        break;
+      case OPT_THROTTLE: opt_throttle= true; break;
+      case OPT_THROTTLE_UTIL: value= atoi(optarg);
+        opt_throttle_util= value < 1 ? 1 : value > 100 ? 100 : value;
+        break;
+      case OPT_THROTTLE_PENDING_READS: value= atoi(optarg);
+        opt_throttle_pending_reads= value < 0 ? 0 : value;
+        break;
+      case OPT_RELAY_LOG_READAHEAD:
+        value= optarg ? atoi(optarg) : RELAY_LOG_READAHEAD_DEFAULT_MB;
+        opt_relay_log_readahead_mb= value < 0 ? 0 : value;
+        break;
+      case OPT_INCLUDE:
+      case OPT_EXCLUDE:
+        if (!strchr(optarg, '.'))
+          usage();
+        (c == OPT_INCLUDE ? opt_include_tables : opt_exclude_tables).push_back(optarg);
+        break;
+      case OPT_STATS_SHM:
+        opt_stats_shm= optarg ? optarg : STATS_SHM_DEFAULT_NAME;
+        break;
       default: usage();  break;
     }
   }
+  if (opt_max_workers)
+  {
+    if (opt_min_workers > opt_max_workers)
+      opt_min_workers= opt_max_workers;
+    if (opt_workers < opt_min_workers)
+      opt_workers= opt_min_workers;
+    if (opt_workers > opt_max_workers)
+      opt_workers= opt_max_workers;
+  }
 }
 
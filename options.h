@@ -22,11 +22,20 @@
 #ifndef __options_h_
 #define __options_h_
 
+#include <string>
+#include <vector>
 #include "replication_booster.h"
 
+/* Upper limit of --threads and of "set threads" on the control socket */
+#define MAX_WORKERS 256
+
 extern uint opt_workers;
+extern uint opt_min_workers;
+extern uint opt_max_workers;
 extern uint opt_skip_events;
 extern uint opt_read_ahead_seconds;
+extern uint64_t opt_skip_bytes;
+extern uint opt_skip_seconds;
 extern uint opt_sleep_millis_at_read_limit;
 extern char *opt_slave_user;
 extern char *opt_slave_password;
@@ -37,6 +46,32 @@ extern int opt_slave_port;
 extern char *opt_slave_socket;
 extern const char *opt_status_file;
 extern uint opt_status_update_freq;
+extern bool opt_schema_cache;
+extern const char *opt_replay_file;
+extern bool opt_dry_run;
+extern bool opt_deadline_drop;
+extern const char *opt_state_file;
+extern const char *opt_instances_file;
+extern bool opt_state_file_enabled;
+extern const char *opt_dry_run_file;
+extern const char *opt_control_socket;
+extern const char *opt_stats_shm;
+extern uint opt_heat_map_size;
+extern bool opt_handler_reads;
+extern uint opt_trace_records;
+extern const char *opt_trace_file;
+/* Window of --relay-log-readahead past the prefetch position */
+#define RELAY_LOG_READAHEAD_DEFAULT_MB 16
+extern uint opt_relay_log_readahead_mb;
+extern uint opt_coalesce_max;
+extern uint opt_coalesce_window_ms;
+extern bool opt_throttle;
+extern uint opt_throttle_util;
+extern uint opt_throttle_pending_reads;
+extern uint opt_explain_max_rows;
+extern bool opt_explain_cap;
+extern std::vector<std::string> opt_include_tables;
+extern std::vector<std::string> opt_exclude_tables;
 
 void get_options(int argc, char **argv);
 
@@ -0,0 +1,269 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --explain-max-rows: a DELETE on an unindexed column, or an UPDATE
+  without WHERE, becomes a SELECT that scans the whole table. It evicts
+  the pages the SQL thread needs and may run longer than the statement
+  itself. Such SELECTs are recognized from EXPLAIN and not executed.
+*/
+
+#include "plan_cache.h"
+#include "schema_cache.h"
+#include <ctype.h>
+#include <strings.h>
+
+/* Upper bound of cached plans, the cache is simply cleared beyond it */
+#define MAX_PLANS 10000
+
+plan_cache *plans= NULL;
+
+std::string make_query_template(const char *query, size_t length)
+{
+  std::string tmpl;
+  const char *p= query, *end= query + length;
+
+  tmpl.reserve(length);
+  while (p < end)
+  {
+    if (isspace((unsigned char)*p))
+    {
+      while (p < end && isspace((unsigned char)*p))
+        p++;
+      if (!tmpl.empty())
+        tmpl.append(1, ' ');
+      continue;
+    }
+    if (*p == '`')
+    {
+      const char *start= p;
+      p= skip_quoted(p);
+      if (!p || p > end)
+        p= end;
+      tmpl.append(start, p - start);
+      continue;
+    }
+    bool literal= false;
+    if (*p == '\'' || *p == '"')
+    {
+      p= skip_quoted(p);
+      if (!p || p > end)
+        p= end;
+      literal= true;
+    } else if (isdigit((unsigned char)*p) &&
+               (tmpl.empty() || !is_identifier_char(tmpl[tmpl.length() - 1])))
+    {
+      while (p < end && (isalnum((unsigned char)*p) || *p == '.'))
+        p++;
+      literal= true;
+    } else if (is_identifier_char(*p))
+    {
+      while (p < end && is_identifier_char(*p))
+        tmpl.append(1, *p++);
+      continue;
+    }
+    if (!literal)
+    {
+      tmpl.append(1, *p++);
+      continue;
+    }
+    /* "(?, ?, ?)" becomes "(?)" */
+    size_t len= tmpl.length();
+    if (len >= 2 && tmpl[len - 1] == ',' && tmpl[len - 2] == '?')
+      tmpl.erase(len - 1);
+    else if (len >= 3 && tmpl[len - 1] == ' ' && tmpl[len - 2] == ',' &&
+             tmpl[len - 3] == '?')
+      tmpl.erase(len - 2);
+    else
+      tmpl.append(1, '?');
+  }
+  return tmpl;
+}
+
+plan_cache::plan_cache()
+  : ddl_generation_seen(ddl_generation)
+{
+  pthread_mutex_init(&mutex, NULL);
+}
+
+plan_cache::~plan_cache()
+{
+  pthread_mutex_destroy(&mutex);
+}
+
+bool plan_cache::get(const std::string &key, plan_info_t *plan)
+{
+  bool found= false;
+  pthread_mutex_lock(&mutex);
+  if (ddl_generation_seen != ddl_generation)
+  {
+    plans.clear();
+    ddl_generation_seen= ddl_generation;
+  }
+  std::map<std::string, plan_info_t>::iterator it= plans.find(key);
+  if (it != plans.end())
+  {
+    *plan= it->second;
+    found= true;
+  }
+  pthread_mutex_unlock(&mutex);
+  return found;
+}
+
+void plan_cache::put(const std::string &key, const plan_info_t &plan)
+{
+  pthread_mutex_lock(&mutex);
+  if (plans.size() >= MAX_PLANS)
+    plans.clear();
+  plans[key]= plan;
+  pthread_mutex_unlock(&mutex);
+}
+
+uint plan_cache::get_size()
+{
+  pthread_mutex_lock(&mutex);
+  uint size= plans.size();
+  pthread_mutex_unlock(&mutex);
+  return size;
+}
+
+void plan_cache::get_all(std::map<std::string, plan_info_t> *out)
+{
+  pthread_mutex_lock(&mutex);
+  *out= plans;
+  pthread_mutex_unlock(&mutex);
+}
+
+static enum plan_class classify_access_type(const char *type)
+{
+  if (!type)
+    return PLAN_POINT;
+  if (!strcmp(type, "system") || !strcmp(type, "const") ||
+      !strcmp(type, "eq_ref"))
+    return PLAN_POINT;
+  if (!strcmp(type, "ALL") || !strcmp(type, "index"))
+    return PLAN_SCAN;
+  return PLAN_RANGE;
+}
+
+/*
+  The plan class is the worst access type of all tables, the estimated
+  rows the product of their row estimates as for a nested loop join.
+*/
+static bool explain(MYSQL *mysql, const char *select, uint length,
+                    plan_info_t *plan)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  MYSQL_FIELD *fields;
+  int type_field= -1, rows_field= -1;
+  std::string sql("EXPLAIN ");
+  sql.append(select, length);
+
+  plan->plan= PLAN_UNKNOWN;
+  plan->rows= 0;
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    DBUG_PRINT("EXPLAIN failed: %d %s", mysql_errno(mysql), mysql_error(mysql));
+    return false;
+  }
+  if (!(result= mysql_store_result(mysql)))
+    return false;
+  fields= mysql_fetch_fields(result);
+  for (uint i= 0; i < mysql_num_fields(result); i++)
+  {
+    if (!strcasecmp(fields[i].name, "type"))
+      type_field= i;
+    else if (!strcasecmp(fields[i].name, "rows"))
+      rows_field= i;
+  }
+  if (type_field < 0 || rows_field < 0)
+  {
+    mysql_free_result(result);
+    return false;
+  }
+  plan->rows= 1;
+  while ((row= mysql_fetch_row(result)))
+  {
+    enum plan_class access= classify_access_type(row[type_field]);
+    uint64_t rows= row[rows_field] ? strtoull(row[rows_field], NULL, 10) : 0;
+    if (access > plan->plan)
+      plan->plan= access;
+    if (rows && plan->rows > UINT64_MAX / rows)
+      plan->rows= UINT64_MAX;
+    else
+      plan->rows*= rows;
+  }
+  if (plan->plan == PLAN_UNKNOWN)
+    plan->plan= PLAN_POINT;
+  mysql_free_result(result);
+  return true;
+}
+
+static bool has_limit(const std::string &tmpl)
+{
+  for (size_t pos= tmpl.find(' '); pos != std::string::npos;
+       pos= tmpl.find(' ', pos + 1))
+  {
+    if (!strncasecmp(tmpl.c_str() + pos, " limit ", 7))
+      return true;
+  }
+  return false;
+}
+
+bool gate_select(MYSQL *mysql, const std::string &db, char **select,
+                 uint *length, worker_stats_t *stats)
+{
+  plan_info_t plan;
+  std::string key(db);
+  key.append(1, '\0');
+  key.append(make_query_template(*select, *length));
+
+  if (!plans->get(key, &plan))
+  {
+    stats->explain_queries++;
+    if (!explain(mysql, *select, *length, &plan))
+      stats->explain_errors++;
+    plans->put(key, plan);
+  }
+  if (plan.plan == PLAN_UNKNOWN || plan.plan == PLAN_POINT ||
+      plan.rows <= opt_explain_max_rows)
+    return true;
+
+  if (opt_explain_cap && !has_limit(key))
+  {
+    char limit[32];
+    int limit_len= snprintf(limit, sizeof(limit), " limit %u", opt_explain_max_rows);
+    char *capped= new char[*length + limit_len + 1];
+    memcpy(capped, *select, *length);
+    memcpy(capped + *length, limit, limit_len + 1);
+    delete[] *select;
+    *select= capped;
+    *length+= limit_len;
+    stats->capped_selects++;
+    return true;
+  }
+  if (plan.plan == PLAN_SCAN)
+    stats->gated_scans++;
+  else
+    stats->gated_ranges++;
+  return false;
+}
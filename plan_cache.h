@@ -0,0 +1,85 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __plan_cache_h_
+#define __plan_cache_h_
+
+#include <string>
+#include <map>
+#include "replication_booster.h"
+
+enum plan_class
+{
+  PLAN_UNKNOWN= 0,
+  /* const, eq_ref: at most one row per table */
+  PLAN_POINT,
+  /* ref, range, index_merge and similar index accesses */
+  PLAN_RANGE,
+  /* ALL, index: full table or full index scan */
+  PLAN_SCAN,
+};
+
+typedef struct plan_info
+{
+  enum plan_class plan;
+  uint64_t rows;
+} plan_info_t;
+
+/*
+  Statement text with literals replaced by "?", whitespace collapsed and
+  value lists shortened to one element, so that statements differing only
+  in their values share a template.
+*/
+std::string make_query_template(const char *query, size_t length);
+
+/*
+  EXPLAIN results per (database, statement template). A template is
+  explained once by the first worker that sees it. All plans are dropped
+  when the relay log reader has seen DDL.
+*/
+class plan_cache
+{
+private:
+  std::map<std::string, plan_info_t> plans;
+  pthread_mutex_t mutex;
+  uint ddl_generation_seen;
+
+public:
+  plan_cache();
+  ~plan_cache();
+
+  bool get(const std::string &key, plan_info_t *plan);
+  void put(const std::string &key, const plan_info_t &plan);
+  uint get_size();
+  void get_all(std::map<std::string, plan_info_t> *out);
+};
+
+extern plan_cache *plans;
+
+/*
+  Decides with the cached plan whether a prefetch SELECT is cheap enough
+  to run. Returns false if it should be skipped. With --explain-cap an
+  expensive SELECT is given a LIMIT instead, replacing *select.
+*/
+bool gate_select(MYSQL *mysql, const std::string &db, char **select,
+                 uint *length, worker_stats_t *stats);
+
+#endif
@@ -20,84 +20,83 @@
 **/
 
 #include "replication_booster.h"
-#include <boost/regex.hpp>
+#include "schema_cache.h"
+#include "heat_map.h"
+#include "trace.h"
+#include "handler_read.h"
+#include "plan_cache.h"
+#include "coalesce.h"
+#include "session_context.h"
+#include <algorithm>
+#include <errno.h>
 
 uint64_t stat_popped_queries= 0;
 uint64_t stat_old_queries= 0;
 uint64_t stat_discarded_queries= 0;
 uint64_t stat_converted_queries= 0;
 uint64_t stat_executed_selects= 0;
+uint64_t stat_dry_run_selects= 0;
 uint64_t stat_error_selects= 0;
+uint64_t stat_missing_table_queries= 0;
+uint64_t stat_late_queries= 0;
+uint64_t stat_select_usec= 0;
+uint64_t stat_select_hist[STATS_HIST_BUCKETS];
+uint64_t stat_handler_reads= 0;
+uint64_t stat_handler_usec= 0;
+uint64_t stat_handler_errors= 0;
+uint64_t stat_handler_opens= 0;
+uint64_t stat_explain_queries= 0;
+uint64_t stat_explain_errors= 0;
+uint64_t stat_gated_scans= 0;
+uint64_t stat_gated_ranges= 0;
+uint64_t stat_capped_selects= 0;
+uint64_t stat_in_probes= 0;
+uint64_t stat_session_changes= 0;
+uint64_t stat_session_errors= 0;
+uint64_t stat_rewrites[STMT_CLASSES][REWRITE_OUTCOMES];
+/* Moving average of SELECT execution time over all workers */
+double select_latency_usec= 0;
 
-const char *update_pattern= "\\A.*?update(?:\\s+(?:low_priority|ignore))?\\s+(.*?)\\s+set\\b(.*?)(?:\\s*where\\b(.*?))?(limit\\s*[0-9]+(?:\\s*,\\s*[0-9]+)?)?\\Z";
-const char *delete_pattern= "\\A.*?delete\\s(.*?)\\bfrom\\b(.*)\\Z";
+static FILE *dry_run_fp= NULL;
+static pthread_mutex_t dry_run_mutex= PTHREAD_MUTEX_INITIALIZER;
 
-const boost::regex update_exp(update_pattern,
-  boost::regbase::normal | boost::regbase::icase);
-const boost::regex delete_exp(delete_pattern,
-  boost::regbase::normal | boost::regbase::icase);
-
-static char* convert_to_select(const std::string query, uint *length)
+int open_dry_run_output()
 {
-  std::string select;
-  char *buf;
-  boost::smatch result;
-
-  if (boost::regex_search(query, result, update_exp))
-  {
-    DBUG_PRINT("Match UPDATE.");
-    select = "select isnull(coalesce(";
-    select.append(result.str(2));
-    select.append(")) from ");
-    select.append(result.str(1));
-    if (result.position(3) != -1)
-    {
-      select.append(" where ");
-      select.append(result.str(3));
-    }
-    if (result.position(4) != -1)
-    {
-      select.append(" ");
-      select.append(result.str(4));
-    }
-    DBUG_PRINT(result.str(1));
-    DBUG_PRINT(result.str(2));
-    DBUG_PRINT(result.str(3));
-    DBUG_PRINT(result.str(4));
-  } else if (boost::regex_search(query, result, delete_exp))
-  {
-    DBUG_PRINT("Match DELETE.");
-    select = "select * from ";
-    select.append(result.str(2));
-    DBUG_PRINT(result.str(1));
-    DBUG_PRINT(result.str(2));
-  } else
+  if (!opt_dry_run || !opt_dry_run_file)
+    return 0;
+  if (!strcmp(opt_dry_run_file, "-"))
+    dry_run_fp= stdout;
+  else if (!(dry_run_fp= fopen(opt_dry_run_file, "w")))
   {
-    DBUG_PRINT("Not matched UPDATE/DELETE.");
-    goto unmatch;
+    print_log("ERROR: Failed to open %s, %d %s",
+              opt_dry_run_file, errno, strerror(errno));
+    return 1;
   }
+  return 0;
+}
 
-  DBUG_PRINT(select);
-  *length= select.length();
-  buf= new char[*length + 1];
-  strcpy(buf, select.c_str());
-  return buf;
-
-unmatch:
-  return NULL;
+void close_dry_run_output()
+{
+  if (dry_run_fp && dry_run_fp != stdout)
+    fclose(dry_run_fp);
+  else if (dry_run_fp)
+    fflush(dry_run_fp);
+  dry_run_fp= NULL;
 }
 
-struct worker_stats_t
+static void write_dry_run(const query_t *query, const char *select_query,
+                          uint select_len)
 {
-  uint64_t popped_queries;
-  uint64_t old_queries;
-  uint64_t discarded_queries;
-  uint64_t converted_queries;
-  uint64_t executed_selects;
-  uint64_t error_selects;
-};
-
-static void update_stats(worker_stats_t *stats)
+  if (!dry_run_fp)
+    return;
+  pthread_mutex_lock(&dry_run_mutex);
+  fprintf(dry_run_fp, "%lu\t%s\t", query->pos, query->qev->db_name.c_str());
+  fwrite(select_query, 1, select_len, dry_run_fp);
+  fputc('\n', dry_run_fp);
+  pthread_mutex_unlock(&dry_run_mutex);
+}
+
+void update_stats(worker_stats_t *stats)
 {
   static const worker_stats_t reset= {0};
   pthread_mutex_lock(&worker_mutex);
@@ -106,11 +105,82 @@ static void update_stats(worker_stats_t *stats)
   stat_discarded_queries += stats->discarded_queries;
   stat_converted_queries += stats->converted_queries;
   stat_executed_selects += stats->executed_selects;
+  stat_dry_run_selects += stats->dry_run_selects;
   stat_error_selects += stats->error_selects;
+  stat_missing_table_queries += stats->missing_table_queries;
+  stat_late_queries += stats->late_queries;
+  stat_select_usec += stats->select_usec;
+  for (uint i= 0; i < STATS_HIST_BUCKETS; i++)
+    stat_select_hist[i] += stats->select_hist[i];
+  stat_handler_reads += stats->handler_reads;
+  stat_handler_usec += stats->handler_usec;
+  stat_handler_errors += stats->handler_errors;
+  stat_handler_opens += stats->handler_opens;
+  stat_explain_queries += stats->explain_queries;
+  stat_explain_errors += stats->explain_errors;
+  stat_gated_scans += stats->gated_scans;
+  stat_gated_ranges += stats->gated_ranges;
+  stat_capped_selects += stats->capped_selects;
+  stat_in_probes += stats->in_probes;
+  stat_session_changes += stats->session_changes;
+  stat_session_errors += stats->session_errors;
+  for (uint i= 0; i < STMT_CLASSES; i++)
+    for (uint j= 0; j < REWRITE_OUTCOMES; j++)
+      stat_rewrites[i][j] += stats->rewrites[i][j];
+  if (stats->select_count)
+  {
+    double latency= (double)stats->select_usec / stats->select_count;
+    select_latency_usec= select_latency_usec ?
+      0.9 * select_latency_usec + 0.1 * latency : latency;
+  }
   pthread_mutex_unlock(&worker_mutex);
   *stats= reset;
 }
 
+/* Attributes a query that was not prefetched to its table */
+static void note_stale_table(const query_t *query)
+{
+  const char *db= query->target_table;
+  if (db)
+    heat_map->add(db, db + strlen(db) + 1, TABLE_STALE, 0);
+}
+
+/*
+  Drops the lookups of a coalesced chain that the SQL thread has passed
+  or is about to pass. Returns the new first query, NULL if none is left.
+*/
+static query_t *prune_lookups(query_t *query, worker_stats_t *stats)
+{
+  query_t *head= NULL, **link= &head;
+  while (query)
+  {
+    query_t *next= query->next;
+    query->next= NULL;
+    bool applied= is_applied(query);
+    if (applied || is_too_late(query))
+    {
+      if (applied)
+      {
+        stats->old_queries++;
+        TRACE(TRACE_DROP_OLD, query->file_seq, query->pos, 0);
+      } else
+      {
+        stats->late_queries++;
+        TRACE(TRACE_DROP_LATE, query->file_seq, query->pos, 0);
+      }
+      if (heat_map)
+        note_stale_table(query);
+      free_query(query);
+    } else
+    {
+      *link= query;
+      link= &query->next;
+    }
+    query= next;
+  }
+  return head;
+}
+
 void* prefetch_worker(void *worker_info)
 {
   int ret= 0;
@@ -121,7 +191,22 @@ void* prefetch_worker(void *worker_info)
   uint worker_id= info->worker_id;
   worker_stats_t stats= {0};
   my_bool reconnect= true;
+  handler_cache handlers;
+  session_state session;
+  session_context_t context;
 
+  query_t *query;
+  if (tracing)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "worker %u", worker_id);
+    trace_register_thread(name);
+  }
+  if (opt_dry_run)
+  {
+    mysql= NULL;
+    goto run;
+  }
   mysql= mysql_init(NULL);
   if (!mysql)
   {
@@ -136,30 +221,90 @@ void* prefetch_worker(void *worker_info)
     print_log("ERROR: Worker failed to connect to MySQL: %d, %s", mysql_errno(mysql),mysql_error(mysql));
     goto err;
   }
-  query_t *query;
 
+run:
   while (1)
   {
     update_stats(&stats);
+    /* Do not hold metadata locks while idle */
+    if (!handlers.empty() && !queue[worker_id]->get_size())
+      handlers.close_all(mysql);
     query= queue[worker_id]->wait_and_pop();
     if (query->shutdown)
     {
       delete query;
+      if (!shutdown_program && worker_id >= opt_workers)
+        retire_worker(worker_id);
       goto end;
     }
     stats.popped_queries++;
+    TRACE(TRACE_POP, query->file_seq, query->pos, 0);
+    if (query->next && !(query= prune_lookups(query, &stats)))
+      continue;
 
-    if (query->pos <= sql_thread_pos)
+    if (is_applied(query))
     {
       stats.old_queries++;
+      TRACE(TRACE_DROP_OLD, query->file_seq, query->pos, 0);
+      if (heat_map)
+        note_stale_table(query);
+      free_query(query);
+      continue;
+    }
+    if (is_too_late(query))
+    {
+      stats.late_queries++;
+      TRACE(TRACE_DROP_LATE, query->file_seq, query->pos, 0);
+      if (heat_map)
+        note_stale_table(query);
       free_query(query);
       continue;
     }
 
     const mysql::Query_event *qev= query->qev;
     uint select_len;
-    char* select_query= convert_to_select(qev->query, &select_len);
-    if (select_query != NULL)
+    rewrite_info_t rewrite;
+    char* select_query= convert_to_select(qev->query, qev->db_name,
+                                          &select_len, &rewrite);
+    TRACE(TRACE_REWRITE, query->file_seq, query->pos, select_query != NULL);
+    stats.rewrites[rewrite.stmt_class][select_query ? REWRITE_CONVERTED :
+                                       rewrite.missing_table ?
+                                       REWRITE_MISSING_TABLE : REWRITE_UNMATCHED]++;
+    if (select_query != NULL && query->next)
+    {
+      uint probe_len;
+      char *probe= make_in_probe(select_query, query, &probe_len);
+      if (probe)
+      {
+        delete[] select_query;
+        select_query= probe;
+        select_len= probe_len;
+        stats.in_probes++;
+      } else
+      {
+        /* Prefetch the first lookup alone */
+        for (const query_t *q= query->next; q; q= q->next)
+          stats.discarded_queries++;
+        free_query(query->next);
+        query->next= NULL;
+      }
+    }
+    bool use_handler= opt_handler_reads && !query->next &&
+                      !rewrite.lookup_index.empty();
+    if (select_query != NULL && opt_dry_run)
+    {
+      stats.converted_queries++;
+      if (use_handler)
+      {
+        std::string handler_read= make_handler_read(rewrite.table, rewrite);
+        write_dry_run(query, handler_read.c_str(), handler_read.length());
+      } else
+        write_dry_run(query, select_query, select_len);
+      stats.dry_run_selects++;
+      if (heat_map)
+        heat_map->add(rewrite.db, rewrite.table, TABLE_EXECUTED, 0);
+      free_query(query, select_query);
+    } else if (select_query != NULL)
     {
       stats.converted_queries++;
       // database has changed
@@ -173,20 +318,72 @@ void* prefetch_worker(void *worker_info)
           goto err;
         }
       }
-      ret= mysql_real_query(mysql, select_query, select_len);
-      if (ret)
+      /* sql_mode, character sets and time zone of the event */
+      if (parse_session_context(qev->variables, &context))
+        session.apply(mysql, context, &stats);
+      if (plans && !use_handler &&
+          !gate_select(mysql, qev->db_name, &select_query, &select_len, &stats))
+      {
+        free_query(query, select_query);
+        if (shutdown_program)
+          goto end;
+        continue;
+      }
+      /* The SQL thread may have passed the query while throttled */
+      if (opt_throttle && throttle_wait() && is_applied(query))
       {
-        print_log("ERROR: Got error on query. Error code:%d message:%s. query:%s", mysql_errno(mysql),mysql_error(mysql), select_query);
-        stats.error_selects++;
+        stats.old_queries++;
+        free_query(query, select_query);
+        if (shutdown_program)
+          goto end;
+        continue;
+      }
+      uint file_seq= query->file_seq;
+      uint64_t pos= query->pos;
+      TRACE(TRACE_EXECUTE_BEGIN, file_seq, pos, 0);
+      uint64_t start_usec= now_usec();
+      /* Falls back to SELECT if the HANDLER could not be opened or read */
+      if (use_handler && handlers.read(mysql, rewrite, &stats))
+      {
+        ret= 0;
+        stats.handler_usec+= now_usec() - start_usec;
+        free_query(query, select_query);
       } else
       {
-        stats.executed_selects++;
+        /* Only SELECTs feed the SELECT latency estimate */
+        uint64_t select_start_usec= now_usec();
+        if (use_handler)
+          stats.handler_usec+= select_start_usec - start_usec;
+        ret= mysql_real_query(mysql, select_query, select_len);
+        if (ret)
+        {
+          print_log("ERROR: Got error on query. Error code:%d message:%s. query:%s", mysql_errno(mysql),mysql_error(mysql), select_query);
+          stats.error_selects++;
+        } else
+        {
+          stats.executed_selects++;
+        }
+        free_query(query, select_query);
+        result = mysql_store_result(mysql);
+        mysql_free_result(result);
+        uint64_t select_usec= now_usec() - select_start_usec;
+        stats.select_usec+= select_usec;
+        stats.select_count++;
+        stats.select_hist[stats_hist_bucket(select_usec)]++;
       }
-      free_query(query, select_query);
-      result = mysql_store_result(mysql);
-      mysql_free_result(result);
+      uint64_t elapsed_usec= now_usec() - start_usec;
+      TRACE(TRACE_EXECUTE_END, file_seq, pos, ret != 0);
+      if (heat_map)
+        heat_map->add(rewrite.db, rewrite.table,
+                      ret ? TABLE_ERROR : TABLE_EXECUTED, elapsed_usec);
     } else
     {
+      if (rewrite.missing_table)
+      {
+        stats.missing_table_queries++;
+        if (heat_map)
+          heat_map->add(rewrite.db, rewrite.table, TABLE_MISSING, 0);
+      }
       free_query(query);
     }
     if (shutdown_program)
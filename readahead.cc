@@ -0,0 +1,220 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --relay-log-readahead: on a cold page cache the SQL thread also waits
+  for reads of the relay log it applies. This thread asks the kernel to
+  read the relay log from the SQL thread position up to a window past
+  the reader, across relay log files, and to drop what the SQL thread
+  has applied so that relay logs do not crowd out other cached files.
+*/
+
+#include "replication_booster.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+/* How often positions are checked, in microseconds */
+#define READAHEAD_INTERVAL 100000
+
+uint64_t stat_readahead_bytes= 0;
+uint64_t stat_readahead_released_bytes= 0;
+
+static pthread_t readahead_thread_id;
+static bool readahead_running= false;
+
+typedef struct relay_log_cursor
+{
+  uint file_seq;
+  uint64_t pos;
+} relay_log_cursor_t;
+
+/* Path of relay log file_seq, in the same directory and naming as path */
+static std::string relay_log_path_for_seq(const char *path, uint file_seq)
+{
+  const char *suffix= strrchr(path, '.');
+  if (!suffix)
+    return std::string(path);
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%0*u", (int)strlen(suffix + 1), file_seq);
+  std::string seq_path(path, suffix + 1 - path);
+  seq_path.append(buf);
+  return seq_path;
+}
+
+static bool advise(const std::string &path, uint64_t begin, uint64_t end,
+                   int advice)
+{
+  if (end <= begin)
+    return true;
+  int fd= open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  int rc= posix_fadvise(fd, begin, end - begin, advice);
+  close(fd);
+  if (rc)
+  {
+    DBUG_PRINT("posix_fadvise failed on %s: %d", path.c_str(), rc);
+    return false;
+  }
+  return true;
+}
+
+static bool file_size(const std::string &path, uint64_t *size)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st))
+    return false;
+  *size= st.st_size;
+  return true;
+}
+
+/* Drops the page cache of relay logs before the SQL thread position */
+static void release_applied(const char *sql_path, const relay_log_cursor_t &sql,
+                            relay_log_cursor_t *released)
+{
+  for (; released->file_seq < sql.file_seq; released->file_seq++)
+  {
+    std::string path= relay_log_path_for_seq(sql_path, released->file_seq);
+    uint64_t size;
+    /* The file may have been purged by the server already */
+    if (file_size(path, &size) && size > released->pos &&
+        advise(path, released->pos, size, POSIX_FADV_DONTNEED))
+      stat_readahead_released_bytes+= size - released->pos;
+    released->pos= 0;
+  }
+  if (sql.pos > released->pos &&
+      advise(std::string(sql_path), released->pos, sql.pos, POSIX_FADV_DONTNEED))
+  {
+    stat_readahead_released_bytes+= sql.pos - released->pos;
+    released->pos= sql.pos;
+  }
+}
+
+/*
+  Walks from the SQL thread position to the window end past the reader
+  and issues WILLNEED for everything not advised yet. The last relay log
+  grows while the I/O thread writes it, so it is revisited every round.
+*/
+static void read_ahead(const char *sql_path, const relay_log_cursor_t &sql,
+                       const relay_log_cursor_t &reader,
+                       relay_log_cursor_t *advised)
+{
+  uint64_t window= (uint64_t)opt_relay_log_readahead_mb << 20;
+  uint64_t beyond_reader= 0;
+  relay_log_cursor_t cur= sql;
+
+  while (!shutdown_program)
+  {
+    std::string path= relay_log_path_for_seq(sql_path, cur.file_seq);
+    uint64_t size, end;
+    if (!file_size(path, &size))
+      break;
+    end= size;
+    if (cur.file_seq >= reader.file_seq)
+    {
+      uint64_t from= cur.file_seq == reader.file_seq ?
+        std::max(cur.pos, reader.pos) : cur.pos;
+      end= std::min(size, from + (window - beyond_reader));
+      if (end > from)
+        beyond_reader+= end - from;
+    }
+
+    uint64_t begin= cur.pos;
+    if (cur.file_seq < advised->file_seq)
+      begin= end;
+    else if (cur.file_seq == advised->file_seq)
+      begin= std::max(begin, advised->pos);
+    if (end > begin && advise(path, begin, end, POSIX_FADV_WILLNEED))
+    {
+      stat_readahead_bytes+= end - begin;
+      advised->file_seq= cur.file_seq;
+      advised->pos= end;
+    }
+
+    if (beyond_reader >= window || end < size)
+      break;
+    cur.file_seq++;
+    cur.pos= 0;
+  }
+}
+
+static void* readahead_thread(void*)
+{
+  char sql_path[PATH_MAX+1];
+  relay_log_cursor_t sql, reader, advised, released;
+  bool first= true;
+
+  while (!shutdown_program)
+  {
+    pthread_mutex_lock(&relay_log_pos_mutex);
+    snprintf(sql_path, sizeof(sql_path), "%s", sql_thread_relay_log_path);
+    sql.file_seq= sql_thread_file_seq;
+    sql.pos= sql_thread_pos;
+    pthread_mutex_unlock(&relay_log_pos_mutex);
+    pthread_mutex_lock(&reader_pos_mutex);
+    reader.file_seq= reader_file_seq;
+    reader.pos= prefetch_position;
+    pthread_mutex_unlock(&reader_pos_mutex);
+    if (reader.file_seq < sql.file_seq ||
+        (reader.file_seq == sql.file_seq && reader.pos < sql.pos))
+      reader= sql;
+
+    if (first)
+    {
+      advised= released= sql;
+      first= false;
+    }
+    if (sql.file_seq < released.file_seq)
+    {
+      /* The relay logs were reset */
+      advised= released= sql;
+    }
+    release_applied(sql_path, sql, &released);
+    read_ahead(sql_path, sql, reader, &advised);
+    usleep(READAHEAD_INTERVAL);
+  }
+  return NULL;
+}
+
+int start_relay_log_readahead()
+{
+  if (!opt_relay_log_readahead_mb)
+    return 0;
+  if (pthread_create(&readahead_thread_id, NULL, readahead_thread, NULL))
+  {
+    print_log("ERROR: Failed to create relay log readahead thread!");
+    return 1;
+  }
+  readahead_running= true;
+  print_log("Reading relay logs %u MB ahead of the prefetch position.",
+            opt_relay_log_readahead_mb);
+  return 0;
+}
+
+void stop_relay_log_readahead()
+{
+  if (!readahead_running)
+    return;
+  pthread_join(readahead_thread_id, NULL);
+  readahead_running= false;
+}
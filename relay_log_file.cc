@@ -0,0 +1,185 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Raw access to relay log files, for events and event ranges that the
+  Binlog API does not decode or that we do not want it to decode.
+*/
+
+#include "replication_booster.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <vector>
+
+static inline uint32_t uint4korr(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void parse_event_header(const char *buf, event_header_t *header)
+{
+  const unsigned char *p= (const unsigned char*)buf;
+  header->timestamp= uint4korr(p);
+  header->type_code= p[4];
+  header->server_id= uint4korr(p + 5);
+  header->event_length= uint4korr(p + 9);
+  header->next_position= uint4korr(p + 13);
+  header->flags= p[17] | (p[18] << 8);
+}
+
+int open_relay_log(const char *path)
+{
+  int fd= open(path, O_RDONLY);
+  if (fd < 0)
+    print_log("ERROR: Failed to open %s, %d %s", path, errno, strerror(errno));
+  return fd;
+}
+
+/* Reads exactly length bytes at pos. Returns false on error or short read. */
+bool read_relay_log(int fd, uint64_t pos, size_t length, std::string *buf)
+{
+  size_t done= 0;
+  buf->resize(length);
+  while (done < length)
+  {
+    ssize_t n= pread(fd, &(*buf)[done], length - done, pos + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done+= n;
+  }
+  return true;
+}
+
+bool read_event_header(int fd, uint64_t pos, event_header_t *header)
+{
+  char buf[EVENT_HEADER_LENGTH];
+  size_t done= 0;
+  while (done < sizeof(buf))
+  {
+    ssize_t n= pread(fd, buf + done, sizeof(buf) - done, pos + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done+= n;
+  }
+  parse_event_header(buf, header);
+  return header->event_length >= EVENT_HEADER_LENGTH;
+}
+
+/* Distance between samples of the relay log position/timestamp index */
+#define RELAY_LOG_INDEX_INTERVAL (64 * 1024)
+/* ROTATE_EVENT, it must be read by the Binlog API to switch files */
+#define ROTATE_EVENT_TYPE 4
+
+/*
+  Sparse (position, timestamp) samples of the relay log file being read,
+  recorded while walking headers and while reading events. Used by the
+  reader thread only.
+*/
+static uint index_file_seq= 0;
+static std::vector<std::pair<uint64_t, uint32_t> > index_samples;
+
+void note_relay_log_position(uint file_seq, uint64_t pos, uint32_t timestamp)
+{
+  if (file_seq != index_file_seq)
+  {
+    index_samples.clear();
+    index_file_seq= file_seq;
+  }
+  if (!timestamp)
+    return;
+  if (index_samples.empty() ||
+      pos >= index_samples.back().first + RELAY_LOG_INDEX_INTERVAL)
+    index_samples.push_back(std::make_pair(pos, timestamp));
+}
+
+/* Last sample after pos whose timestamp is still before timestamp */
+static uint64_t find_indexed_position(uint file_seq, uint64_t pos,
+                                      uint32_t timestamp)
+{
+  uint64_t found= pos;
+  if (file_seq != index_file_seq)
+    return pos;
+  for (size_t i= 0; i < index_samples.size(); i++)
+  {
+    if (index_samples[i].first <= pos)
+      continue;
+    if (index_samples[i].second >= timestamp)
+      break;
+    found= index_samples[i].first;
+  }
+  return found;
+}
+
+/*
+  Moves pos forward by reading event headers only, until at least
+  target->events events and target->bytes bytes are skipped and the
+  next event is target->seconds past the first one. A rotate event, an
+  incomplete event at the end of the file or a bad header stops the walk.
+  Returns the new position, target->first_timestamp is the timestamp of
+  the event at the old position.
+*/
+uint64_t skip_relay_log_events(int fd, uint file_seq, uint64_t pos,
+                               skip_target_t *target)
+{
+  event_header_t header;
+  struct stat st;
+  uint64_t start= pos;
+  uint32_t until= 0;
+  bool jumped= false;
+
+  target->first_timestamp= 0;
+  target->skipped_events= 0;
+  if (fd < 0 || fstat(fd, &st) || !read_event_header(fd, pos, &header))
+    return pos;
+  target->first_timestamp= header.timestamp;
+  if (target->seconds && header.timestamp)
+  {
+    until= header.timestamp + target->seconds;
+    uint64_t indexed= find_indexed_position(file_seq, pos, until);
+    if (indexed > pos)
+    {
+      pos= indexed;
+      jumped= true;
+    }
+  }
+
+  while (read_event_header(fd, pos, &header))
+  {
+    if (header.type_code == ROTATE_EVENT_TYPE ||
+        pos + header.event_length > (uint64_t)st.st_size)
+      break;
+    if ((jumped || target->skipped_events >= target->events) &&
+        pos - start >= target->bytes &&
+        (!until || (header.timestamp && header.timestamp >= until)))
+      break;
+    note_relay_log_position(file_seq, pos, header.timestamp);
+    pos+= header.event_length;
+    target->skipped_events++;
+  }
+  target->skipped_bytes= pos - start;
+  return pos;
+}
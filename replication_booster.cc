@@ -20,6 +20,13 @@
 **/
 
 #include "replication_booster.h"
+#include "schema_cache.h"
+#include "gtid.h"
+#include "heat_map.h"
+#include "trace.h"
+#include "replication_filter.h"
+#include "plan_cache.h"
+#include "coalesce.h"
 #include <stdarg.h>
 #include <errno.h>
 #include <signal.h>
@@ -34,24 +41,55 @@ char *url_for_binlog_api;
 char *sql_thread_relay_log_path;
 uint32_t sql_thread_timestamp;
 uint64_t sql_thread_pos;
+uint sql_thread_file_seq= 0;
+/* Furthest worker position on a multi-threaded slave, see read_mts_frontier() */
+uint64_t mts_frontier_pos= 0;
+uint mts_frontier_file_seq= 0;
+/* slave_parallel_workers, 0 if the SQL thread applies by itself */
+uint mts_workers= 0;
+static bool mts_worker_info_table= false;
+/* File number of the relay log being read by the Binlog API */
+uint reader_file_seq= 0;
 pthread_mutex_t worker_mutex;
 pthread_mutex_t relay_log_pos_mutex;
+/* reader_file_seq and prefetch_position change together under it */
+pthread_mutex_t reader_pos_mutex= PTHREAD_MUTEX_INITIALIZER;
 enum relay_log_info_type rli_type= RLI_TYPE_FILE;
 bool shutdown_program= false;
 unsigned long prefetch_position= 0;
 uint32_t prefetch_timestamp= 0;
 bool is_sql_thread_running= true;
+/* Incremented when the relay log reader sees DDL */
+volatile uint ddl_generation= 0;
+/* Set through the control socket to stop reading the relay log */
+bool prefetch_paused= false;
+/* SQL thread progress in relay log bytes per second, 0 if unknown */
+double sql_apply_rate= 0;
+/* MASTER_DELAY of the replica and SQL_Remaining_Delay, -1 if not waiting */
+uint sql_delay= 0;
+int sql_remaining_delay= -1;
+/* When sql_remaining_delay was read */
+static time_t sql_remaining_delay_time= 0;
+/* Raw descriptor of the relay log file being read by the Binlog API */
+int relay_log_fd= -1;
+unsigned char prefetch_sid[16];
+int64_t prefetch_gno= 0;
 
 uint64_t stat_parsed_binlog_events= 0;
 uint64_t stat_skipped_binlog_events= 0;
+uint64_t stat_skipped_bytes= 0;
 uint64_t stat_reached_ahead_relay_log= 0;
 uint64_t stat_reached_end_of_relay_log= 0;
 uint64_t stat_unrelated_binlog_events= 0;
 uint64_t stat_discarded_in_front_queries= 0;
 uint64_t stat_pushed_queries= 0;
+uint64_t stat_executed_in_front_queries= 0;
+uint64_t stat_filtered_queries= 0;
+uint64_t stat_excluded_queries= 0;
+uint64_t stat_delay_waits= 0;
+uint64_t stat_delay_wait_usec= 0;
 
 struct timeval t_begin, t_end;
-pthread_t *worker_thread_ids;
 pthread_t rli_reader_thread_id;
 pthread_t status_thread_id;
 
@@ -88,8 +126,71 @@ void free_query(query_t *query, char *select)
 {
   if(select != NULL)
     delete[] select;
-  delete query->qev;
-  delete query;
+  while (query)
+  {
+    query_t *next= query->next;
+    delete[] query->target_table;
+    delete query->qev;
+    delete query;
+    query= next;
+  }
+}
+
+uint relay_log_file_seq(const char *path)
+{
+  const char *suffix= strrchr(path, '.');
+  return suffix ? strtoul(suffix + 1, NULL, 10) : 0;
+}
+
+/* query_t::target_table, NULL for multi-table statements */
+static char *make_target_table(const mysql::Query_event *qev)
+{
+  std::string db, table;
+  if (!find_target_table(qev->query.c_str(), qev->db_name, &db, &table))
+    return NULL;
+  char *name= new char[db.length() + table.length() + 2];
+  memcpy(name, db.c_str(), db.length() + 1);
+  memcpy(name + db.length() + 1, table.c_str(), table.length() + 1);
+  return name;
+}
+
+/*
+  Whether the SQL thread has already executed the query. The executed
+  GTID set is exact across relay log files and purges, positions are
+  used when GTIDs are not available.
+*/
+bool is_applied(const query_t *query)
+{
+  if (query->gno > 0)
+  {
+    gtid_set_ptr executed= get_executed_gtids();
+    if (executed && !executed->empty())
+      return executed->contains(query->sid, query->gno);
+  }
+  if (query->file_seq != sql_thread_file_seq)
+    return query->file_seq < sql_thread_file_seq;
+  return query->pos <= sql_thread_pos;
+}
+
+/*
+  Whether the SQL thread will reach the query before a SELECT started now
+  is expected to finish. The estimate uses the SQL thread's recent apply
+  rate in relay log bytes per second and the workers' SELECT latency.
+*/
+bool is_too_late(const query_t *query)
+{
+  if (!opt_deadline_drop || sql_apply_rate <= 0 ||
+      query->file_seq != sql_thread_file_seq || query->pos <= sql_thread_pos)
+    return false;
+  double usec_until_reached= (query->pos - sql_thread_pos) / sql_apply_rate * 1e6;
+  return usec_until_reached < select_latency_usec;
+}
+
+uint64_t now_usec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
 static double timediff(struct timeval tv0, struct timeval tv1)
@@ -112,32 +213,185 @@ static int connect_binlog_file(Binary_log *binlog)
   return rc;
 }
 
-static bool is_convert_candidate(const char *query)
+/*
+  Replay reads far faster than workers can convert, so the reader waits
+  for a worker queue to drain below this depth instead of buffering the
+  whole relay log in memory.
+*/
+#define REPLAY_MAX_QUEUE_DEPTH 1024
+
+/* Hands a query, with the lookups coalesced into it, to the next worker */
+void push_query(query_t *query)
 {
-  bool convert_candidate= true;
+  pthread_rwlock_rdlock(&worker_dispatch_lock);
+  uint worker_id= stat_pushed_queries % opt_workers;
+  while (opt_replay_file && !shutdown_program &&
+         get_queue_depth(worker_id) >= REPLAY_MAX_QUEUE_DEPTH)
+    usleep(1000);
+  if (tracing)
+  {
+    for (const query_t *q= query; q; q= q->next)
+      trace_record(TRACE_PUSH, q->file_seq, q->pos, worker_id);
+  }
+  queue[worker_id]->push(query);
+  pthread_rwlock_unlock(&worker_dispatch_lock);
+  stat_pushed_queries++;
+}
 
-  /* non candidate queries: BEGIN, COMMIT/CREATE, INSERT */;
-  switch (query[0])
+/*
+  Queues the event to a worker if it is a prefetch candidate. Returns true
+  if the event is now owned by the queue.
+*/
+static bool dispatch_event(Binary_log_event *event, status_t *status)
+{
+  bool queued= false;
+  switch (event->header()->type_code)
   {
-    case 'B':
-    case 'b':
-    case 'C':
-    case 'c':
-    case 'I':
-    case 'i':
-      convert_candidate= false;
-      DBUG_PRINT("Matched non-convert query: %s", query);
-      break;
+  case mysql::QUERY_EVENT:
+    {
+      const mysql::Query_event *qev= static_cast<const mysql::Query_event *>(event);
+      DBUG_PRINT("query= %s db= %s", qev->query.c_str(), qev->db_name.c_str());
+      if (is_ddl_query(qev->query.c_str()))
+      {
+        ddl_generation++;
+        if (schemas)
+          note_ddl_query(qev->query.c_str(), qev->db_name, reader_file_seq,
+                         status->current_pos);
+      }
+      if (!is_convert_candidate(qev->query.c_str()))
+      {
+        stat_discarded_in_front_queries++;
+        break;
+      }
+      if (status->executed_transaction)
+      {
+        stat_executed_in_front_queries++;
+        break;
+      }
+      if (filters)
+      {
+        enum filter_result result= filters->check(qev->query.c_str(), qev->db_name);
+        if (result == FILTER_REPLICATION)
+        {
+          stat_filtered_queries++;
+          break;
+        } else if (result == FILTER_RULE)
+        {
+          stat_excluded_queries++;
+          break;
+        }
+      }
+
+      query_t *query= new query_t;
+      memset(query, 0, sizeof(query_t));
+      query->qev= qev;
+      query->pos= status->current_pos;
+      query->file_seq= reader_file_seq;
+      query->gno= status->gno;
+      memcpy(query->sid, status->sid, sizeof(query->sid));
+      if (heat_map)
+        query->target_table= make_target_table(qev);
+      queued= true;
+      if (coalescer)
+      {
+        coalescer->flush_expired(now_usec());
+        if (coalescer->add(query))
+          break;
+      }
+      push_query(query);
+    }
+    break;
+  case mysql::ROTATE_EVENT:
+    {
+      if (event->header()->server_id == my_server_id)
+      {
+        mysql::Rotate_event *rot= static_cast<mysql::Rotate_event *>(event);
+        status->got_rotate_event= true;
+        snprintf(status->next_file, sizeof(status->next_file), "%s",
+                 rot->binlog_file.c_str());
+        status->next_pos= rot->binlog_pos;
+        DBUG_PRINT("filename= %s pos=%lu\n", rot->binlog_file.c_str(), rot->binlog_pos);
+      }
+    }
+    break;
+  default:
+    stat_unrelated_binlog_events++;
+    break;
+  }
+  return queued;
+}
+
+/*
+  Remembers the GTID of the transaction that follows. If the SQL thread
+  has already executed it, the reader is behind and its queries are not
+  dispatched.
+*/
+static void read_transaction_gtid(status_t *status, uint32_t event_length)
+{
+  status->gno= 0;
+  status->executed_transaction= false;
+  if (status->event_type != GTID_LOG_EVENT ||
+      !read_gtid_event(relay_log_fd, status->current_pos, event_length,
+                       status->sid, &status->gno))
+    return;
+  gtid_set_ptr executed= get_executed_gtids();
+  status->executed_transaction= executed &&
+    executed->contains(status->sid, status->gno);
+  prefetch_gno= status->gno;
+  memcpy(prefetch_sid, status->sid, sizeof(prefetch_sid));
+}
+
+/* Events inside a Transaction_payload_event, positioned at the payload */
+static bool dispatch_payload_event(Binary_log_event *event, void *arg)
+{
+  return dispatch_event(event, (status_t*)arg);
+}
+
+/*
+  On a replica with MASTER_DELAY the SQL thread applies an event SQL_Delay
+  seconds after its timestamp, so the window relative to the SQL thread's
+  event would prefetch hours early. Waits until the event is due within
+  --seconds-prefetch instead. Returns false if reading should stop.
+*/
+static bool wait_until_due(uint32_t timestamp)
+{
+  uint64_t wait_start= 0;
+  while ((time_t)timestamp + sql_delay > time(NULL) + (time_t)opt_read_ahead_seconds)
+  {
+    if (shutdown_program || !is_sql_thread_running || prefetch_paused)
+      return false;
+    if (!wait_start)
+    {
+      wait_start= now_usec();
+      stat_delay_waits++;
+    }
+    usleep(100000);
   }
-  return convert_candidate;
+  if (wait_start)
+  {
+    stat_delay_wait_usec+= now_usec() - wait_start;
+    /*
+      The SQL thread applies events as soon as they are due. While it waits
+      on one, that event's timestamp is SQL_Delay seconds before the time it
+      is due, SQL_Remaining_Delay from when that was read. The event waited
+      for must stay inside the window, or the reader would restart.
+    */
+    uint32_t origin= time(NULL) - sql_delay;
+    if (sql_remaining_delay >= 0)
+      origin= sql_remaining_delay_time + sql_remaining_delay - sql_delay;
+    if (origin + opt_read_ahead_seconds <= timestamp)
+      origin= timestamp - opt_read_ahead_seconds + 1;
+    sql_thread_timestamp= origin;
+  }
+  return true;
 }
 
-static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = false)
+static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = false,
+                             bool skip = true)
 {
   int rc;
   bool eof= false;
   bool start= true;
-  uint events_handled= 0;
   rc= connect_binlog_file(binlog);
   if (rc)
   {
@@ -154,6 +408,49 @@ static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = fals
     DBUG_PRINT("Got server id %d", my_server_id);
   }
 
+  /* Events right after the SQL thread are too late, skip their headers */
+  if (!opt_replay_file && skip)
+  {
+    skip_target_t target;
+    memset(&target, 0, sizeof(target));
+    target.events= opt_skip_events;
+    target.bytes= opt_skip_bytes;
+    target.seconds= opt_skip_seconds;
+    start_pos= skip_relay_log_events(relay_log_fd, reader_file_seq, start_pos,
+                                     &target);
+    stat_skipped_binlog_events+= target.skipped_events;
+    stat_skipped_bytes+= target.skipped_bytes;
+    if (target.first_timestamp)
+    {
+      sql_thread_timestamp= target.first_timestamp;
+      start= false;
+    }
+  } else if (!opt_replay_file)
+  {
+    /* Starting past the SQL thread, the read ahead limit is still from it */
+    event_header_t header;
+    if (read_event_header(relay_log_fd, sql_thread_pos, &header))
+    {
+      sql_thread_timestamp= header.timestamp;
+      start= false;
+    }
+  }
+  /* The read ahead window starts at the furthest MTS worker */
+  if (!opt_replay_file && mts_workers)
+  {
+    event_header_t header;
+    pthread_mutex_lock(&relay_log_pos_mutex);
+    uint frontier_seq= mts_frontier_file_seq;
+    uint64_t frontier_pos= mts_frontier_pos;
+    pthread_mutex_unlock(&relay_log_pos_mutex);
+    if (frontier_seq == reader_file_seq && frontier_pos > sql_thread_pos &&
+        read_event_header(relay_log_fd, frontier_pos, &header))
+    {
+      sql_thread_timestamp= header.timestamp;
+      start= false;
+    }
+  }
+
   status_t *status= new status_t;
   memset(status, 0, sizeof(status_t));
   status->next_pos= start_pos;
@@ -164,13 +461,17 @@ static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = fals
 
   while (1)
   {
-    if (shutdown_program || !is_sql_thread_running)
+    if (shutdown_program || !is_sql_thread_running || prefetch_paused)
     {
+      if (coalescer)
+        coalescer->flush_all();
       return status;
     }
     bool delete_event= true;
     Binary_log_event *event;
+    pthread_mutex_lock(&reader_pos_mutex);
     prefetch_position= binlog->get_position();
+    pthread_mutex_unlock(&reader_pos_mutex);
     rc = binlog->wait_for_next_event(&event);
     if (rc == ERR_EOF)
     {
@@ -186,6 +487,8 @@ static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = fals
     status->next_pos= status->next_pos + event_length;
     status->event_type= event->header()->type_code;
     stat_parsed_binlog_events++;
+    note_relay_log_position(reader_file_seq, status->current_pos, timestamp);
+    TRACE(TRACE_READ, reader_file_seq, status->current_pos, status->event_type);
     DBUG_PRINT("Event type: %s length: %d current pos: %d next pos: %d timestamp: %d",
                mysql::system::get_event_type_str(event->get_event_type()), event_length,
                status->current_pos, status->next_pos, timestamp);
@@ -196,65 +499,37 @@ static status_t *read_binlog(Binary_log *binlog, int start_pos, bool init = fals
       start= false;
     }
 
-    if (timestamp >= sql_thread_timestamp + opt_read_ahead_seconds)
+    if (!opt_replay_file && sql_delay && !wait_until_due(timestamp))
     {
-      DBUG_PRINT("Reached end timestamp: %d, sql thread timestamp: %d",
-                 timestamp, sql_thread_timestamp);
-      stat_reached_ahead_relay_log++;
-      usleep(opt_sleep_millis_at_read_limit);
       delete event;
       goto end;
     }
 
-    events_handled++;
-    if (events_handled <= opt_skip_events)
+    if (!opt_replay_file &&
+        timestamp >= sql_thread_timestamp + opt_read_ahead_seconds)
     {
-      stat_skipped_binlog_events++;
+      DBUG_PRINT("Reached end timestamp: %d, sql thread timestamp: %d",
+                 timestamp, sql_thread_timestamp);
+      stat_reached_ahead_relay_log++;
+      usleep(opt_sleep_millis_at_read_limit);
       delete event;
-      continue;
+      goto end;
     }
 
-    switch (status->event_type)
-    {
-    case mysql::QUERY_EVENT:
-      {
-        const mysql::Query_event *qev= static_cast<const mysql::Query_event *>(event);
-        DBUG_PRINT("query= %s db= %s", qev->query.c_str(), qev->db_name.c_str());
-        if (!is_convert_candidate(qev->query.c_str()))
-        {
-          stat_discarded_in_front_queries++;
-          break;
-        }
-
-        query_t *query= new query_t;
-        memset(query, 0, sizeof(query_t));
-        query->qev= qev;
-        query->pos= status->current_pos;
-        queue[stat_pushed_queries % opt_workers]->push(query);
-        stat_pushed_queries++;
-        delete_event= false;
-      }
-      break;
-    case mysql::ROTATE_EVENT:
-      {
-        if (event->header()->server_id == my_server_id)
-        {
-          mysql::Rotate_event *rot= static_cast<mysql::Rotate_event *>(event);
-          status->got_rotate_event= true;
-          status->next_file= rot->binlog_file.c_str();
-          status->next_pos= rot->binlog_pos;
-          DBUG_PRINT("filename= %s pos=%lu\n", rot->binlog_file.c_str(), rot->binlog_pos);
-        }
-      }
-      break;
-    default:
-      stat_unrelated_binlog_events++;
-      break;
-    }
+    if (status->event_type == GTID_LOG_EVENT ||
+        status->event_type == ANONYMOUS_GTID_LOG_EVENT)
+      read_transaction_gtid(status, event_length);
+    else if (status->event_type == TRANSACTION_PAYLOAD_EVENT)
+      decode_transaction_payload(driver, relay_log_fd, status->current_pos,
+                                 event_length, dispatch_payload_event, status);
+    else
+      delete_event= !dispatch_event(event, status);
     if (delete_event)
       delete event;
   }
 end:
+  if (coalescer)
+    coalescer->flush_all();
   DBUG_PRINT("Disconnecting binlog");
   driver->disconnect();
   if (eof)
@@ -280,6 +555,9 @@ static void delete_binlog_driver()
     delete driver;
   if (binlog != NULL)
     delete binlog;
+  if (relay_log_fd >= 0)
+    close(relay_log_fd);
+  relay_log_fd= -1;
 }
 
 static void init_binlog_driver(const char *url)
@@ -292,52 +570,144 @@ static void init_binlog_driver(const char *url)
 static void init_binlog_driver(const char* binlog_file_path, char **url)
 {
   get_file_url(binlog_file_path, url);
+  if (relay_log_fd >= 0)
+    close(relay_log_fd);
+  relay_log_fd= open_relay_log(binlog_file_path);
+  pthread_mutex_lock(&reader_pos_mutex);
+  reader_file_seq= relay_log_file_seq(binlog_file_path);
+  prefetch_position= 0;
+  pthread_mutex_unlock(&reader_pos_mutex);
   return init_binlog_driver(*url);
 }
 
-static void read_current_relay_info()
+/*
+  Reads the relay log name and position from a relay log info or worker
+  info file: the first line that is a path, and the line after it.
+*/
+static bool read_relay_log_position(const char *info_path, char *relay_log_path,
+                                    uint64_t *pos)
 {
   char row[PATH_MAX+1];
-  char *pos;
   FILE *fp;
-  fp= fopen(relay_log_info_path, "r");
-  if (!fp)
-  {
-    print_log("ERROR: Failed to open %s, %d %s",
-              relay_log_info_path, errno, strerror(errno));
-    sleep(100);
-    exit(1);
-  }
+  bool found= false;
+  if (!(fp= fopen(info_path, "r")))
+    return false;
   while (fgets(row, sizeof(row), fp) != NULL)
   {
-    bool found= false;
-    row[strlen(row) -1] = '\0';
-    pos= row;
+    row[strcspn(row, "\n")] = '\0';
     // relay log file
     if (row[0] == '.')
     {
       found= true;
-      pos+= 2;
-      pthread_mutex_lock(&relay_log_pos_mutex);
-      sprintf(sql_thread_relay_log_path, "%s/%s", data_dir, pos);
+      snprintf(relay_log_path, PATH_MAX+1, "%s/%s", data_dir, row + 2);
     } else if(row[0] == '/')
     {
       found= true;
-      pthread_mutex_lock(&relay_log_pos_mutex);
-      sprintf(sql_thread_relay_log_path, "%s", pos);
+      snprintf(relay_log_path, PATH_MAX+1, "%s", row);
     }
     if (found)
     {
       // relay log pos
-      fgets(row, sizeof(row), fp);
-      row[strlen(row) -1] = '\0';
-      char *x;
-      sql_thread_pos= strtoull(row, &x, 0);
-      pthread_mutex_unlock(&relay_log_pos_mutex);
+      found= fgets(row, sizeof(row), fp) != NULL;
+      *pos= strtoull(row, NULL, 0);
       break;
     }
   }
   fclose(fp);
+  return found;
+}
+
+/*
+  Multi-threaded slave: relay-log.info only holds the checkpoint, the low
+  water mark below which every transaction is applied. Workers are
+  usually past it, each at the end of the last transaction it applied.
+  Transactions between the checkpoint and the furthest worker may still
+  wait in the queue of a slower worker, so the checkpoint stays the SQL
+  thread position for old queries and restarts. The furthest position
+  only moves the start of the read ahead window.
+*/
+static void note_worker_position(const char *path, uint64_t pos,
+                                 char *best_path, uint64_t *best_pos)
+{
+  uint file_seq= relay_log_file_seq(path);
+  uint best_seq= best_path[0] ? relay_log_file_seq(best_path) : 0;
+  if (!best_path[0] || file_seq > best_seq ||
+      (file_seq == best_seq && pos > *best_pos))
+  {
+    snprintf(best_path, PATH_MAX+1, "%s", path);
+    *best_pos= pos;
+  }
+}
+
+static void read_mts_frontier(MYSQL *mysql)
+{
+  char best_path[PATH_MAX+1]= "";
+  uint64_t best_pos= 0;
+
+  if (mts_worker_info_table)
+  {
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    if (mysql_query(mysql, "SELECT Relay_log_name, Relay_log_pos "
+                           "FROM mysql.slave_worker_info") ||
+        !(result= mysql_store_result(mysql)))
+      return;
+    while ((row= mysql_fetch_row(result)))
+    {
+      char path[PATH_MAX+1];
+      if (!row[0] || !row[1] || !row[0][0])
+        continue;
+      if (row[0][0] == '/')
+        snprintf(path, sizeof(path), "%s", row[0]);
+      else
+        snprintf(path, sizeof(path), "%s/%s", data_dir,
+                 row[0][0] == '.' ? row[0] + 2 : row[0]);
+      note_worker_position(path, strtoull(row[1], NULL, 10), best_path, &best_pos);
+    }
+    mysql_free_result(result);
+  } else
+  {
+    /* worker-relay-log.info.<id> next to relay-log.info */
+    const char *base= strrchr(relay_log_info_path, '/');
+    std::string dir(relay_log_info_path, base ? base - relay_log_info_path : 0);
+    base= base ? base + 1 : relay_log_info_path;
+    for (uint id= 0; id <= mts_workers; id++)
+    {
+      char info_path[PATH_MAX+1], path[PATH_MAX+1];
+      uint64_t pos;
+      snprintf(info_path, sizeof(info_path), "%s/worker-%s.%u",
+               dir.c_str(), base, id);
+      if (read_relay_log_position(info_path, path, &pos))
+        note_worker_position(path, pos, best_path, &best_pos);
+    }
+  }
+  pthread_mutex_lock(&relay_log_pos_mutex);
+  mts_frontier_file_seq= best_path[0] ? relay_log_file_seq(best_path) : 0;
+  mts_frontier_pos= best_pos;
+  pthread_mutex_unlock(&relay_log_pos_mutex);
+}
+
+static void read_current_relay_info()
+{
+  char path[PATH_MAX+1];
+  uint64_t pos;
+  errno= 0;
+  if (!read_relay_log_position(relay_log_info_path, path, &pos))
+  {
+    if (errno)
+      print_log("ERROR: Failed to open %s, %d %s",
+                relay_log_info_path, errno, strerror(errno));
+    else
+      print_log("ERROR: No relay log position in %s", relay_log_info_path);
+    sleep(100);
+    exit(1);
+  }
+  uint file_seq= relay_log_file_seq(path);
+  pthread_mutex_lock(&relay_log_pos_mutex);
+  strcpy(sql_thread_relay_log_path, path);
+  sql_thread_pos= pos;
+  sql_thread_file_seq= file_seq;
+  pthread_mutex_unlock(&relay_log_pos_mutex);
 }
 
 static void init_relay_log_info_path(MYSQL *mysql, uint version)
@@ -374,6 +744,32 @@ static void init_relay_log_info_path(MYSQL *mysql, uint version)
   strcpy(relay_log_info_path, buf);
 }
 
+/* Takes SQL_Delay and SQL_Remaining_Delay from a SHOW SLAVE STATUS row */
+static void note_slave_delay(MYSQL_RES *result, MYSQL_ROW row)
+{
+  MYSQL_FIELD *fields= mysql_fetch_fields(result);
+  uint delay= 0;
+  int remaining= -1;
+  for (uint i= 0; i < mysql_num_fields(result); i++)
+  {
+    if (!strcmp(fields[i].name, "SQL_Delay") && row[i])
+      delay= strtoul(row[i], NULL, 10);
+    else if (!strcmp(fields[i].name, "SQL_Remaining_Delay") && row[i])
+      remaining= strtol(row[i], NULL, 10);
+  }
+  if (delay != sql_delay)
+  {
+    if (delay)
+      print_log("Replica is delayed by %u seconds. Prefetching events when "
+                "they are due within %u seconds.", delay, opt_read_ahead_seconds);
+    else
+      print_log("Replica is no longer delayed.");
+  }
+  sql_delay= delay;
+  sql_remaining_delay_time= time(NULL);
+  sql_remaining_delay= remaining;
+}
+
 static MYSQL* init_mysql_config()
 {
   MYSQL *mysql;
@@ -421,6 +817,40 @@ static MYSQL* init_mysql_config()
   mysql_free_result(result);
 
   version= mysql_get_server_version(mysql);
+  if (version >= 50605 && !mysql_query(mysql, "SELECT @@global.gtid_mode"))
+  {
+    result= mysql_store_result(mysql);
+    if (result && (row= mysql_fetch_row(result)) && row[0])
+      gtid_mode_on= !strcmp(row[0], "ON");
+    if (result)
+      mysql_free_result(result);
+    if (gtid_mode_on)
+      print_log("GTID mode is on. Using executed GTIDs to detect old queries.");
+  }
+  if (version >= 50600 &&
+      !mysql_query(mysql, "SELECT @@global.slave_parallel_workers, "
+                          "@@global.relay_log_info_repository"))
+  {
+    result= mysql_store_result(mysql);
+    if (result && (row= mysql_fetch_row(result)) && row[0])
+    {
+      mts_workers= strtoul(row[0], NULL, 10);
+      mts_worker_info_table= row[1] && !strcmp(row[1], "TABLE");
+    }
+    if (result)
+      mysql_free_result(result);
+    if (mts_workers)
+      print_log("Multi-threaded slave with %u workers. Using worker positions "
+                "to track SQL thread progress.", mts_workers);
+  }
+  if (version >= 50600 && !mysql_query(mysql, "SHOW SLAVE STATUS"))
+  {
+    result= mysql_store_result(mysql);
+    if (result && (row= mysql_fetch_row(result)))
+      note_slave_delay(result, row);
+    if (result)
+      mysql_free_result(result);
+  }
   if (version > 50600)
   {
     // TODO: supporting table type relay log
@@ -462,25 +892,47 @@ static inline const char *bool_to_str(bool v)
   return v ? "true" : "false";
 }
 
-static void print_status(FILE *stream)
+void print_status(FILE *stream)
 {
   fprintf(stream, "Status:\n");
   pthread_mutex_lock(&relay_log_pos_mutex);
   fprintf(stream, "  Relay log file: %s\n", sql_thread_relay_log_path);
   fprintf(stream, "  Relay log (SQL thread) position: %lu\n", sql_thread_pos);
+  if (mts_workers)
+    fprintf(stream, "  Furthest relay log position of %u workers: %u:%lu\n",
+            mts_workers, mts_frontier_file_seq, mts_frontier_pos);
   pthread_mutex_unlock(&relay_log_pos_mutex);
   fprintf(stream, "  SQL thread timestamp: %u\n", sql_thread_timestamp);
+  if (sql_delay)
+    fprintf(stream, "  SQL thread delay/remaining delay: %u/%d seconds\n",
+            sql_delay, sql_remaining_delay);
   fprintf(stream, "  Prefetch event timestamp: %u\n", prefetch_timestamp);
   fprintf(stream, "  Prefetch event position: %lu\n", prefetch_position);
+  if (gtid_mode_on)
+  {
+    char gtid[64];
+    gtid_set_ptr executed= get_executed_gtids();
+    format_gtid(prefetch_sid, prefetch_gno, gtid, sizeof(gtid));
+    fprintf(stream, "  Prefetch GTID: %s\n", gtid);
+    fprintf(stream, "  Executed GTID intervals: %lu\n",
+            executed ? executed->get_interval_count() : 0);
+  }
   fprintf(stream, "  Is SQL thread running: %s\n",
           bool_to_str(is_sql_thread_running));
+  fprintf(stream, "  Dry run: %s\n", bool_to_str(opt_dry_run));
+  fprintf(stream, "  Worker threads: %u\n", opt_workers);
     fprintf(stream, "  Shutdown program: %s\n", bool_to_str(shutdown_program));
 }
 
-static void print_statistics(FILE *stream)
+void print_statistics(FILE *stream)
 {
   uint64_t popped_queries, old_queries, discarded_queries;
-  uint64_t converted_queries, executed_selects, error_selects;
+  uint64_t converted_queries, executed_selects, error_selects, dry_run_selects;
+  uint64_t missing_table_queries, late_queries, select_usec;
+  uint64_t handler_reads, handler_errors, handler_opens, handler_usec;
+  uint64_t explain_queries, explain_errors, gated_scans, gated_ranges;
+  uint64_t capped_selects, in_probes, session_changes, session_errors;
+  uint64_t rewrites[STMT_CLASSES][REWRITE_OUTCOMES];
 
   pthread_mutex_lock(&worker_mutex);
   popped_queries = stat_popped_queries;
@@ -488,23 +940,97 @@ static void print_statistics(FILE *stream)
   discarded_queries = stat_discarded_queries;
   converted_queries = stat_converted_queries;
   executed_selects = stat_executed_selects;
+  dry_run_selects = stat_dry_run_selects;
   error_selects = stat_error_selects;
+  missing_table_queries = stat_missing_table_queries;
+  late_queries = stat_late_queries;
+  select_usec = stat_select_usec;
+  handler_reads = stat_handler_reads;
+  handler_usec = stat_handler_usec;
+  handler_errors = stat_handler_errors;
+  handler_opens = stat_handler_opens;
+  explain_queries = stat_explain_queries;
+  explain_errors = stat_explain_errors;
+  gated_scans = stat_gated_scans;
+  gated_ranges = stat_gated_ranges;
+  capped_selects = stat_capped_selects;
+  in_probes = stat_in_probes;
+  session_changes = stat_session_changes;
+  session_errors = stat_session_errors;
+  memcpy(rewrites, stat_rewrites, sizeof(rewrites));
   pthread_mutex_unlock(&worker_mutex);
 
   fprintf(stream, "Statistics:\n");
   fprintf(stream, " Parsed binlog events: %lu\n", stat_parsed_binlog_events);
   fprintf(stream, " Skipped binlog events by offset: %lu\n", stat_skipped_binlog_events);
+  fprintf(stream, " Skipped relay log bytes by offset: %lu\n", stat_skipped_bytes);
   fprintf(stream, " Unrelated binlog events: %lu\n", stat_unrelated_binlog_events);
   fprintf(stream, " Queries discarded in front: %lu\n", stat_discarded_in_front_queries);
+  fprintf(stream, " Queries of executed transactions discarded in front: %lu\n",
+          stat_executed_in_front_queries);
+  fprintf(stream, " Queries skipped by replication filters: %lu\n", stat_filtered_queries);
+  fprintf(stream, " Queries excluded by --include/--exclude: %lu\n", stat_excluded_queries);
   fprintf(stream, " Queries pushed to workers: %lu\n", stat_pushed_queries);
   fprintf(stream, " Queries popped by workers: %lu\n", popped_queries);
   fprintf(stream, " Old queries popped by workers: %lu\n", old_queries);
   fprintf(stream, " Queries discarded by workers: %lu\n", discarded_queries);
+  fprintf(stream, " Queries dropped as too late to prefetch: %lu\n", late_queries);
   fprintf(stream, " Queries converted to select: %lu\n", converted_queries);
+  for (uint i= 0; i < STMT_CLASSES; i++)
+    fprintf(stream, " Rewrites of %s (converted/unmatched/missing table): %lu/%lu/%lu\n",
+            statement_class_names[i], rewrites[i][REWRITE_CONVERTED],
+            rewrites[i][REWRITE_UNMATCHED], rewrites[i][REWRITE_MISSING_TABLE]);
   fprintf(stream, " Executed SELECT queries: %lu\n", executed_selects);
+  fprintf(stream, " Dry run SELECT queries: %lu\n", dry_run_selects);
   fprintf(stream, " Error SELECT queries: %lu\n", error_selects);
+  fprintf(stream, " Total SELECT time: %.3f seconds\n", select_usec / 1e6);
+  fprintf(stream, " Estimated SELECT latency: %.0f usec\n", select_latency_usec);
+  fprintf(stream, " Estimated SQL thread apply rate: %.0f bytes/sec\n", sql_apply_rate);
+  fprintf(stream, " Session context changes/errors: %lu/%lu\n",
+          session_changes, session_errors);
+  fprintf(stream, " HANDLER reads/errors/opens: %lu/%lu/%lu\n",
+          handler_reads, handler_errors, handler_opens);
+  fprintf(stream, " Total HANDLER time: %.3f seconds\n", handler_usec / 1e6);
+  if (coalescer)
+  {
+    fprintf(stream, " Lookups coalesced/groups: %lu/%lu\n",
+            stat_coalesced_queries, stat_coalesced_batches);
+    fprintf(stream, " IN-list SELECT queries: %lu\n", in_probes);
+  }
+  if (plans)
+  {
+    fprintf(stream, " EXPLAIN queries/errors, cached plans: %lu/%lu, %u\n",
+            explain_queries, explain_errors, plans->get_size());
+    fprintf(stream, " SELECTs skipped as too expensive (scan/range): %lu/%lu\n",
+            gated_scans, gated_ranges);
+    fprintf(stream, " SELECTs capped with LIMIT: %lu\n", capped_selects);
+  }
+  fprintf(stream, " Queries on missing tables: %lu\n", missing_table_queries);
+  fprintf(stream, " Table definitions loaded: %lu\n", stat_schema_loads);
+  fprintf(stream, " Table definitions invalidated: %lu\n", stat_schema_invalidations);
+  fprintf(stream, " Compressed transaction payloads: %lu\n", stat_payload_events);
+  fprintf(stream, " Events in compressed transaction payloads: %lu\n", stat_payload_inner_events);
+  fprintf(stream, " Transaction payload errors: %lu\n", stat_payload_errors);
+  fprintf(stream, " Transaction payload bytes (compressed/uncompressed): %lu/%lu\n",
+          stat_payload_compressed_bytes, stat_payload_uncompressed_bytes);
+  fprintf(stream, " Transaction payload decompression: %.1f MB/s\n",
+          stat_payload_decompress_usec ?
+          (double)stat_payload_uncompressed_bytes / stat_payload_decompress_usec : 0.0);
+  if (opt_throttle)
+    print_throttle(stream);
+  if (opt_relay_log_readahead_mb)
+    fprintf(stream, " Relay log read ahead/released: %.1f/%.1f MB\n",
+            stat_readahead_bytes / 1048576.0,
+            stat_readahead_released_bytes / 1048576.0);
+  fprintf(stream, " Worker pool grown/shrunk: %lu/%lu\n",
+          stat_pool_grows, stat_pool_shrinks);
   fprintf(stream, " Number of times to read relay log limit: %lu\n", stat_reached_ahead_relay_log);
+  if (sql_delay || stat_delay_waits)
+    fprintf(stream, " Waits for delayed events to become due/wait time: %lu/%.3f seconds\n",
+            stat_delay_waits, stat_delay_wait_usec / 1e6);
   fprintf(stream, " Number of times to reach end of relay log: %lu\n", stat_reached_end_of_relay_log);
+  if (heat_map)
+    heat_map->print(stream, HEAT_MAP_PRINT_LIMIT);
 }
 
 static bool make_status_file(int *error)
@@ -556,6 +1082,7 @@ static void* status_thread(void*)
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
     if (make_status_file(&error))
       print_log("ERROR: Could not print to status file (%d)", error);
+    save_booster_state(false);
     pthread_setcancelstate(state, NULL);
   }
 
@@ -564,39 +1091,110 @@ static void* status_thread(void*)
 
 static void do_shutdown()
 {
-  gettimeofday(&t_end, 0);
+  if (!opt_replay_file)
+    gettimeofday(&t_end, 0);
   print_log("Stopping Replication Booster..");
   delete_binlog_driver();
-  for (uint i=0; i < opt_workers; i++)
+  /* Both read the worker queues, which the pool frees */
+  stop_control_socket();
+  stop_stats_shm();
+  stop_pool_controller();
+  shutdown_worker_pool();
+  stop_relay_log_readahead();
+  /* When replaying, workers finish their queues before exiting */
+  if (opt_replay_file)
+    gettimeofday(&t_end, 0);
+  else
+    pthread_join(rli_reader_thread_id, NULL);
+  if (!opt_replay_file)
   {
-    query_t *query= new query_t;
-    memset(query, 0, sizeof(query_t));
-    query->shutdown= true;
-    queue[i]->push(query);
+    pthread_cancel(status_thread_id);
+    pthread_join(status_thread_id, NULL);
   }
-  for (uint i=0; i < opt_workers; i++)
-  {
-    pthread_join(worker_thread_ids[i], NULL);
-    queue[i]->clear();
-    delete queue[i];
-  }
-  pthread_join(rli_reader_thread_id, NULL);
-  pthread_cancel(status_thread_id);
-  pthread_join(status_thread_id, NULL);
+  stop_state_warmup();
+  save_booster_state(true);
+  stop_tracing();
   double total_time= timediff(t_begin,t_end);
   printf("Running duration: %10.3f seconds\n", total_time);
+  if (opt_replay_file && total_time > 0)
+  {
+    printf("Parsed binlog events per second: %.1f\n",
+           stat_parsed_binlog_events / total_time);
+    printf("Converted queries per second: %.1f\n",
+           stat_converted_queries / total_time);
+  }
   print_statistics(stdout);
+  close_dry_run_output();
   mysql_library_end();
   delete[] data_dir;
   delete[] relay_log_info_path;
   delete[] url_for_binlog_api;
   delete[] sql_thread_relay_log_path;
-  delete[] worker_thread_ids;
-  delete[] queue;
+  delete schemas;
+  delete heat_map;
+  delete filters;
+  delete plans;
+  delete coalescer;
   pthread_mutex_destroy(&worker_mutex);
   pthread_mutex_destroy(&relay_log_pos_mutex);
 }
 
+/* Refreshes the executed GTID set if it has changed since last time */
+static void read_executed_gtids(MYSQL *mysql, std::string *last_gtids)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  if (mysql_query(mysql, "SELECT @@global.gtid_executed"))
+  {
+    print_log("ERROR: Could not read gtid_executed: %d %s",
+              mysql_errno(mysql), mysql_error(mysql));
+    return;
+  }
+  result= mysql_store_result(mysql);
+  if (result && (row= mysql_fetch_row(result)) && row[0] &&
+      *last_gtids != row[0])
+  {
+    gtid_set *executed= new gtid_set();
+    if (executed->parse(row[0]))
+    {
+      set_executed_gtids(gtid_set_ptr(executed));
+      last_gtids->assign(row[0]);
+    } else
+    {
+      print_log("ERROR: Could not parse gtid_executed: %.200s", row[0]);
+      delete executed;
+    }
+  }
+  if (result)
+    mysql_free_result(result);
+}
+
+/*
+  Updates sql_apply_rate from the SQL thread position, sampled every
+  SQL_RATE_INTERVAL_USEC. Samples spanning a relay log switch are ignored.
+*/
+#define SQL_RATE_INTERVAL_USEC 500000
+static void update_sql_apply_rate()
+{
+  static uint64_t last_usec= 0, last_pos= 0;
+  static uint last_file_seq= 0;
+  uint64_t now= now_usec();
+  if (now - last_usec < SQL_RATE_INTERVAL_USEC)
+    return;
+  pthread_mutex_lock(&relay_log_pos_mutex);
+  uint64_t pos= sql_thread_pos;
+  uint file_seq= sql_thread_file_seq;
+  pthread_mutex_unlock(&relay_log_pos_mutex);
+  if (last_usec && file_seq == last_file_seq && pos >= last_pos)
+  {
+    double rate= (pos - last_pos) * 1e6 / (now - last_usec);
+    sql_apply_rate= sql_apply_rate ? 0.7 * sql_apply_rate + 0.3 * rate : rate;
+  }
+  last_usec= now;
+  last_pos= pos;
+  last_file_seq= file_seq;
+}
+
 static void* rli_reader_thread(void* arg)
 {
   int rc;
@@ -606,19 +1204,43 @@ static void* rli_reader_thread(void* arg)
   MYSQL_RES   *result;
   MYSQL_ROW    row;
   MYSQL_FIELD *field;
+  std::string last_gtids;
+  uint64_t traced_pos= 0;
 
+  trace_register_thread("rli reader");
   while (1)
   {
     if (rli_type == RLI_TYPE_FILE)
     {
       read_current_relay_info();
     }
+    if (tracing && sql_thread_pos != traced_pos)
+    {
+      traced_pos= sql_thread_pos;
+      trace_record(TRACE_SQL_POSITION, sql_thread_file_seq, traced_pos, 0);
+    }
+    update_sql_apply_rate();
+    if (schemas)
+    {
+      uint file_seq;
+      uint64_t pos;
+      pthread_mutex_lock(&relay_log_pos_mutex);
+      file_seq= sql_thread_file_seq;
+      pos= sql_thread_pos;
+      pthread_mutex_unlock(&relay_log_pos_mutex);
+      schemas->apply_pending(file_seq, pos);
+    }
     if (shutdown_program)
     {
       goto end;
     }
     usleep(10000);
     counter++;
+    /* checking every 100 milliseconds */
+    if (gtid_mode_on && counter % 10 == 0)
+      read_executed_gtids(mysql, &last_gtids);
+    if (mts_workers && counter % 10 == 0)
+      read_mts_frontier(mysql);
     /* checking every 2000 milliseconds */
     if (counter % 200 == 0)
     {
@@ -651,8 +1273,11 @@ static void* rli_reader_thread(void* arg)
           print_log("SQL Thread started again. Starting slave prefetching.");
           is_sql_thread_running= true;
         }
+        note_slave_delay(result, row);
       }
       mysql_free_result(result);
+      if (opt_throttle)
+        update_throttle(mysql);
     }
   }
 end:
@@ -662,14 +1287,50 @@ end:
   pthread_exit(0);
 }
 
-int main(int argc, char **argv)
+/*
+  Offline mode: reads the given relay log and the relay logs it rotates
+  to as fast as possible, without a server. Workers write or count the
+  SELECT statements instead of executing them.
+*/
+static void replay_relay_logs()
+{
+  bool init= true;
+  char next_path[PATH_MAX+1];
+
+  while (!shutdown_program)
+  {
+    status *status= read_binlog(binlog, 4, init);
+    init= false;
+    if (!status)
+      break;
+    if (!status->got_rotate_event || status->code != END_OF_FILE)
+    {
+      delete status;
+      break;
+    }
+    snprintf(next_path, sizeof(next_path), "%s/%s",
+             dirname(strdupa(sql_thread_relay_log_path)), status->next_file);
+    delete status;
+    if (access(next_path, R_OK))
+      break;
+    print_log("Replaying relay log file: %s", next_path);
+    strcpy(sql_thread_relay_log_path, next_path);
+    delete_binlog_driver();
+    init_binlog_driver(sql_thread_relay_log_path, &url_for_binlog_api);
+  }
+}
+
+int replication_booster_main(int argc, char **argv)
 {
   uint64_t pos;
   bool init=true;
-  MYSQL *mysql;
+  bool skip= true;
+  MYSQL *mysql= NULL;
 
   get_options(argc, argv);
-  if (check_local(opt_slave_host))
+  if (opt_instances_file)
+    exit(supervise_instances(argc, argv));
+  if (!opt_replay_file && check_local(opt_slave_host))
   {
     goto err;
   }
@@ -682,42 +1343,114 @@ int main(int argc, char **argv)
     exit(1);
   }
   init_signals();
-  mysql= init_mysql_config();
-  if (!mysql)
+  if (start_tracing())
+  {
+    exit(1);
+  }
+  trace_register_thread("reader");
+  if (!opt_replay_file)
+  {
+    mysql= init_mysql_config();
+    if (!mysql)
+    {
+      goto err;
+    }
+  }
+  if (open_dry_run_output())
   {
     goto err;
   }
   pthread_mutex_init(&worker_mutex, NULL);
   pthread_mutex_init(&relay_log_pos_mutex, NULL);
-  queue = new query_queue*[opt_workers];
+  if (opt_schema_cache && !opt_replay_file)
+    schemas= new schema_cache();
+  if (opt_heat_map_size)
+    heat_map= new table_heat_map(opt_heat_map_size);
+  if (opt_explain_max_rows && !opt_dry_run)
+    plans= new plan_cache();
+  if (opt_coalesce_max > 1)
+    coalescer= new lookup_coalescer();
+  filters= new replication_filter();
+  for (size_t i= 0; i < opt_include_tables.size() + opt_exclude_tables.size(); i++)
+  {
+    bool include= i < opt_include_tables.size();
+    const std::string &rule= include ? opt_include_tables[i] :
+      opt_exclude_tables[i - opt_include_tables.size()];
+    if (!filters->add_rule(rule.c_str(), include))
+    {
+      print_log("ERROR: Invalid --%s=%s, expected db.table.",
+                include ? "include" : "exclude", rule.c_str());
+      goto err;
+    }
+  }
+  if (mysql && !filters->load_slave_filters(mysql))
+  {
+    goto err;
+  }
+  if (filters->empty())
+  {
+    delete filters;
+    filters= NULL;
+  } else
+    filters->log_summary();
   url_for_binlog_api= new char[PATH_MAX+10];
   sql_thread_relay_log_path= new char[PATH_MAX+1];
-  read_current_relay_info();
+  if (opt_replay_file)
+  {
+    snprintf(sql_thread_relay_log_path, PATH_MAX+1, "%s", opt_replay_file);
+    sql_thread_pos= 0;
+  } else
+  {
+    if (mts_workers)
+      read_mts_frontier(mysql);
+    read_current_relay_info();
+  }
   pos= sql_thread_pos;
   print_log("Reading relay log file: %s from relay log pos: %lu",
             sql_thread_relay_log_path, sql_thread_pos);
 
-  worker_thread_ids= new pthread_t[opt_workers];
-  for (uint i=0; i< opt_workers; i++)
+  if (init_worker_pool())
   {
-    worker_info_t *info= new worker_info_t;
-    memset(info, 0, sizeof(worker_info_t));
-    queue[i]= new query_queue();
-    info->worker_id= i;
-    if (pthread_create(&(info->ptid), NULL, prefetch_worker, info))
+    goto err;
+  }
+  if (!opt_replay_file)
+  {
+    uint64_t reader_pos;
+    if (load_booster_state(mysql, &reader_pos))
     {
-      print_log("ERROR: Failed to create worker worker_thread_ids!");
-      goto err;
+      print_log("Continuing from the saved reader position %lu.", reader_pos);
+      pos= reader_pos;
+      skip= false;
     }
-    worker_thread_ids[i]= info->ptid;
+    /* Known from the state file if mysqld has not restarted */
+    if (my_server_id)
+      init= false;
   }
-  if (pthread_create(&rli_reader_thread_id, NULL, rli_reader_thread, mysql))
+  if (!opt_replay_file &&
+      pthread_create(&rli_reader_thread_id, NULL, rli_reader_thread, mysql))
   {
       print_log("ERROR: Failed to create relay log reader thread!");
       goto err;
   }
+  if (!opt_replay_file && start_control_socket())
+  {
+    goto err;
+  }
+  if (start_stats_shm())
+  {
+    goto err;
+  }
+  if (!opt_replay_file && start_pool_controller())
+  {
+    goto err;
+  }
+  if (!opt_replay_file && start_relay_log_readahead())
+  {
+    goto err;
+  }
   dir_name_status_file = dirname(strdupa(opt_status_file));
-  if (pthread_create(&status_thread_id, NULL, status_thread, NULL))
+  if (!opt_replay_file &&
+      pthread_create(&status_thread_id, NULL, status_thread, NULL))
   {
     print_log("ERROR: Failed to create status thread!");
     goto err;
@@ -727,10 +1460,17 @@ int main(int argc, char **argv)
 
   gettimeofday(&t_begin, 0);
   print_log("Replication Booster started.");
+  if (opt_replay_file)
+  {
+    replay_relay_logs();
+    do_shutdown();
+    goto end;
+  }
   while (1)
   {
-    status *status= read_binlog(binlog, pos, init);
+    status *status= read_binlog(binlog, pos, init, skip);
     init= false;
+    skip= true;
     if (shutdown_program)
     {
       if (status)
@@ -738,11 +1478,8 @@ int main(int argc, char **argv)
       do_shutdown();
       goto end;
     }
-    for (uint i=0; i < opt_workers; i++)
-    {
-      queue[i]->clear();
-    }
-    while (!is_sql_thread_running)
+    clear_worker_queues();
+    while (!is_sql_thread_running || prefetch_paused)
     {
       if (shutdown_program) {
         do_shutdown();
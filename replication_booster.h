@@ -29,9 +29,11 @@
 #include <unistd.h>
 #include <cstdlib>
 #include <queue>
+#include <vector>
 #include <binlog_api.h>
 #include <mysql.h>
 #include "options.h"
+#include "stats_shm.h"
 
 using mysql::Binary_log;
 using mysql::Binary_log_event;
@@ -53,27 +55,108 @@ extern char *relay_log_info_path;
 extern char *data_dir;
 extern char *sql_thread_relay_log_path;
 extern uint64_t sql_thread_pos;
+extern uint sql_thread_file_seq;
+extern uint64_t mts_frontier_pos;
+extern uint mts_frontier_file_seq;
+extern uint mts_workers;
 extern uint32_t sql_thread_timestamp;
+extern uint sql_delay;
+extern int sql_remaining_delay;
 extern pthread_mutex_t worker_mutex;
 extern pthread_mutex_t relay_log_pos_mutex;
+extern pthread_mutex_t reader_pos_mutex;
+extern pthread_rwlock_t worker_dispatch_lock;
 extern bool shutdown_program;
+extern bool prefetch_paused;
+extern volatile uint ddl_generation;
+extern bool is_sql_thread_running;
+extern uint reader_file_seq;
+extern unsigned long prefetch_position;
+extern uint32_t prefetch_timestamp;
 
 class query_queue;
 extern query_queue **queue;
 
 extern uint64_t stat_parsed_binlog_events;
 extern uint64_t stat_skipped_binlog_events;
+extern uint64_t stat_skipped_bytes;
 extern uint64_t stat_reached_ahead_relay_log;
+extern uint64_t stat_delay_waits;
+extern uint64_t stat_delay_wait_usec;
 extern uint64_t stat_reached_end_of_relay_log;
 extern uint64_t stat_unrelated_binlog_events;
 extern uint64_t stat_discarded_in_front_queries;
+extern uint64_t stat_executed_in_front_queries;
+extern uint64_t stat_filtered_queries;
+extern uint64_t stat_excluded_queries;
 extern uint64_t stat_pushed_queries;
 extern uint64_t stat_popped_queries;
 extern uint64_t stat_old_queries;
 extern uint64_t stat_discarded_queries;
 extern uint64_t stat_converted_queries;
 extern uint64_t stat_executed_selects;
+extern uint64_t stat_dry_run_selects;
 extern uint64_t stat_error_selects;
+extern uint64_t stat_missing_table_queries;
+extern uint64_t stat_late_queries;
+extern uint64_t stat_select_usec;
+extern uint64_t stat_select_hist[STATS_HIST_BUCKETS];
+extern uint64_t stat_handler_reads;
+extern uint64_t stat_handler_usec;
+extern uint64_t stat_handler_errors;
+extern uint64_t stat_handler_opens;
+extern uint64_t stat_explain_queries;
+extern uint64_t stat_explain_errors;
+extern uint64_t stat_gated_scans;
+extern uint64_t stat_gated_ranges;
+extern uint64_t stat_capped_selects;
+extern double sql_apply_rate;
+extern double select_latency_usec;
+extern uint64_t stat_schema_loads;
+extern uint64_t stat_schema_invalidations;
+extern uint64_t stat_payload_events;
+extern uint64_t stat_payload_inner_events;
+extern uint64_t stat_payload_errors;
+extern uint64_t stat_payload_compressed_bytes;
+extern uint64_t stat_payload_uncompressed_bytes;
+extern uint64_t stat_payload_decompress_usec;
+extern uint64_t stat_readahead_bytes;
+extern uint64_t stat_readahead_released_bytes;
+extern uint64_t stat_coalesced_batches;
+extern uint64_t stat_coalesced_queries;
+extern uint64_t stat_in_probes;
+extern uint64_t stat_session_changes;
+extern uint64_t stat_session_errors;
+extern uint64_t stat_pool_grows;
+extern uint64_t stat_pool_shrinks;
+
+/* v4 binlog event header */
+#define EVENT_HEADER_LENGTH 19
+/* Event types newer than the Binlog API */
+#define TRANSACTION_PAYLOAD_EVENT 40
+
+typedef struct event_header
+{
+  uint32_t timestamp;
+  uint8_t type_code;
+  uint32_t server_id;
+  uint32_t event_length;
+  uint32_t next_position;
+  uint16_t flags;
+} event_header_t;
+
+/* Where skip_relay_log_events() stops, and what it skipped */
+typedef struct skip_target
+{
+  uint events;
+  uint64_t bytes;
+  uint seconds;
+  uint32_t first_timestamp;
+  uint skipped_events;
+  uint64_t skipped_bytes;
+} skip_target_t;
+
+typedef bool (*payload_event_handler)(Binary_log_event *event, void *arg);
 
 enum relay_log_info_type { RLI_TYPE_FILE= 0, RLI_TYPE_TABLE= 1, };
 enum relay_log_code { READING= 0, END_OF_FILE= 1, TIMESTAMP_LIMIT= 2, };
@@ -82,19 +165,99 @@ typedef struct query
 {
   const mysql::Query_event *qev;
   uint64_t pos;
+  /* Relay log file number, the suffix of the relay log file name */
+  uint file_seq;
+  /* Transaction identity, gno is 0 without GTIDs */
+  unsigned char sid[16];
+  int64_t gno;
   bool shutdown;
+  /*
+    "db\0table" of a single table statement, set by the reader when the
+    heat map is enabled so that workers can attribute dropped queries
+    without parsing them. NULL if unknown.
+  */
+  char *target_table;
+  /* Further lookups coalesced into this one, see coalesce.cc */
+  struct query *next;
 } query_t;
 
 typedef struct status
 {
   enum relay_log_code code;
-  const char *next_file;
+  char next_file[PATH_MAX+1];
   uint64_t current_pos;
   uint64_t next_pos;
   int event_type;
   bool got_rotate_event;
+  /* GTID of the transaction being read */
+  unsigned char sid[16];
+  int64_t gno;
+  bool executed_transaction;
 } status_t;
 
+/* Statement classes of the rewriter, for statistics */
+enum statement_class
+{
+  STMT_UPDATE= 0,
+  STMT_UPDATE_MULTI,
+  STMT_DELETE,
+  STMT_DELETE_MULTI,
+  STMT_REPLACE,
+  STMT_OTHER,
+  STMT_CLASSES
+};
+
+enum rewrite_outcome
+{
+  REWRITE_CONVERTED= 0,
+  REWRITE_UNMATCHED,
+  REWRITE_MISSING_TABLE,
+  REWRITE_OUTCOMES
+};
+
+extern const char *statement_class_names[STMT_CLASSES];
+extern uint64_t stat_rewrites[STMT_CLASSES][REWRITE_OUTCOMES];
+
+typedef struct rewrite_info
+{
+  enum statement_class stmt_class;
+  std::string db;
+  std::string table;
+  bool missing_table;
+  /* Unique key fixed by the WHERE clause, empty if none (--handler-reads) */
+  std::string lookup_index;
+  std::vector<std::string> lookup_values;
+} rewrite_info_t;
+
+typedef struct worker_stats
+{
+  uint64_t popped_queries;
+  uint64_t old_queries;
+  uint64_t discarded_queries;
+  uint64_t converted_queries;
+  uint64_t executed_selects;
+  uint64_t dry_run_selects;
+  uint64_t error_selects;
+  uint64_t missing_table_queries;
+  uint64_t late_queries;
+  uint64_t select_usec;
+  uint64_t select_count;
+  uint64_t select_hist[STATS_HIST_BUCKETS];
+  uint64_t handler_reads;
+  uint64_t handler_usec;
+  uint64_t handler_errors;
+  uint64_t handler_opens;
+  uint64_t explain_queries;
+  uint64_t explain_errors;
+  uint64_t gated_scans;
+  uint64_t gated_ranges;
+  uint64_t capped_selects;
+  uint64_t in_probes;
+  uint64_t session_changes;
+  uint64_t session_errors;
+  uint64_t rewrites[STMT_CLASSES][REWRITE_OUTCOMES];
+} worker_stats_t;
+
 typedef struct worker_info
 {
   pthread_t ptid;
@@ -105,12 +268,77 @@ void *prefetch_worker(void *worker_info);
 void print_log(const char *format, ...);
 void print_log(const std::string &str);
 void free_query(query_t *query, char *select = NULL);
+void push_query(query_t *query);
+bool is_applied(const query_t *query);
+bool is_too_late(const query_t *query);
+uint64_t now_usec();
+uint relay_log_file_seq(const char *path);
 int check_local(const char *hostname_or_ip);
+enum statement_class classify_statement(const char *query, const char **body);
+bool is_convert_candidate(const char *query);
+char* convert_to_select(const std::string &query, const std::string &db,
+                        uint *length, rewrite_info_t *info);
+void update_stats(worker_stats_t *stats);
+int open_dry_run_output();
+void close_dry_run_output();
+int replication_booster_main(int argc, char **argv);
+int supervise_instances(int argc, char **argv);
+void print_status(FILE *stream);
+void print_statistics(FILE *stream);
+int init_worker_pool();
+int resize_worker_pool(uint workers);
+void retire_worker(uint worker_id);
+void clear_worker_queues();
+uint get_queue_depth(uint worker_id);
+void shutdown_worker_pool();
+int start_pool_controller();
+void stop_pool_controller();
+int start_control_socket();
+void stop_control_socket();
+int start_stats_shm();
+void stop_stats_shm();
+void update_throttle(MYSQL *mysql);
+bool throttle_wait();
+void print_throttle(FILE *stream);
+double get_throttle_rate();
+void set_throttle_rate(double rate);
+int start_relay_log_readahead();
+void stop_relay_log_readahead();
+bool load_booster_state(MYSQL *mysql, uint64_t *reader_pos);
+int save_booster_state(bool force);
+void stop_state_warmup();
+void parse_event_header(const char *buf, event_header_t *header);
+int open_relay_log(const char *path);
+bool read_relay_log(int fd, uint64_t pos, size_t length, std::string *buf);
+bool read_event_header(int fd, uint64_t pos, event_header_t *header);
+void note_relay_log_position(uint file_seq, uint64_t pos, uint32_t timestamp);
+uint64_t skip_relay_log_events(int fd, uint file_seq, uint64_t pos,
+                               skip_target_t *target);
+bool decode_transaction_payload(Binary_log_driver *drv, int fd, uint64_t pos,
+                                uint32_t length, payload_event_handler handler,
+                                void *arg);
+
+/*
+  Serving order of queued queries: nearest to the SQL thread first.
+  Shutdown requests go last so that queued work is finished first.
+*/
+struct query_order
+{
+  bool operator()(const query_t *a, const query_t *b) const
+  {
+    if (a->shutdown != b->shutdown)
+      return a->shutdown;
+    if (a->file_seq != b->file_seq)
+      return a->file_seq > b->file_seq;
+    return a->pos > b->pos;
+  }
+};
 
 class query_queue
 {
 private:
-  std::queue<query_t*> queue;
+  typedef std::priority_queue<query_t*, std::vector<query_t*>, query_order> queue_t;
+  queue_t queue;
   pthread_mutex_t mutex;
   pthread_cond_t cond;
   bool empty() const
@@ -147,14 +375,15 @@ public:
     pthread_mutex_unlock(&mutex);
   }
 
-  bool try_pop(query_t *popped_value)
+  bool try_pop(query_t **popped_value)
   {
     pthread_mutex_lock(&mutex);
     if(queue.empty())
     {
+      pthread_mutex_unlock(&mutex);
       return false;
     }
-    popped_value=queue.front();
+    *popped_value=queue.top();
     queue.pop();
     pthread_mutex_unlock(&mutex);
     return true;
@@ -167,7 +396,7 @@ public:
     {
       pthread_cond_wait(&cond, &mutex);
     }
-    query_t* popped_value=queue.front();
+    query_t* popped_value=queue.top();
     queue.pop();
     pthread_mutex_unlock(&mutex);
     return popped_value;
@@ -175,13 +404,13 @@ public:
 
   void clear()
   {
-    std::queue<query_t*> empty;
+    queue_t empty;
     pthread_mutex_lock(&mutex);
     std::swap(queue, empty);
     pthread_mutex_unlock(&mutex);
     while(!empty.empty())
     {
-      query_t* q=empty.front();
+      query_t* q=empty.top();
       empty.pop();
       free_query(q);
     }
@@ -0,0 +1,352 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Statements the SQL thread is going to skip because of replicate-*
+  options, or that the user excluded with --include/--exclude, are not
+  worth prefetching. They are dropped in the reader before a worker sees
+  them.
+*/
+
+#include "replication_filter.h"
+#include "schema_cache.h"
+#include <ctype.h>
+#include <strings.h>
+
+/* Upper bound of cached decisions, the cache is simply cleared beyond it */
+#define MAX_FILTER_DECISIONS 10000
+
+replication_filter *filters= NULL;
+
+/* True if a join, a second table or USING follows the table reference */
+static bool more_tables_follow(const char *p)
+{
+  static const char *keywords[]= {"join", "inner", "left", "right", "cross",
+                                  "straight_join", "natural", "using"};
+  if (*p == ',')
+    return true;
+  for (uint i= 0; i < sizeof(keywords)/sizeof(char*); i++)
+  {
+    const char *q= p;
+    if (match_keyword(&q, keywords[i]))
+      return true;
+  }
+  return false;
+}
+
+/* [db.]table, the database defaulting to the current one */
+static bool read_table_name(const char **p, const std::string &default_db,
+                            std::string *db, std::string *table)
+{
+  std::string first;
+  if (!read_identifier(p, &first))
+    return false;
+  if (**p == '.')
+  {
+    (*p)++;
+    if (!read_identifier(p, table))
+      return false;
+    *db= first;
+  } else
+  {
+    *db= default_db;
+    *table= first;
+  }
+  *p= skip_comments(*p);
+  return true;
+}
+
+bool find_target_table(const char *query, const std::string &default_db,
+                       std::string *db, std::string *table)
+{
+  static const char *modifiers[]= {"low_priority", "quick", "ignore"};
+  const char *p= skip_comments(query);
+  bool is_update;
+
+  /* REPLACE [LOW_PRIORITY | DELAYED] [INTO] table writes a single table */
+  if (match_keyword(&p, "replace"))
+  {
+    if (!match_keyword(&p, "low_priority"))
+      match_keyword(&p, "delayed");
+    match_keyword(&p, "into");
+    return read_table_name(&p, default_db, db, table) && !db->empty();
+  }
+  if (match_keyword(&p, "update"))
+    is_update= true;
+  else if (match_keyword(&p, "delete"))
+    is_update= false;
+  else
+    return false;
+  for (uint i= 0; i < sizeof(modifiers)/sizeof(char*); i++)
+    match_keyword(&p, modifiers[i]);
+  /* DELETE t1, t2 FROM ... deletes from several tables */
+  if (!is_update && !match_keyword(&p, "from"))
+    return false;
+
+  if (!read_table_name(&p, default_db, db, table) || more_tables_follow(p))
+    return false;
+
+  /* An alias may come before a join */
+  std::string alias;
+  match_keyword(&p, "as");
+  const char *q= p;
+  if (!match_keyword(&q, is_update ? "set" : "where") && read_identifier(&p, &alias))
+  {
+    p= skip_comments(p);
+    if (more_tables_follow(p))
+      return false;
+  }
+  return !db->empty();
+}
+
+bool wild_pattern::match(const char *pattern, const char *str)
+{
+  while (*pattern)
+  {
+    if (*pattern == '%')
+    {
+      while (*pattern == '%')
+        pattern++;
+      if (!*pattern)
+        return true;
+      for (; *str; str++)
+      {
+        if (match(pattern, str))
+          return true;
+      }
+      return false;
+    }
+    if (!*str)
+      return false;
+    if (*pattern == '\\' && pattern[1])
+      pattern++;
+    else if (*pattern == '_')
+    {
+      pattern++;
+      str++;
+      continue;
+    }
+    if (*pattern != *str)
+      return false;
+    pattern++;
+    str++;
+  }
+  return !*str;
+}
+
+bool wild_pattern::parse(const std::string &text)
+{
+  size_t dot= text.find('.');
+  if (dot == std::string::npos || dot == 0 || dot == text.length() - 1)
+    return false;
+  db= text.substr(0, dot);
+  table= text.substr(dot + 1);
+  return true;
+}
+
+static void split_list(const char *list, std::vector<std::string> *items)
+{
+  std::string item;
+  for (const char *p= list; ; p++)
+  {
+    if (!*p || *p == ',')
+    {
+      size_t begin= item.find_first_not_of(" \t");
+      size_t end= item.find_last_not_of(" \t");
+      if (begin != std::string::npos)
+        items->push_back(item.substr(begin, end - begin + 1));
+      item.clear();
+      if (!*p)
+        break;
+    } else
+      item.append(1, *p);
+  }
+}
+
+/*
+  Reads the replicate-* options from SHOW SLAVE STATUS. They can only be
+  changed while the SQL thread is stopped, so they are read once at
+  startup.
+*/
+bool replication_filter::load_slave_filters(MYSQL *mysql)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  MYSQL_FIELD *fields;
+  uint num_fields;
+
+  if (mysql_query(mysql, "SHOW SLAVE STATUS"))
+  {
+    print_log("ERROR: Could not execute SHOW SLAVE STATUS: %d %s",
+              mysql_errno(mysql), mysql_error(mysql));
+    return false;
+  }
+  result= mysql_store_result(mysql);
+  if (!result)
+    return false;
+  if (!(row= mysql_fetch_row(result)))
+  {
+    mysql_free_result(result);
+    return true;
+  }
+  num_fields= mysql_num_fields(result);
+  fields= mysql_fetch_fields(result);
+  for (uint i= 0; i < num_fields; i++)
+  {
+    const char *name= fields[i].name;
+    std::vector<std::string> items;
+    if (!row[i] || strncmp(name, "Replicate_", 10))
+      continue;
+    split_list(row[i], &items);
+    for (size_t j= 0; j < items.size(); j++)
+    {
+      wild_pattern pattern;
+      if (!strcmp(name, "Replicate_Do_DB"))
+        do_db.insert(items[j]);
+      else if (!strcmp(name, "Replicate_Ignore_DB"))
+        ignore_db.insert(items[j]);
+      else if (!strcmp(name, "Replicate_Do_Table"))
+        do_table.insert(items[j]);
+      else if (!strcmp(name, "Replicate_Ignore_Table"))
+        ignore_table.insert(items[j]);
+      else if (!strcmp(name, "Replicate_Wild_Do_Table") && pattern.parse(items[j]))
+        wild_do_table.push_back(pattern);
+      else if (!strcmp(name, "Replicate_Wild_Ignore_Table") && pattern.parse(items[j]))
+        wild_ignore_table.push_back(pattern);
+    }
+  }
+  mysql_free_result(result);
+  decisions.clear();
+  return true;
+}
+
+bool replication_filter::add_rule(const char *text, bool include)
+{
+  wild_pattern pattern;
+  if (!pattern.parse(text))
+    return false;
+  if (include)
+    include_rules.push_back(pattern);
+  else
+    exclude_rules.push_back(pattern);
+  decisions.clear();
+  return true;
+}
+
+bool replication_filter::empty() const
+{
+  return do_db.empty() && ignore_db.empty() && do_table.empty() &&
+         ignore_table.empty() && wild_do_table.empty() &&
+         wild_ignore_table.empty() && include_rules.empty() &&
+         exclude_rules.empty();
+}
+
+/*
+  Same order as the server applies statement based filters: database
+  options against the default database first, then table options in the
+  order do, ignore, wild do, wild ignore.
+*/
+enum filter_result replication_filter::decide(const std::string &default_db,
+                                              const std::string &db,
+                                              const std::string &table) const
+{
+  if (!do_db.empty() || !ignore_db.empty())
+  {
+    if (default_db.empty())
+      return FILTER_REPLICATION;
+    if (!do_db.empty() ? !do_db.count(default_db) : ignore_db.count(default_db))
+      return FILTER_REPLICATION;
+  }
+
+  if (!do_table.empty() || !ignore_table.empty() ||
+      !wild_do_table.empty() || !wild_ignore_table.empty())
+  {
+    std::string name(db);
+    name.append(".");
+    name.append(table);
+    bool decided= false;
+    if (do_table.count(name))
+      decided= true;
+    else if (ignore_table.count(name))
+      return FILTER_REPLICATION;
+    for (size_t i= 0; !decided && i < wild_do_table.size(); i++)
+      decided= wild_do_table[i].matches(db, table);
+    for (size_t i= 0; !decided && i < wild_ignore_table.size(); i++)
+    {
+      if (wild_ignore_table[i].matches(db, table))
+        return FILTER_REPLICATION;
+    }
+    if (!decided && (!do_table.empty() || !wild_do_table.empty()))
+      return FILTER_REPLICATION;
+  }
+
+  for (size_t i= 0; i < exclude_rules.size(); i++)
+  {
+    if (exclude_rules[i].matches(db, table))
+      return FILTER_RULE;
+  }
+  if (include_rules.empty())
+    return FILTER_PASS;
+  for (size_t i= 0; i < include_rules.size(); i++)
+  {
+    if (include_rules[i].matches(db, table))
+      return FILTER_PASS;
+  }
+  return FILTER_RULE;
+}
+
+/*
+  Called by the relay log reader only, so the decision cache needs no
+  lock. Statements whose table is not known are prefetched.
+*/
+enum filter_result replication_filter::check(const char *query,
+                                             const std::string &default_db)
+{
+  std::string db, table;
+  if (!find_target_table(query, default_db, &db, &table))
+    return FILTER_PASS;
+
+  std::string key(default_db);
+  key.append(1, '\0');
+  key.append(db);
+  key.append(1, '\0');
+  key.append(table);
+  std::map<std::string, enum filter_result>::iterator it= decisions.find(key);
+  if (it != decisions.end())
+    return it->second;
+
+  if (decisions.size() >= MAX_FILTER_DECISIONS)
+    decisions.clear();
+  enum filter_result result= decide(default_db, db, table);
+  decisions.insert(std::make_pair(key, result));
+  return result;
+}
+
+void replication_filter::log_summary() const
+{
+  print_log("Replication filters: %lu database, %lu table, %lu wild table rules. "
+          "Include rules: %lu, exclude rules: %lu.",
+          (unsigned long)(do_db.size() + ignore_db.size()),
+          (unsigned long)(do_table.size() + ignore_table.size()),
+          (unsigned long)(wild_do_table.size() + wild_ignore_table.size()),
+          (unsigned long)include_rules.size(),
+          (unsigned long)exclude_rules.size());
+}
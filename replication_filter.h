@@ -0,0 +1,94 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __replication_filter_h_
+#define __replication_filter_h_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include "replication_booster.h"
+
+enum filter_result
+{
+  FILTER_PASS= 0,
+  /* The slave's replicate-* options skip the statement */
+  FILTER_REPLICATION,
+  /* Excluded by --include/--exclude */
+  FILTER_RULE,
+};
+
+/* "db.table" pattern with % and _ wildcards, as replicate-wild-do-table */
+class wild_pattern
+{
+private:
+  std::string db;
+  std::string table;
+  static bool match(const char *pattern, const char *str);
+
+public:
+  bool parse(const std::string &text);
+  bool matches(const std::string &db_name, const std::string &table_name) const
+  {
+    return match(db.c_str(), db_name.c_str()) &&
+           match(table.c_str(), table_name.c_str());
+  }
+};
+
+/*
+  Decides in the relay log reader whether an UPDATE or DELETE is worth
+  prefetching. Slave filters follow the statement based rules of the
+  server: database options are checked against the default database,
+  table options against the updated table. Decisions are cached per
+  (default database, table), so patterns are matched once per table.
+*/
+class replication_filter
+{
+private:
+  std::set<std::string> do_db, ignore_db;
+  std::set<std::string> do_table, ignore_table;
+  std::vector<wild_pattern> wild_do_table, wild_ignore_table;
+  std::vector<wild_pattern> include_rules, exclude_rules;
+  std::map<std::string, enum filter_result> decisions;
+
+  enum filter_result decide(const std::string &default_db,
+                            const std::string &db,
+                            const std::string &table) const;
+
+public:
+  bool load_slave_filters(MYSQL *mysql);
+  bool add_rule(const char *pattern, bool include);
+  bool empty() const;
+  enum filter_result check(const char *query, const std::string &default_db);
+  void log_summary() const;
+};
+
+/*
+  Target table of a single table UPDATE, DELETE or REPLACE, found without
+  regular expressions. Returns false for multi-table statements.
+*/
+bool find_target_table(const char *query, const std::string &default_db,
+                       std::string *db, std::string *table);
+
+extern replication_filter *filters;
+
+#endif
@@ -0,0 +1,715 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Rewrites UPDATE, DELETE and REPLACE statements into SELECT statements
+  that read the same records. Statements are split into clauses at top
+  level keywords, skipping quoted strings, identifiers, comments and
+  parentheses, so that keywords in literals or subqueries do not confuse
+  the rewrite.
+*/
+
+#include "replication_booster.h"
+#include "schema_cache.h"
+#include "handler_read.h"
+#include <algorithm>
+#include <ctype.h>
+#include <strings.h>
+
+#define countof(array) (sizeof(array) / sizeof(array[0]))
+
+const char *statement_class_names[STMT_CLASSES]=
+  {"UPDATE", "multi-table UPDATE", "DELETE", "multi-table DELETE", "REPLACE",
+   "other"};
+
+static const size_t npos= std::string::npos;
+
+/* The shared lexing helpers at a position of a string */
+static bool is_line_comment(const std::string &s, size_t pos)
+{
+  return ::is_line_comment(s.c_str() + pos);
+}
+
+static bool is_quote_start(const std::string &s, size_t pos)
+{
+  return ::is_quote_start(s.c_str() + pos);
+}
+
+static size_t skip_quoted(const std::string &s, size_t pos)
+{
+  const char *end= ::skip_quoted(s.c_str() + pos);
+  return end ? end - s.c_str() : s.length();
+}
+
+/*
+  Drops line comments, whose end a rewrite could lose when it trims a
+  clause, and unwraps executable comments, whose contents mysqld runs.
+*/
+static std::string normalize_comments(const std::string &s)
+{
+  std::string out;
+  size_t pos= 0;
+  bool executable= false;
+  while (pos < s.length())
+  {
+    if (executable && !s.compare(pos, 2, "*/"))
+    {
+      out.append(" ");
+      executable= false;
+      pos+= 2;
+    } else if (!s.compare(pos, 3, "/*!"))
+    {
+      for (pos+= 3; pos < s.length() && isdigit((unsigned char)s[pos]); pos++)
+        ;
+      out.append(" ");
+      executable= true;
+    } else if (!is_quote_start(s, pos))
+      out.append(1, s[pos++]);
+    else if (is_line_comment(s, pos))
+      pos= skip_quoted(s, pos);
+    else
+    {
+      size_t next= skip_quoted(s, pos);
+      out.append(s, pos, next - pos);
+      pos= next;
+    }
+  }
+  return out;
+}
+
+/*
+  Position of the first of the keywords outside parentheses and quotes,
+  at or after pos, npos if there is none.
+*/
+static size_t find_keyword(const std::string &s, size_t pos,
+                           const char *const *keywords, size_t count)
+{
+  int depth= 0;
+  while (pos < s.length())
+  {
+    if (is_quote_start(s, pos))
+    {
+      pos= skip_quoted(s, pos);
+      continue;
+    }
+    char c= s[pos];
+    if (c == '(')
+      depth++;
+    else if (c == ')')
+      depth--;
+    else if (is_identifier_char(c))
+    {
+      size_t end= pos;
+      while (end < s.length() && is_identifier_char(s[end]))
+        end++;
+      if (!depth && isalpha((unsigned char)c) && (!pos || s[pos - 1] != '.'))
+      {
+        for (size_t i= 0; i < count; i++)
+        {
+          if (strlen(keywords[i]) == end - pos &&
+              !strncasecmp(s.c_str() + pos, keywords[i], end - pos))
+            return pos;
+        }
+      }
+      pos= end;
+      continue;
+    }
+    pos++;
+  }
+  return npos;
+}
+
+static size_t find_keyword(const std::string &s, size_t pos, const char *keyword)
+{
+  return find_keyword(s, pos, &keyword, 1);
+}
+
+/* Position of the parenthesis closing the one at pos, npos if none */
+static size_t find_closing(const std::string &s, size_t pos)
+{
+  int depth= 0;
+  while (pos < s.length())
+  {
+    if (is_quote_start(s, pos))
+    {
+      pos= skip_quoted(s, pos);
+      continue;
+    }
+    if (s[pos] == '(')
+      depth++;
+    else if (s[pos] == ')' && !--depth)
+      return pos;
+    pos++;
+  }
+  return npos;
+}
+
+static size_t skip_space(const std::string &s, size_t pos)
+{
+  while (pos < s.length() && isspace((unsigned char)s[pos]))
+    pos++;
+  return pos;
+}
+
+/* Text between begin and end (npos for the end) without surrounding space */
+static std::string trim(const std::string &s, size_t begin, size_t end= npos)
+{
+  if (end == npos || end > s.length())
+    end= s.length();
+  begin= skip_space(s, begin);
+  while (end > begin && isspace((unsigned char)s[end - 1]))
+    end--;
+  return s.substr(begin, end - begin);
+}
+
+/* Returns the position after the keyword at pos, or pos if it is not there */
+static size_t skip_keyword(const std::string &s, size_t pos, const char *keyword)
+{
+  size_t len= strlen(keyword), start= skip_space(s, pos);
+  if (!strncasecmp(s.c_str() + start, keyword, len) &&
+      !is_identifier_char(s.c_str()[start + len]))
+    return start + len;
+  return pos;
+}
+
+static size_t skip_modifiers(const std::string &s, size_t pos,
+                             const char *const *modifiers, size_t count)
+{
+  for (size_t i= 0; i < count; i++)
+    pos= skip_keyword(s, pos, modifiers[i]);
+  return skip_space(s, pos);
+}
+
+/* Splits at commas outside parentheses and quotes */
+static void split_list(const std::string &s, std::vector<std::string> *items)
+{
+  size_t pos= 0, start= 0;
+  int depth= 0;
+  items->clear();
+  while (pos < s.length())
+  {
+    if (is_quote_start(s, pos))
+    {
+      pos= skip_quoted(s, pos);
+      continue;
+    }
+    if (s[pos] == '(')
+      depth++;
+    else if (s[pos] == ')')
+      depth--;
+    else if (s[pos] == ',' && !depth)
+    {
+      items->push_back(trim(s, start, pos));
+      start= pos + 1;
+    }
+    pos++;
+  }
+  items->push_back(trim(s, start));
+}
+
+/* Column name of a possibly qualified and quoted column reference */
+static std::string column_name(const std::string &ref)
+{
+  size_t pos= 0, start= 0;
+  while (pos < ref.length())
+  {
+    if (ref[pos] == '`')
+      pos= skip_quoted(ref, pos);
+    else if (ref[pos++] == '.')
+      start= pos;
+  }
+  std::string name= trim(ref, start);
+  if (name.length() >= 2 && name[0] == '`' && name[name.length() - 1] == '`')
+  {
+    std::string unquoted;
+    for (size_t i= 1; i + 1 < name.length(); i++)
+    {
+      unquoted.append(1, name[i]);
+      if (name[i] == '`')
+        i++;
+    }
+    return unquoted;
+  }
+  return name;
+}
+
+static bool is_multi_table(const std::string &tables)
+{
+  static const char *joins[]= {"join", "straight_join"};
+  std::vector<std::string> items;
+  split_list(tables, &items);
+  return items.size() > 1 || find_keyword(tables, 0, joins, countof(joins)) != npos;
+}
+
+static void append_identifier(std::string *str, const std::string &name)
+{
+  str->append("`");
+  for (size_t i= 0; i < name.length(); i++)
+  {
+    if (name[i] == '`')
+      str->append("`");
+    str->append(1, name[i]);
+  }
+  str->append("`");
+}
+
+/*
+  Builds "isnull(coalesce(pk, indexed columns))" for a DELETE, so that
+  the probe reads the records the DELETE removes index entries for
+  without fetching every (possibly off-page) column as "select *" does.
+*/
+static bool make_narrow_columns(const table_meta_t *meta, std::string *columns)
+{
+  std::vector<std::string> names;
+  for (size_t i= 0; i < meta->indexes.size(); i++)
+  {
+    for (size_t j= 0; j < meta->indexes[i].columns.size(); j++)
+    {
+      const std::string &name= meta->indexes[i].columns[j];
+      if (std::find(names.begin(), names.end(), name) == names.end())
+        names.push_back(name);
+    }
+  }
+  if (names.empty())
+    return false;
+  columns->assign("isnull(coalesce(");
+  for (size_t i= 0; i < names.size(); i++)
+  {
+    if (i)
+      columns->append(",");
+    append_identifier(columns, names[i]);
+  }
+  columns->append("))");
+  return true;
+}
+
+/*
+  Looks up the target table of a single table statement. Returns false
+  if the table is known not to exist.
+*/
+static bool lookup_table(const std::string &table_ref, const std::string &db,
+                         rewrite_info_t *info, table_meta_ptr *meta)
+{
+  if (!parse_table_name(table_ref, db, &info->db, &info->table))
+    return true;
+  if (!schemas)
+    return true;
+  *meta= schemas->get(info->db, info->table);
+  if (*meta && !(*meta)->exists)
+  {
+    DBUG_PRINT("Table %s.%s does not exist.", info->db.c_str(), info->table.c_str());
+    info->missing_table= true;
+    return false;
+  }
+  return true;
+}
+
+/*
+  UPDATE [LOW_PRIORITY] [IGNORE] tables SET assignments [WHERE ...]
+  [ORDER BY ...] [LIMIT ...] becomes
+  SELECT isnull(coalesce(assignments)) FROM tables [WHERE ...] ...,
+  which reads the updated columns of the same rows.
+*/
+static bool rewrite_update(const std::string &stmt, const std::string &db,
+                           rewrite_info_t *info, std::string *select)
+{
+  static const char *modifiers[]= {"low_priority", "ignore"};
+  static const char *clauses[]= {"where", "order", "limit"};
+  table_meta_ptr meta;
+  size_t pos= skip_modifiers(stmt, 0, modifiers, countof(modifiers));
+  size_t set= find_keyword(stmt, pos, "set");
+  if (set == npos)
+    return false;
+  size_t clause= find_keyword(stmt, set + 3, clauses, countof(clauses));
+  std::string tables= trim(stmt, pos, set);
+  std::string assignments= trim(stmt, set + 3, clause);
+  std::string tail= clause == npos ? "" : trim(stmt, clause);
+  if (tables.empty() || assignments.empty())
+    return false;
+
+  if (is_multi_table(tables))
+    info->stmt_class= STMT_UPDATE_MULTI;
+  else
+  {
+    if (!lookup_table(tables, db, info, &meta))
+      return false;
+    if (opt_handler_reads && meta && !tail.empty())
+      find_point_lookup(meta.get(), tail, info);
+  }
+  select->assign("select isnull(coalesce(");
+  select->append(assignments);
+  select->append(")) from ");
+  select->append(tables);
+  if (!tail.empty())
+  {
+    select->append(" ");
+    select->append(tail);
+  }
+  return true;
+}
+
+/* "select t1.*, t2.* from tables [WHERE ...]" for the deleted tables */
+static bool rewrite_multi_delete(const std::string &targets,
+                                 const std::string &tables,
+                                 const std::string &tail, std::string *select)
+{
+  std::vector<std::string> items;
+  split_list(targets, &items);
+  if (tables.empty())
+    return false;
+  select->assign("select ");
+  for (size_t i= 0; i < items.size(); i++)
+  {
+    std::string target= items[i];
+    if (target.length() > 2 && !target.compare(target.length() - 2, 2, ".*"))
+      target.erase(target.length() - 2);
+    if (target.empty())
+      return false;
+    if (i)
+      select->append(", ");
+    select->append(target);
+    select->append(".*");
+  }
+  select->append(" from ");
+  select->append(tables);
+  if (!tail.empty())
+  {
+    select->append(" ");
+    select->append(tail);
+  }
+  return true;
+}
+
+/*
+  DELETE [LOW_PRIORITY] [QUICK] [IGNORE] FROM table [WHERE ...]
+  [ORDER BY ...] [LIMIT ...] reads the indexed columns of the rows.
+  The multi-table forms "DELETE t1, t2 FROM tables WHERE ..." and
+  "DELETE FROM t1, t2 USING tables WHERE ..." read the rows of the
+  deleted tables only.
+*/
+static bool rewrite_delete(const std::string &stmt, const std::string &db,
+                           rewrite_info_t *info, std::string *select)
+{
+  static const char *modifiers[]= {"low_priority", "quick", "ignore"};
+  static const char *clauses[]= {"where", "order", "limit"};
+  table_meta_ptr meta;
+  size_t pos= skip_modifiers(stmt, 0, modifiers, countof(modifiers));
+  size_t from= skip_keyword(stmt, pos, "from");
+
+  if (from == pos)
+  {
+    info->stmt_class= STMT_DELETE_MULTI;
+    if ((from= find_keyword(stmt, pos, "from")) == npos)
+      return false;
+    size_t where= find_keyword(stmt, from + 4, "where");
+    return rewrite_multi_delete(trim(stmt, pos, from),
+                                trim(stmt, from + 4, where),
+                                where == npos ? "" : trim(stmt, where), select);
+  }
+  size_t using_pos= find_keyword(stmt, from, "using");
+  if (using_pos != npos)
+  {
+    info->stmt_class= STMT_DELETE_MULTI;
+    size_t where= find_keyword(stmt, using_pos + 5, "where");
+    return rewrite_multi_delete(trim(stmt, from, using_pos),
+                                trim(stmt, using_pos + 5, where),
+                                where == npos ? "" : trim(stmt, where), select);
+  }
+
+  size_t clause= find_keyword(stmt, from, clauses, countof(clauses));
+  std::string table= trim(stmt, from, clause);
+  std::string tail= clause == npos ? "" : trim(stmt, clause);
+  std::string columns("*");
+  if (table.empty() || is_multi_table(table))
+    return false;
+  if (!lookup_table(table, db, info, &meta))
+    return false;
+  if (meta && !make_narrow_columns(meta.get(), &columns))
+    columns= "*";
+  if (opt_handler_reads && meta && !tail.empty())
+    find_point_lookup(meta.get(), tail, info);
+  select->assign("select ");
+  select->append(columns);
+  select->append(" from ");
+  select->append(table);
+  if (!tail.empty())
+  {
+    select->append(" ");
+    select->append(tail);
+  }
+  return true;
+}
+
+/* Rows of REPLACE ... VALUES (...), (...) or REPLACE ... SET a=1, b=2 */
+static bool read_replace_rows(const std::string &stmt, size_t pos,
+                              std::vector<std::string> *columns,
+                              std::vector<std::vector<std::string> > *rows)
+{
+  size_t next= skip_keyword(stmt, pos, "values");
+  if (next == pos)
+    next= skip_keyword(stmt, pos, "value");
+  if (next != pos)
+  {
+    pos= next;
+    while (1)
+    {
+      pos= skip_keyword(stmt, pos, "row");
+      pos= skip_space(stmt, pos);
+      size_t close;
+      if (pos >= stmt.length() || stmt[pos] != '(' ||
+          (close= find_closing(stmt, pos)) == npos)
+        return false;
+      std::vector<std::string> values;
+      split_list(stmt.substr(pos + 1, close - pos - 1), &values);
+      rows->push_back(values);
+      pos= skip_space(stmt, close + 1);
+      if (pos >= stmt.length() || stmt[pos] != ',')
+        return true;
+      pos++;
+    }
+  }
+
+  if ((next= skip_keyword(stmt, pos, "set")) == pos || !columns->empty())
+    return false;
+  std::vector<std::string> assignments, values;
+  split_list(stmt.substr(next), &assignments);
+  for (size_t i= 0; i < assignments.size(); i++)
+  {
+    size_t eq= 0;
+    const std::string &item= assignments[i];
+    while (eq < item.length() && item[eq] != '=')
+      eq= is_quote_start(item, eq) ? skip_quoted(item, eq) : eq + 1;
+    if (eq >= item.length())
+      return false;
+    columns->push_back(column_name(item.substr(0, eq)));
+    values.push_back(trim(item, eq + 1));
+  }
+  rows->push_back(values);
+  return true;
+}
+
+static bool is_unknown_value(const std::string &value)
+{
+  return value.empty() || !strcasecmp(value.c_str(), "null") ||
+         !strcasecmp(value.c_str(), "default");
+}
+
+/*
+  REPLACE deletes the rows that have the same primary key or unique key
+  values as a new row. For each such key given in the statement, reads
+  the indexed columns of the rows with "key IN (values of all rows)",
+  the SELECTs for several keys joined by UNION ALL. Needs the table
+  definition; REPLACE ... SELECT is not converted.
+*/
+static bool rewrite_replace(const std::string &stmt, const std::string &db,
+                            rewrite_info_t *info, std::string *select)
+{
+  static const char *modifiers[]= {"low_priority", "delayed", "into"};
+  table_meta_ptr meta;
+  std::vector<std::string> columns;
+  std::vector<std::vector<std::string> > rows;
+  size_t pos= skip_modifiers(stmt, 0, modifiers, countof(modifiers));
+  size_t end= pos;
+  while (end < stmt.length() && !isspace((unsigned char)stmt[end]) &&
+         stmt[end] != '(')
+    end= stmt[end] == '`' ? skip_quoted(stmt, end) : end + 1;
+  if (end == pos || !lookup_table(stmt.substr(pos, end - pos), db, info, &meta) ||
+      !meta || info->table.empty())
+    return false;
+
+  pos= skip_keyword(stmt, end, "partition");
+  if (pos != end)
+  {
+    pos= skip_space(stmt, pos);
+    if ((pos= find_closing(stmt, pos)) == npos)
+      return false;
+    pos++;
+  }
+  pos= skip_space(stmt, pos);
+  if (pos < stmt.length() && stmt[pos] == '(')
+  {
+    size_t close= find_closing(stmt, pos);
+    if (close == npos || skip_keyword(stmt, pos + 1, "select") != pos + 1)
+      return false;
+    std::vector<std::string> names;
+    split_list(stmt.substr(pos + 1, close - pos - 1), &names);
+    for (size_t i= 0; i < names.size(); i++)
+      columns.push_back(column_name(names[i]));
+    pos= close + 1;
+  }
+  if (!read_replace_rows(stmt, pos, &columns, &rows))
+    return false;
+  if (columns.empty())
+    columns= meta->columns;
+
+  std::string narrow;
+  if (!make_narrow_columns(meta.get(), &narrow))
+    return false;
+  select->clear();
+  for (size_t k= 0; k < meta->indexes.size(); k++)
+  {
+    const index_info_t &key= meta->indexes[k];
+    std::vector<size_t> positions;
+    if (!key.primary && !key.unique)
+      continue;
+    for (size_t i= 0; i < key.columns.size(); i++)
+    {
+      size_t j;
+      for (j= 0; j < columns.size(); j++)
+      {
+        if (!strcasecmp(columns[j].c_str(), key.columns[i].c_str()))
+          break;
+      }
+      if (j == columns.size())
+        break;
+      positions.push_back(j);
+    }
+    if (positions.size() != key.columns.size())
+      continue;
+
+    std::string in_list;
+    for (size_t r= 0; r < rows.size(); r++)
+    {
+      std::string tuple;
+      if (rows[r].size() != columns.size())
+        return false;
+      for (size_t i= 0; i < positions.size(); i++)
+      {
+        const std::string &value= rows[r][positions[i]];
+        /* NULL never conflicts, DEFAULT and AUTO_INCREMENT are unknown */
+        if (is_unknown_value(value))
+        {
+          tuple.clear();
+          break;
+        }
+        tuple.append(i ? "," : "");
+        tuple.append(value);
+      }
+      if (tuple.empty())
+        continue;
+      in_list.append(in_list.empty() ? "" : ",");
+      if (positions.size() > 1)
+        in_list.append("(" + tuple + ")");
+      else
+        in_list.append(tuple);
+    }
+    if (in_list.empty())
+      continue;
+
+    select->append(select->empty() ? "select " : " union all select ");
+    select->append(narrow);
+    select->append(" from ");
+    append_identifier(select, info->db);
+    select->append(".");
+    append_identifier(select, info->table);
+    select->append(" where ");
+    if (positions.size() > 1)
+      select->append("(");
+    for (size_t i= 0; i < key.columns.size(); i++)
+    {
+      if (i)
+        select->append(",");
+      append_identifier(select, key.columns[i]);
+    }
+    select->append(positions.size() > 1 ? ") in (" : " in (");
+    select->append(in_list);
+    select->append(")");
+  }
+  return !select->empty();
+}
+
+/*
+  Class of the statement from its first keyword after comments and
+  opening parentheses. *body is set to the text after the keyword.
+*/
+enum statement_class classify_statement(const char *query, const char **body)
+{
+  static const struct { const char *keyword; enum statement_class stmt_class; }
+    keywords[]= {{"update", STMT_UPDATE}, {"delete", STMT_DELETE},
+                 {"replace", STMT_REPLACE}};
+  query= skip_comments(query);
+  while (*query == '(')
+    query= skip_comments(query + 1);
+  for (size_t i= 0; i < countof(keywords); i++)
+  {
+    size_t len= strlen(keywords[i].keyword);
+    if (!strncasecmp(query, keywords[i].keyword, len) &&
+        !is_identifier_char(query[len]))
+    {
+      if (body)
+        *body= query + len;
+      return keywords[i].stmt_class;
+    }
+  }
+  if (body)
+    *body= query;
+  return STMT_OTHER;
+}
+
+bool is_convert_candidate(const char *query)
+{
+  if (classify_statement(query, NULL) != STMT_OTHER)
+    return true;
+  DBUG_PRINT("Matched non-convert query: %s", query);
+  return false;
+}
+
+char* convert_to_select(const std::string &query, const std::string &db,
+                        uint *length, rewrite_info_t *info)
+{
+  std::string select;
+  const char *body;
+  bool converted= false;
+  char *buf;
+
+  info->missing_table= false;
+  info->db.clear();
+  info->table.clear();
+  info->lookup_index.clear();
+  info->lookup_values.clear();
+  info->stmt_class= classify_statement(query.c_str(), &body);
+  std::string stmt(normalize_comments(body));
+  switch (info->stmt_class)
+  {
+  case STMT_UPDATE:
+    converted= rewrite_update(stmt, db, info, &select);
+    break;
+  case STMT_DELETE:
+    converted= rewrite_delete(stmt, db, info, &select);
+    break;
+  case STMT_REPLACE:
+    converted= rewrite_replace(stmt, db, info, &select);
+    break;
+  default:
+    break;
+  }
+  if (!converted)
+  {
+    DBUG_PRINT("Not converted: %s", query.c_str());
+    return NULL;
+  }
+
+  DBUG_PRINT(select);
+  *length= select.length();
+  buf= new char[*length + 1];
+  strcpy(buf, select.c_str());
+  return buf;
+}
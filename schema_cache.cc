@@ -0,0 +1,546 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#include "schema_cache.h"
+#include <ctype.h>
+#include <strings.h>
+#include <boost/regex.hpp>
+
+/* Tables not found are looked up again after this many seconds */
+#define NEGATIVE_ENTRY_TTL 10
+
+schema_cache *schemas= NULL;
+uint64_t stat_schema_loads= 0;
+uint64_t stat_schema_invalidations= 0;
+
+const char *ddl_table_pattern= "\\A\\s*(?:create|alter|drop|truncate|rename)\\b.*?\\b(?:table|index\\s+\\S+\\s+on)\\s+(?:if\\s+(?:not\\s+)?exists\\s+)?((?:`[^`]+`|[\\w$]+)(?:\\s*\\.\\s*(?:`[^`]+`|[\\w$]+))?)(.*)\\Z";
+const char *ddl_db_pattern= "\\A\\s*(?:create|alter|drop)\\s+(?:database|schema)\\s+(?:if\\s+(?:not\\s+)?exists\\s+)?(`[^`]+`|[\\w$]+)";
+
+const boost::regex ddl_table_exp(ddl_table_pattern,
+  boost::regbase::normal | boost::regbase::icase);
+const boost::regex ddl_db_exp(ddl_db_pattern,
+  boost::regbase::normal | boost::regbase::icase);
+
+const index_info_t *table_meta::primary_key() const
+{
+  for (size_t i= 0; i < indexes.size(); i++)
+  {
+    if (indexes[i].primary)
+      return &indexes[i];
+  }
+  return NULL;
+}
+
+bool table_meta::is_indexed(const std::string &column) const
+{
+  for (size_t i= 0; i < indexes.size(); i++)
+  {
+    for (size_t j= 0; j < indexes[i].columns.size(); j++)
+    {
+      if (!strcasecmp(indexes[i].columns[j].c_str(), column.c_str()))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool table_meta::has_column(const std::string &column) const
+{
+  for (size_t i= 0; i < columns.size(); i++)
+  {
+    if (!strcasecmp(columns[i].c_str(), column.c_str()))
+      return true;
+  }
+  return false;
+}
+
+static std::string unquote_identifier(const std::string &str)
+{
+  size_t len= str.length();
+  if (len >= 2 && str[0] == '`' && str[len-1] == '`')
+    return str.substr(1, len - 2);
+  return str;
+}
+
+static size_t scan_identifier(const std::string &str, size_t pos)
+{
+  if (pos < str.length() && str[pos] == '`')
+  {
+    size_t end= str.find('`', pos + 1);
+    return end == std::string::npos ? std::string::npos : end + 1;
+  }
+  while (pos < str.length() && is_identifier_char(str[pos]))
+    pos++;
+  return pos;
+}
+
+/*
+  Extracts db and table name from a single table reference such as
+  "db.t", "`t` AS x" or "t x". Returns false for joins and table lists.
+*/
+bool parse_table_name(const std::string &ref, const std::string &default_db,
+                      std::string *db, std::string *table)
+{
+  size_t pos= 0, end;
+  while (pos < ref.length() && isspace((unsigned char)ref[pos]))
+    pos++;
+  end= scan_identifier(ref, pos);
+  if (end == std::string::npos || end == pos)
+    return false;
+  std::string first= unquote_identifier(ref.substr(pos, end - pos));
+  pos= end;
+  if (pos < ref.length() && ref[pos] == '.')
+  {
+    end= scan_identifier(ref, pos + 1);
+    if (end == std::string::npos || end == pos + 1)
+      return false;
+    *db= first;
+    *table= unquote_identifier(ref.substr(pos + 1, end - pos - 1));
+    pos= end;
+  } else
+  {
+    *db= default_db;
+    *table= first;
+  }
+
+  /* Optional alias, nothing else may follow */
+  static const boost::regex alias_exp("\\A\\s*(?:as\\s+)?(?:`[^`]+`|[\\w$]+)?\\s*\\Z",
+    boost::regbase::normal | boost::regbase::icase);
+  std::string rest= ref.substr(pos);
+  if (!boost::regex_match(rest, alias_exp))
+    return false;
+  static const boost::regex join_exp("\\A\\s*(?:as\\s+)?(?:join|inner|left|right|cross|straight_join|natural)\\b",
+    boost::regbase::normal | boost::regbase::icase);
+  return !boost::regex_search(rest, join_exp) && !db->empty();
+}
+
+bool is_identifier_char(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+bool is_line_comment(const char *p)
+{
+  return p[0] == '#' ||
+         (p[0] == '-' && p[1] == '-' && isspace((unsigned char)p[2]));
+}
+
+bool is_quote_start(const char *p)
+{
+  return *p == '\'' || *p == '"' || *p == '`' || is_line_comment(p) ||
+         (p[0] == '/' && p[1] == '*' && p[2] != '!');
+}
+
+const char *skip_quoted(const char *p)
+{
+  if (p[0] == '/')
+  {
+    const char *end= strstr(p + 2, "*/");
+    return end ? end + 2 : NULL;
+  }
+  if (is_line_comment(p))
+  {
+    const char *end= strchr(p, '\n');
+    return end ? end : p + strlen(p);
+  }
+  char quote= *p++;
+  while (*p)
+  {
+    if (*p == '\\' && quote != '`' && p[1])
+      p+= 2;
+    else if (*p == quote && p[1] == quote)
+      p+= 2;
+    else if (*p++ == quote)
+      return p;
+  }
+  return NULL;
+}
+
+const char *skip_comments(const char *query)
+{
+  while (1)
+  {
+    while (isspace((unsigned char)*query))
+      query++;
+    if (!is_quote_start(query) ||
+        *query == '\'' || *query == '"' || *query == '`')
+      return query;
+    const char *end= skip_quoted(query);
+    if (!end)
+      return query;
+    query= end;
+  }
+}
+
+bool match_keyword(const char **p, const char *keyword)
+{
+  size_t len= strlen(keyword);
+  if (strncasecmp(*p, keyword, len) || is_identifier_char((*p)[len]))
+    return false;
+  *p= skip_comments(*p + len);
+  return true;
+}
+
+bool read_identifier(const char **p, std::string *name)
+{
+  name->clear();
+  if (**p == '`')
+  {
+    const char *end= skip_quoted(*p);
+    if (!end)
+      return false;
+    for (const char *q= *p + 1; q < end - 1; q++)
+    {
+      name->append(1, *q);
+      if (*q == '`')
+        q++;
+    }
+    *p= end;
+  } else
+  {
+    while (is_identifier_char(**p))
+      name->append(1, *(*p)++);
+  }
+  return !name->empty();
+}
+
+bool is_ddl_query(const char *query)
+{
+  static const char *keywords[]= {"create", "alter", "drop", "truncate", "rename"};
+  query= skip_comments(query);
+  for (uint i= 0; i < sizeof(keywords)/sizeof(char*); i++)
+  {
+    size_t len= strlen(keywords[i]);
+    if (!strncasecmp(query, keywords[i], len) &&
+        !is_identifier_char(query[len]))
+      return true;
+  }
+  return false;
+}
+
+/*
+  Drops cached definitions affected by a DDL statement. Statements we can
+  not attribute to a single table invalidate the whole database.
+*/
+void note_ddl_query(const char *query, const std::string &default_db,
+                    uint file_seq, uint64_t pos)
+{
+  boost::cmatch result;
+  std::string db, table;
+
+  if (!schemas)
+    return;
+  if (boost::regex_search(query, result, ddl_db_exp))
+  {
+    schemas->note_ddl(unquote_identifier(result.str(1)), "", file_seq, pos);
+    return;
+  }
+  if (boost::regex_search(query, result, ddl_table_exp) &&
+      parse_table_name(result.str(1), default_db, &db, &table) &&
+      result.str(2).find(',') == std::string::npos)
+  {
+    schemas->note_ddl(db, table, file_seq, pos);
+    return;
+  }
+  if (!default_db.empty())
+    schemas->note_ddl(default_db, "", file_seq, pos);
+  else
+    schemas->invalidate_all();
+}
+
+schema_cache::schema_cache()
+  : mysql(NULL)
+{
+  pthread_mutex_init(&mutex, NULL);
+  pthread_mutex_init(&load_mutex, NULL);
+}
+
+schema_cache::~schema_cache()
+{
+  if (mysql)
+    mysql_close(mysql);
+  pthread_mutex_destroy(&mutex);
+  pthread_mutex_destroy(&load_mutex);
+}
+
+std::string schema_cache::make_key(const std::string &db, const std::string &table)
+{
+  std::string key(db);
+  key.append(1, '\0');
+  key.append(table);
+  return key;
+}
+
+bool schema_cache::connect()
+{
+  my_bool reconnect= true;
+  if (mysql)
+    return true;
+  mysql= mysql_init(NULL);
+  if (!mysql)
+  {
+    print_log("ERROR: mysql_init failed on schema cache.");
+    return false;
+  }
+  mysql_options(mysql, MYSQL_READ_DEFAULT_GROUP, "client");
+  mysql_options(mysql, MYSQL_OPT_RECONNECT, &reconnect);
+  if (!mysql_real_connect(mysql, opt_slave_host, opt_admin_user,
+                          opt_admin_password, NULL, opt_slave_port,
+                          opt_slave_socket, 0))
+  {
+    print_log("ERROR: Schema cache failed to connect to MySQL: %d, %s",
+              mysql_errno(mysql), mysql_error(mysql));
+    mysql_close(mysql);
+    mysql= NULL;
+    return false;
+  }
+  return true;
+}
+
+static std::string escape_string(MYSQL *mysql, const std::string &str)
+{
+  char *buf= new char[str.length() * 2 + 1];
+  mysql_real_escape_string(mysql, buf, str.c_str(), str.length());
+  std::string escaped(buf);
+  delete[] buf;
+  return escaped;
+}
+
+static MYSQL_RES *run_query(MYSQL *mysql, const std::string &sql)
+{
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    print_log("ERROR: Schema cache query failed: %d %s. query:%s",
+              mysql_errno(mysql), mysql_error(mysql), sql.c_str());
+    return NULL;
+  }
+  return mysql_store_result(mysql);
+}
+
+/* Must be called with load_mutex held */
+table_meta_t *schema_cache::load(const std::string &db, const std::string &table)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  std::string where, sql;
+
+  if (!connect())
+    return NULL;
+
+  where= " WHERE TABLE_SCHEMA='";
+  where.append(escape_string(mysql, db));
+  where.append("' AND TABLE_NAME='");
+  where.append(escape_string(mysql, table));
+  where.append("'");
+
+  table_meta_t *meta= new table_meta_t;
+  meta->db= db;
+  meta->table= table;
+  meta->loaded_at= time(NULL);
+
+  sql= "SELECT COLUMN_NAME FROM information_schema.COLUMNS";
+  sql.append(where);
+  sql.append(" ORDER BY ORDINAL_POSITION");
+  if (!(result= run_query(mysql, sql)))
+    goto err;
+  while ((row= mysql_fetch_row(result)))
+    meta->columns.push_back(row[0]);
+  mysql_free_result(result);
+  meta->exists= !meta->columns.empty();
+  if (!meta->exists)
+    return meta;
+
+  sql= "SELECT INDEX_NAME, NON_UNIQUE, COLUMN_NAME FROM information_schema.STATISTICS";
+  sql.append(where);
+  sql.append(" ORDER BY INDEX_NAME, SEQ_IN_INDEX");
+  if (!(result= run_query(mysql, sql)))
+    goto err;
+  while ((row= mysql_fetch_row(result)))
+  {
+    if (meta->indexes.empty() || meta->indexes.back().name != row[0])
+    {
+      index_info_t index;
+      index.name= row[0];
+      index.primary= !strcmp(row[0], "PRIMARY");
+      index.unique= !strcmp(row[1], "0");
+      meta->indexes.push_back(index);
+    }
+    meta->indexes.back().columns.push_back(row[2]);
+  }
+  mysql_free_result(result);
+
+  sql= "SELECT CONSTRAINT_NAME, COLUMN_NAME, REFERENCED_TABLE_SCHEMA,"
+       " REFERENCED_TABLE_NAME, REFERENCED_COLUMN_NAME"
+       " FROM information_schema.KEY_COLUMN_USAGE";
+  sql.append(where);
+  sql.append(" AND REFERENCED_TABLE_NAME IS NOT NULL"
+             " ORDER BY CONSTRAINT_NAME, ORDINAL_POSITION");
+  if (!(result= run_query(mysql, sql)))
+    goto err;
+  while ((row= mysql_fetch_row(result)))
+  {
+    if (meta->foreign_keys.empty() || meta->foreign_keys.back().name != row[0])
+    {
+      foreign_key_info_t fk;
+      fk.name= row[0];
+      fk.ref_db= row[2];
+      fk.ref_table= row[3];
+      meta->foreign_keys.push_back(fk);
+    }
+    meta->foreign_keys.back().columns.push_back(row[1]);
+    meta->foreign_keys.back().ref_columns.push_back(row[4]);
+  }
+  mysql_free_result(result);
+  return meta;
+
+err:
+  delete meta;
+  return NULL;
+}
+
+/*
+  Returns the cached definition, loading it on a miss. Returns an empty
+  pointer if the definition could not be loaded.
+*/
+table_meta_ptr schema_cache::get(const std::string &db, const std::string &table)
+{
+  std::string key= make_key(db, table);
+  std::map<std::string, table_meta_ptr>::iterator it;
+  table_meta_ptr meta;
+
+  pthread_mutex_lock(&mutex);
+  it= tables.find(key);
+  if (it != tables.end())
+    meta= it->second;
+  pthread_mutex_unlock(&mutex);
+  if (meta && (meta->exists || time(NULL) < meta->loaded_at + NEGATIVE_ENTRY_TTL))
+    return meta;
+
+  pthread_mutex_lock(&load_mutex);
+  /* Another worker may have loaded it while we were waiting */
+  pthread_mutex_lock(&mutex);
+  it= tables.find(key);
+  if (it != tables.end() && it->second != meta)
+    meta= it->second;
+  else
+    meta.reset();
+  pthread_mutex_unlock(&mutex);
+  if (!meta)
+  {
+    table_meta_t *loaded= load(db, table);
+    if (loaded)
+    {
+      meta.reset(loaded);
+      pthread_mutex_lock(&mutex);
+      tables[key]= meta;
+      stat_schema_loads++;
+      pthread_mutex_unlock(&mutex);
+      DBUG_PRINT("Loaded table definition %s.%s, exists=%d",
+                 db.c_str(), table.c_str(), loaded->exists);
+    }
+  }
+  pthread_mutex_unlock(&load_mutex);
+  return meta;
+}
+
+/* Must be called with mutex held. Empty table means the whole db. */
+void schema_cache::erase(const std::string &db, const std::string &table)
+{
+  if (!table.empty())
+  {
+    if (tables.erase(make_key(db, table)))
+      stat_schema_invalidations++;
+    return;
+  }
+  std::string prefix= make_key(db, "");
+  std::map<std::string, table_meta_ptr>::iterator it= tables.lower_bound(prefix);
+  while (it != tables.end() && !it->first.compare(0, prefix.length(), prefix))
+  {
+    tables.erase(it++);
+    stat_schema_invalidations++;
+  }
+}
+
+void schema_cache::note_ddl(const std::string &db, const std::string &table,
+                            uint file_seq, uint64_t pos)
+{
+  pending_ddl_t ddl;
+  ddl.db= db;
+  ddl.table= table;
+  ddl.file_seq= file_seq;
+  ddl.pos= pos;
+  DBUG_PRINT("DDL on %s.%s at %u:%lu", db.c_str(), table.c_str(), file_seq, pos);
+  pthread_mutex_lock(&mutex);
+  erase(db, table);
+  pending.push_back(ddl);
+  pthread_mutex_unlock(&mutex);
+}
+
+/*
+  Called by the relay log monitoring thread. Once the SQL thread has
+  passed a DDL, definitions loaded in the meantime are outdated. Positions
+  are only comparable within the same relay log file.
+*/
+void schema_cache::apply_pending(uint sql_file_seq, uint64_t sql_pos)
+{
+  pthread_mutex_lock(&mutex);
+  std::list<pending_ddl_t>::iterator it= pending.begin();
+  while (it != pending.end())
+  {
+    if (it->file_seq < sql_file_seq ||
+        (it->file_seq == sql_file_seq && it->pos < sql_pos))
+    {
+      erase(it->db, it->table);
+      it= pending.erase(it);
+    } else
+      it++;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void schema_cache::invalidate_all()
+{
+  pthread_mutex_lock(&mutex);
+  stat_schema_invalidations+= tables.size();
+  tables.clear();
+  pthread_mutex_unlock(&mutex);
+}
+
+uint schema_cache::get_size()
+{
+  uint size;
+  pthread_mutex_lock(&mutex);
+  size= tables.size();
+  pthread_mutex_unlock(&mutex);
+  return size;
+}
+
+void schema_cache::get_tables(std::vector<std::pair<std::string, std::string> > *out)
+{
+  pthread_mutex_lock(&mutex);
+  std::map<std::string, table_meta_ptr>::iterator it;
+  for (it= tables.begin(); it != tables.end(); it++)
+  {
+    if (it->second->exists)
+      out->push_back(std::make_pair(it->second->db, it->second->table));
+  }
+  pthread_mutex_unlock(&mutex);
+}
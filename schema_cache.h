@@ -0,0 +1,143 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __schema_cache_h_
+#define __schema_cache_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <boost/shared_ptr.hpp>
+#include "replication_booster.h"
+
+typedef struct index_info
+{
+  std::string name;
+  bool primary;
+  bool unique;
+  std::vector<std::string> columns;
+} index_info_t;
+
+typedef struct foreign_key_info
+{
+  std::string name;
+  std::vector<std::string> columns;
+  std::string ref_db;
+  std::string ref_table;
+  std::vector<std::string> ref_columns;
+} foreign_key_info_t;
+
+/*
+  Table definition as seen in information_schema. exists is false for
+  negative entries, i.e. tables which were not found when loaded.
+*/
+typedef struct table_meta
+{
+  std::string db;
+  std::string table;
+  bool exists;
+  time_t loaded_at;
+  std::vector<std::string> columns;
+  std::vector<index_info_t> indexes;
+  std::vector<foreign_key_info_t> foreign_keys;
+
+  const index_info_t *primary_key() const;
+  bool is_indexed(const std::string &column) const;
+  bool has_column(const std::string &column) const;
+} table_meta_t;
+
+typedef boost::shared_ptr<const table_meta_t> table_meta_ptr;
+
+typedef struct pending_ddl
+{
+  std::string db;
+  std::string table;
+  uint file_seq;
+  uint64_t pos;
+} pending_ddl_t;
+
+/*
+  Lazily loaded cache of table definitions. Lookups are done by workers,
+  loading uses a dedicated connection with the administration user.
+  Entries are dropped when the relay log reader sees DDL for them, and
+  dropped again once the SQL thread has actually executed the DDL, since
+  a worker may reload the old definition in between.
+*/
+class schema_cache
+{
+private:
+  std::map<std::string, table_meta_ptr> tables;
+  std::list<pending_ddl_t> pending;
+  pthread_mutex_t mutex;
+  pthread_mutex_t load_mutex;
+  MYSQL *mysql;
+
+  static std::string make_key(const std::string &db, const std::string &table);
+  bool connect();
+  table_meta_t *load(const std::string &db, const std::string &table);
+  void erase(const std::string &db, const std::string &table);
+
+public:
+  schema_cache();
+  ~schema_cache();
+
+  table_meta_ptr get(const std::string &db, const std::string &table);
+  void note_ddl(const std::string &db, const std::string &table,
+                uint file_seq, uint64_t pos);
+  void apply_pending(uint sql_file_seq, uint64_t sql_pos);
+  void invalidate_all();
+  uint get_size();
+  /* Database and table names of the cached definitions of existing tables */
+  void get_tables(std::vector<std::pair<std::string, std::string> > *out);
+};
+
+extern schema_cache *schemas;
+
+bool parse_table_name(const std::string &ref, const std::string &default_db,
+                      std::string *db, std::string *table);
+
+/*
+  SQL lexing shared by the statement parsers, so that they agree on
+  quoting and comments. Executable comments ("/" "*!") are not comments:
+  mysqld runs their text.
+*/
+bool is_identifier_char(char c);
+/* "#" or "-- " */
+bool is_line_comment(const char *p);
+/* Quoted string, quoted identifier or comment */
+bool is_quote_start(const char *p);
+/*
+  Position after the quoted string, quoted identifier or comment at p,
+  NULL if it is not terminated. A line comment ends before its newline.
+*/
+const char *skip_quoted(const char *p);
+/* Skips whitespace and comments */
+const char *skip_comments(const char *query);
+/* Skips the keyword and the whitespace and comments after it, if it is at *p */
+bool match_keyword(const char **p, const char *keyword);
+/* Plain or backquoted identifier */
+bool read_identifier(const char **p, std::string *name);
+bool is_ddl_query(const char *query);
+void note_ddl_query(const char *query, const std::string &default_db,
+                    uint file_seq, uint64_t pos);
+
+#endif
@@ -0,0 +1,351 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Prefetches run in the session context of the event they were converted
+  from: with another sql_mode (ANSI_QUOTES, NO_BACKSLASH_ESCAPES,
+  PIPES_AS_CONCAT) the SELECT is parsed differently or fails, and with
+  another character set or time zone literals compare differently and
+  read other index ranges than the SQL thread does.
+*/
+
+#include "session_context.h"
+
+/* Status variable codes of Query_event, see log_event.h of mysqld */
+enum
+{
+  Q_FLAGS2_CODE= 0,
+  Q_SQL_MODE_CODE= 1,
+  Q_CATALOG_CODE= 2,
+  Q_AUTO_INCREMENT= 3,
+  Q_CHARSET_CODE= 4,
+  Q_TIME_ZONE_CODE= 5,
+  Q_CATALOG_NZ_CODE= 6,
+  Q_LC_TIME_NAMES_CODE= 7,
+  Q_CHARSET_DATABASE_CODE= 8,
+  Q_TABLE_MAP_FOR_UPDATE_CODE= 9,
+  Q_MASTER_DATA_WRITTEN_CODE= 10,
+  Q_INVOKER= 11,
+  Q_UPDATED_DB_NAMES= 12,
+  Q_MICROSECONDS= 13,
+  Q_COMMIT_TS= 14,
+  Q_COMMIT_TS2= 15,
+  Q_EXPLICIT_DEFAULTS_FOR_TIMESTAMP= 16,
+  Q_DDL_LOGGED_WITH_XID= 17,
+  Q_DEFAULT_COLLATION_FOR_UTF8MB4= 18,
+  Q_SQL_REQUIRE_PRIMARY_KEY= 19,
+  Q_DEFAULT_TABLE_ENCRYPTION= 20,
+  /* MariaDB */
+  Q_HRNOW= 128,
+  Q_XID= 129
+};
+
+/* Q_UPDATED_DB_NAMES count when the names are not listed */
+#define OVER_MAX_DBS_IN_EVENT_MTS 254
+
+static inline uint16_t uint2korr(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint64_t uint8korr(const uint8_t *p)
+{
+  uint64_t value= 0;
+  for (int i= 7; i >= 0; i--)
+    value= (value << 8) | p[i];
+  return value;
+}
+
+/* Length of a status variable with a length prefixed string at p */
+static size_t string_var_length(const uint8_t *p, const uint8_t *end)
+{
+  return p < end ? 1 + *p : 1;
+}
+
+bool parse_session_context(const std::vector<uint8_t> &variables,
+                           session_context_t *context)
+{
+  const uint8_t *p= variables.empty() ? NULL : &variables[0];
+  const uint8_t *end= p + variables.size();
+
+  context->flags= 0;
+  while (p < end)
+  {
+    uint code= *p++;
+    size_t length;
+    switch (code)
+    {
+    case Q_FLAGS2_CODE:
+    case Q_MASTER_DATA_WRITTEN_CODE:
+      length= 4;
+      break;
+    case Q_SQL_MODE_CODE:
+      length= 8;
+      if (p + length <= end)
+      {
+        context->sql_mode= uint8korr(p);
+        context->flags|= SESSION_SQL_MODE;
+      }
+      break;
+    case Q_CATALOG_CODE:
+      length= string_var_length(p, end) + 1;
+      break;
+    case Q_AUTO_INCREMENT:
+      length= 4;
+      if (p + length <= end)
+      {
+        context->auto_increment_increment= uint2korr(p);
+        context->auto_increment_offset= uint2korr(p + 2);
+        context->flags|= SESSION_AUTO_INCREMENT;
+      }
+      break;
+    case Q_CHARSET_CODE:
+      length= 6;
+      if (p + length <= end)
+      {
+        context->charset_client= uint2korr(p);
+        context->collation_connection= uint2korr(p + 2);
+        context->collation_server= uint2korr(p + 4);
+        context->flags|= SESSION_CHARSET;
+      }
+      break;
+    case Q_TIME_ZONE_CODE:
+      length= string_var_length(p, end);
+      if (p + length <= end)
+      {
+        context->time_zone.assign((const char *)p + 1, length - 1);
+        context->flags|= SESSION_TIME_ZONE;
+      }
+      break;
+    case Q_CATALOG_NZ_CODE:
+      length= string_var_length(p, end);
+      break;
+    case Q_LC_TIME_NAMES_CODE:
+    case Q_CHARSET_DATABASE_CODE:
+    case Q_DEFAULT_COLLATION_FOR_UTF8MB4:
+      length= 2;
+      break;
+    case Q_TABLE_MAP_FOR_UPDATE_CODE:
+    case Q_DDL_LOGGED_WITH_XID:
+    case Q_XID:
+      length= 8;
+      break;
+    case Q_INVOKER:
+      length= string_var_length(p, end);
+      length+= string_var_length(p + length, end);
+      break;
+    case Q_UPDATED_DB_NAMES:
+    {
+      const uint8_t *q= p + 1;
+      if (p < end && *p != OVER_MAX_DBS_IN_EVENT_MTS)
+      {
+        for (uint i= 0; i < *p && q < end; i++)
+        {
+          while (q < end && *q)
+            q++;
+          q++;
+        }
+      }
+      length= q - p;
+      break;
+    }
+    case Q_MICROSECONDS:
+    case Q_HRNOW:
+      length= 3;
+      break;
+    case Q_EXPLICIT_DEFAULTS_FOR_TIMESTAMP:
+    case Q_SQL_REQUIRE_PRIMARY_KEY:
+    case Q_DEFAULT_TABLE_ENCRYPTION:
+      length= 1;
+      break;
+    default:
+      /* Codes are written in increasing order, the rest is unknown too */
+      return true;
+    }
+    if (p + length > end)
+      return false;
+    p+= length;
+  }
+  return true;
+}
+
+static void append_quoted(std::string *sql, const std::string &value)
+{
+  sql->append("'");
+  for (size_t i= 0; i < value.length(); i++)
+  {
+    if (value[i] == '\'' || value[i] == '\\')
+      sql->append(1, value[i]);
+    sql->append(1, value[i]);
+  }
+  sql->append("'");
+}
+
+/*
+  Assignment for one field of context. Without a time zone in the event
+  the SQL thread uses the global time zone, and the auto increment
+  variables default to 1.
+*/
+static std::string make_assignment(uint field, const session_context_t &context)
+{
+  char buf[128];
+  std::string sql;
+  switch (field)
+  {
+  case SESSION_SQL_MODE:
+    snprintf(buf, sizeof(buf), "sql_mode=%lu", context.sql_mode);
+    sql= buf;
+    break;
+  case SESSION_CHARSET:
+    snprintf(buf, sizeof(buf),
+             "character_set_client=%u,collation_connection=%u,collation_server=%u",
+             context.charset_client, context.collation_connection,
+             context.collation_server);
+    sql= buf;
+    break;
+  case SESSION_TIME_ZONE:
+    if (context.flags & SESSION_TIME_ZONE)
+    {
+      sql= "time_zone=";
+      append_quoted(&sql, context.time_zone);
+    } else
+      sql= "time_zone=@@global.time_zone";
+    break;
+  case SESSION_AUTO_INCREMENT:
+    snprintf(buf, sizeof(buf),
+             "auto_increment_increment=%u,auto_increment_offset=%u",
+             context.flags & SESSION_AUTO_INCREMENT ?
+             context.auto_increment_increment : 1,
+             context.flags & SESSION_AUTO_INCREMENT ?
+             context.auto_increment_offset : 1);
+    sql= buf;
+    break;
+  }
+  return sql;
+}
+
+static bool same_field(uint field, const session_context_t &a,
+                       const session_context_t &b)
+{
+  switch (field)
+  {
+  case SESSION_SQL_MODE:
+    return a.sql_mode == b.sql_mode;
+  case SESSION_CHARSET:
+    return a.charset_client == b.charset_client &&
+           a.collation_connection == b.collation_connection &&
+           a.collation_server == b.collation_server;
+  case SESSION_TIME_ZONE:
+    return (a.flags & SESSION_TIME_ZONE) == (b.flags & SESSION_TIME_ZONE) &&
+           a.time_zone == b.time_zone;
+  case SESSION_AUTO_INCREMENT:
+    return (a.flags & SESSION_AUTO_INCREMENT) ==
+           (b.flags & SESSION_AUTO_INCREMENT) &&
+           a.auto_increment_increment == b.auto_increment_increment &&
+           a.auto_increment_offset == b.auto_increment_offset;
+  }
+  return false;
+}
+
+static void copy_field(uint field, const session_context_t &from,
+                       session_context_t *to)
+{
+  to->flags= (to->flags & ~field) | (from.flags & field);
+  switch (field)
+  {
+  case SESSION_SQL_MODE:
+    to->sql_mode= from.sql_mode;
+    break;
+  case SESSION_CHARSET:
+    to->charset_client= from.charset_client;
+    to->collation_connection= from.collation_connection;
+    to->collation_server= from.collation_server;
+    break;
+  case SESSION_TIME_ZONE:
+    to->time_zone= from.time_zone;
+    break;
+  case SESSION_AUTO_INCREMENT:
+    to->auto_increment_increment= from.auto_increment_increment;
+    to->auto_increment_offset= from.auto_increment_offset;
+    break;
+  }
+}
+
+bool session_state::apply(MYSQL *mysql, const session_context_t &context,
+                          worker_stats_t *stats)
+{
+  static const uint fields[]= {SESSION_SQL_MODE, SESSION_CHARSET,
+                               SESSION_TIME_ZONE, SESSION_AUTO_INCREMENT};
+  /* Fields the SQL thread keeps from the previous event if not logged */
+  static const uint sticky= SESSION_SQL_MODE | SESSION_CHARSET;
+  std::vector<uint> changed;
+  std::string sql;
+  bool ok= true;
+
+  if (mysql_thread_id(mysql) != thread_id)
+  {
+    thread_id= mysql_thread_id(mysql);
+    known= 0;
+  }
+  for (size_t i= 0; i < sizeof(fields)/sizeof(uint); i++)
+  {
+    uint field= fields[i];
+    if ((field & sticky) && !(context.flags & field))
+      continue;
+    if ((known & field) && same_field(field, context, current))
+      continue;
+    changed.push_back(field);
+    sql.append(sql.empty() ? "SET " : ",");
+    sql.append(make_assignment(field, context));
+  }
+  if (changed.empty())
+    return true;
+
+  stats->session_changes++;
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    /* Find the failing variable, e.g. a time zone unknown to this server */
+    DBUG_PRINT("%s failed: %d %s", sql.c_str(), mysql_errno(mysql), mysql_error(mysql));
+    for (size_t i= 0; i < changed.size(); i++)
+    {
+      sql= "SET " + make_assignment(changed[i], context);
+      if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+      {
+        DBUG_PRINT("%s failed: %d %s", sql.c_str(), mysql_errno(mysql), mysql_error(mysql));
+        stats->session_errors++;
+        ok= false;
+      }
+    }
+  }
+  /* A failed value is not retried until the context changes again */
+  for (size_t i= 0; i < changed.size(); i++)
+  {
+    copy_field(changed[i], context, &current);
+    known|= changed[i];
+  }
+  if (mysql_thread_id(mysql) != thread_id)
+  {
+    /* Reconnected while setting: the values are lost */
+    thread_id= mysql_thread_id(mysql);
+    known= 0;
+  }
+  return ok;
+}
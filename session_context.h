@@ -0,0 +1,82 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#ifndef __session_context_h_
+#define __session_context_h_
+
+#include <string>
+#include <vector>
+#include "replication_booster.h"
+
+/*
+  Session variables stored in the status variables of a Query_event that
+  change how the SQL thread parses and executes its statement. Fields
+  whose SESSION_* bit is not set in flags were not in the event.
+*/
+enum session_field
+{
+  SESSION_SQL_MODE= 1,
+  SESSION_CHARSET= 2,
+  SESSION_TIME_ZONE= 4,
+  SESSION_AUTO_INCREMENT= 8
+};
+
+typedef struct session_context
+{
+  uint flags;
+  uint64_t sql_mode;
+  /* Collation ids, as in SET character_set_client= <id> */
+  uint16_t charset_client;
+  uint16_t collation_connection;
+  uint16_t collation_server;
+  std::string time_zone;
+  uint16_t auto_increment_increment;
+  uint16_t auto_increment_offset;
+} session_context_t;
+
+/* Returns false if the status variables are truncated */
+bool parse_session_context(const std::vector<uint8_t> &variables,
+                           session_context_t *context);
+
+/*
+  Session variables last set on one worker connection, so that a SET is
+  only sent when an event's context differs. Forgotten when the client
+  library reconnected, as the new session starts with server defaults.
+*/
+class session_state
+{
+private:
+  session_context_t current;
+  uint known;
+  unsigned long thread_id;
+
+public:
+  session_state() : known(0), thread_id(0) { current.flags= 0; }
+
+  /*
+    Sets the variables of context that differ from the session. Returns
+    false if a SET failed; the statement is prefetched anyway.
+  */
+  bool apply(MYSQL *mysql, const session_context_t &context,
+             worker_stats_t *stats);
+};
+
+#endif
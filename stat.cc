@@ -0,0 +1,251 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  replication_booster_stat: prints the statistics replication_booster
+  publishes with --stats-shm. The segment is mapped read-only, so reading
+  it does not involve the booster process at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "stats_shm.h"
+
+static const char *stat_name= STATS_SHM_DEFAULT_NAME;
+static unsigned int stat_interval_msec= 0;
+static unsigned int stat_count= 0;
+static bool stat_json= false;
+
+static void stat_usage()
+{
+  printf("Usage: \n");
+  printf(" replication_booster_stat [OPTIONS]\n\n");
+  printf("Options:\n");
+  printf(" -n, --name=name       :Shared memory segment name. Default is %s.\n", STATS_SHM_DEFAULT_NAME);
+  printf(" -i, --interval=msec   :Print every msec milliseconds, with rates since the previous sample.\n");
+  printf(" -c, --count=N         :Stop after N samples. Default is 1 without --interval, else unlimited.\n");
+  printf(" -j, --json            :Print one JSON object per sample.\n");
+  exit(1);
+}
+
+/* Percentile of the SELECT latency histogram, as the bucket's upper bound */
+static uint64_t hist_percentile(const uint64_t *hist, double percentile)
+{
+  uint64_t total= 0, seen= 0;
+  for (int i= 0; i < STATS_HIST_BUCKETS; i++)
+    total+= hist[i];
+  if (!total)
+    return 0;
+  for (int i= 0; i < STATS_HIST_BUCKETS; i++)
+  {
+    seen+= hist[i];
+    if (seen >= total * percentile)
+      return 2ULL << i;
+  }
+  return 2ULL << (STATS_HIST_BUCKETS - 1);
+}
+
+static double rate(uint64_t now, uint64_t before, double seconds)
+{
+  return seconds > 0 && now >= before ? (now - before) / seconds : 0;
+}
+
+static void print_text(const stats_segment_t *s, const stats_segment_t *prev)
+{
+  double seconds= prev ? (s->updated_usec - prev->updated_usec) / 1e6 : 0;
+  uint64_t depth= 0, max_depth= 0;
+  for (uint32_t i= 0; i < s->workers && i < STATS_SHM_MAX_WORKERS; i++)
+  {
+    depth+= s->queue_depth[i];
+    if (s->queue_depth[i] > max_depth)
+      max_depth= s->queue_depth[i];
+  }
+
+  struct timeval now;
+  gettimeofday(&now, 0);
+  double age_msec= ((uint64_t)now.tv_sec * 1000000 + now.tv_usec -
+                    (double)s->updated_usec) / 1000;
+
+  printf("pid %d, %u workers, updated %.1f ms ago%s%s\n", s->pid, s->workers,
+         age_msec, s->paused ? ", paused" : "",
+         s->is_sql_thread_running ? "" : ", SQL thread stopped");
+  printf("  SQL thread:  file %u pos %lu timestamp %u\n",
+         s->sql_thread_file_seq, (unsigned long)s->sql_thread_pos,
+         s->sql_thread_timestamp);
+  printf("  Prefetcher:  file %u pos %lu timestamp %u (%+d s)\n",
+         s->prefetch_file_seq, (unsigned long)s->prefetch_pos,
+         s->prefetch_timestamp,
+         (int)(s->prefetch_timestamp - s->sql_thread_timestamp));
+  printf("  Queued queries: %lu (max %lu per worker)\n",
+         (unsigned long)depth, (unsigned long)max_depth);
+  printf("  SQL thread apply rate: %.0f bytes/sec\n", s->sql_apply_rate);
+  printf("  SELECT latency: avg %.0f usec, p50 < %lu usec, p99 < %lu usec\n",
+         s->select_latency_usec,
+         (unsigned long)hist_percentile(s->select_latency_hist, 0.5),
+         (unsigned long)hist_percentile(s->select_latency_hist, 0.99));
+  printf("  Parsed events: %lu", (unsigned long)s->parsed_binlog_events);
+  if (prev)
+    printf(" (%.0f/s)", rate(s->parsed_binlog_events,
+                             prev->parsed_binlog_events, seconds));
+  printf("\n  Pushed queries: %lu", (unsigned long)s->pushed_queries);
+  if (prev)
+    printf(" (%.0f/s)", rate(s->pushed_queries, prev->pushed_queries, seconds));
+  printf("\n  Executed SELECTs: %lu", (unsigned long)s->executed_selects);
+  if (prev)
+    printf(" (%.0f/s)", rate(s->executed_selects, prev->executed_selects,
+                             seconds));
+  printf("\n  Errors: %lu, old: %lu, late: %lu, missing tables: %lu\n",
+         (unsigned long)s->error_selects, (unsigned long)s->old_queries,
+         (unsigned long)s->late_queries,
+         (unsigned long)s->missing_table_queries);
+}
+
+static void print_json(const stats_segment_t *s)
+{
+#define FIELD(name) printf(",\"" #name "\":%lu", (unsigned long)s->name)
+  printf("{\"pid\":%d,\"updated_usec\":%lu,\"workers\":%u", s->pid,
+         (unsigned long)s->updated_usec, s->workers);
+  FIELD(sql_thread_file_seq);
+  FIELD(sql_thread_pos);
+  FIELD(sql_thread_timestamp);
+  FIELD(prefetch_file_seq);
+  FIELD(prefetch_pos);
+  FIELD(prefetch_timestamp);
+  FIELD(is_sql_thread_running);
+  FIELD(paused);
+  printf(",\"sql_apply_rate\":%.1f,\"select_latency_usec\":%.1f",
+         s->sql_apply_rate, s->select_latency_usec);
+  FIELD(parsed_binlog_events);
+  FIELD(skipped_binlog_events);
+  FIELD(unrelated_binlog_events);
+  FIELD(discarded_in_front_queries);
+  FIELD(executed_in_front_queries);
+  FIELD(pushed_queries);
+  FIELD(popped_queries);
+  FIELD(old_queries);
+  FIELD(discarded_queries);
+  FIELD(late_queries);
+  FIELD(converted_queries);
+  FIELD(executed_selects);
+  FIELD(error_selects);
+  FIELD(select_usec);
+  FIELD(missing_table_queries);
+  FIELD(schema_loads);
+  FIELD(schema_invalidations);
+  FIELD(payload_events);
+  FIELD(payload_errors);
+  FIELD(reached_ahead_relay_log);
+  FIELD(reached_end_of_relay_log);
+#undef FIELD
+  printf(",\"select_latency_hist\":[");
+  for (int i= 0; i < STATS_HIST_BUCKETS; i++)
+    printf("%s%lu", i ? "," : "", (unsigned long)s->select_latency_hist[i]);
+  printf("],\"queue_depth\":[");
+  for (uint32_t i= 0; i < s->workers && i < STATS_SHM_MAX_WORKERS; i++)
+    printf("%s%u", i ? "," : "", s->queue_depth[i]);
+  printf("]}\n");
+}
+
+int main(int argc, char **argv)
+{
+  static struct option stat_options[]=
+  {
+    {"help", no_argument, 0, '?'},
+    {"name", required_argument, 0, 'n'},
+    {"interval", required_argument, 0, 'i'},
+    {"count", required_argument, 0, 'c'},
+    {"json", no_argument, 0, 'j'},
+    {0,0,0,0}
+  };
+  int c, fd, opt_ind= 0;
+  struct stat st;
+  stats_segment_t *shm, sample, prev;
+  bool have_prev= false;
+
+  while ((c= getopt_long(argc, argv, "?n:i:c:j", stat_options, &opt_ind)) != EOF)
+  {
+    switch (c)
+    {
+      case 'n': stat_name= optarg; break;
+      case 'i': stat_interval_msec= atoi(optarg); break;
+      case 'c': stat_count= atoi(optarg); break;
+      case 'j': stat_json= true; break;
+      default: stat_usage(); break;
+    }
+  }
+  if (!stat_interval_msec && !stat_count)
+    stat_count= 1;
+
+  if ((fd= shm_open(stat_name, O_RDONLY, 0)) < 0)
+  {
+    fprintf(stderr, "Could not open shared memory segment %s: %s\n"
+            "Is replication_booster running with --stats-shm?\n",
+            stat_name, strerror(errno));
+    return 1;
+  }
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(stats_segment_t))
+  {
+    fprintf(stderr, "Shared memory segment %s has an unknown layout.\n",
+            stat_name);
+    return 1;
+  }
+  shm= (stats_segment_t*)mmap(NULL, sizeof(stats_segment_t), PROT_READ,
+                              MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED)
+  {
+    fprintf(stderr, "Could not map %s: %s\n", stat_name, strerror(errno));
+    return 1;
+  }
+
+  for (unsigned int n= 0; !stat_count || n < stat_count; n++)
+  {
+    if (n)
+      usleep(stat_interval_msec * 1000);
+    if (!read_stats_segment(shm, &sample))
+    {
+      fprintf(stderr, "Could not read a consistent sample from %s.\n",
+              stat_name);
+      return 1;
+    }
+    if (stat_json)
+      print_json(&sample);
+    else
+    {
+      if (n)
+        printf("\n");
+      print_text(&sample, have_prev ? &prev : NULL);
+    }
+    fflush(stdout);
+    prev= sample;
+    have_prev= true;
+  }
+  munmap(shm, sizeof(stats_segment_t));
+  return 0;
+}
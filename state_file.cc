@@ -0,0 +1,347 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --state-file: a restarted booster starts cold, reading from the SQL
+  thread position again with empty caches and default tuning, so lag
+  grows for the first minutes. The reader position, cached plans, the
+  names of tables with cached definitions and the tuned values are
+  written next to the status file and reloaded at startup.
+
+  The file is text, one "name value" line per item:
+
+    replication_booster_state 1
+    data_dir /var/lib/mysql
+    relay_log_info /var/lib/mysql/relay-log.info
+    server_started 1700000000
+    server_id 2
+    reader 123 45678
+    workers 16
+    throttle_rate 250
+    select_latency_usec 850
+    sql_apply_rate 1200000
+    table <tab> db <tab> table
+    plan <tab> class <tab> rows <tab> db <tab> template
+
+  A file of another instance (data directory or relay-log.info path) is
+  ignored. The reader position, server id and throttle rate are only
+  used if mysqld has not restarted since, since its buffer pool is cold
+  otherwise. Table definitions themselves are not saved, as DDL may have
+  run in the meantime; they are loaded again in the background.
+*/
+
+#include "replication_booster.h"
+#include "plan_cache.h"
+#include "schema_cache.h"
+#include <errno.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#define STATE_FILE_VERSION 1
+/* mysqld start time differs by rounding of Uptime */
+#define SERVER_START_TOLERANCE_SEC 5
+/* Upper bound of tables whose definitions are loaded at startup */
+#define STATE_MAX_TABLES 10000
+/* The status thread rewrites the file at most this often */
+#define STATE_SAVE_INTERVAL_SEC 60
+
+static time_t server_started= 0;
+static std::vector<std::pair<std::string, std::string> > warmup_tables;
+static pthread_t warmup_thread_id;
+static bool warmup_running= false;
+
+static std::string state_file_path()
+{
+  if (opt_state_file)
+    return std::string(opt_state_file);
+  return std::string(opt_status_file) + ".state";
+}
+
+static time_t read_server_started(MYSQL *mysql)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  time_t started= 0;
+  if (mysql_query(mysql, "SHOW GLOBAL STATUS LIKE 'Uptime'") ||
+      !(result= mysql_store_result(mysql)))
+    return 0;
+  if ((row= mysql_fetch_row(result)) && row[1])
+    started= time(NULL) - strtol(row[1], NULL, 10);
+  mysql_free_result(result);
+  return started;
+}
+
+static bool has_separator(const std::string &str)
+{
+  return str.find_first_of("\t\n") != std::string::npos;
+}
+
+static void* state_warmup_thread(void*)
+{
+  uint loaded= 0;
+  for (size_t i= 0; i < warmup_tables.size() && !shutdown_program; i++)
+  {
+    table_meta_ptr meta= schemas->get(warmup_tables[i].first,
+                                      warmup_tables[i].second);
+    if (meta && meta->exists)
+      loaded++;
+  }
+  print_log("Loaded %u of %lu table definitions from the state file.",
+            loaded, warmup_tables.size());
+  warmup_tables.clear();
+  return NULL;
+}
+
+void stop_state_warmup()
+{
+  if (!warmup_running)
+    return;
+  pthread_join(warmup_thread_id, NULL);
+  warmup_running= false;
+}
+
+/*
+  Applies the state file. Returns true if the reader can start at
+  *reader_pos instead of the SQL thread position: mysqld did not restart
+  and the position is a complete event ahead of the SQL thread in its
+  current relay log.
+*/
+bool load_booster_state(MYSQL *mysql, uint64_t *reader_pos)
+{
+  char line[PATH_MAX + 4096];
+  std::string path= state_file_path();
+  FILE *fp;
+  bool same_server= false, has_reader= false;
+  uint reader_seq= 0, version= 0, restored_plans= 0;
+  uint64_t pos= 0;
+  long saved_started= 0;
+
+  if (!opt_state_file_enabled)
+    return false;
+  server_started= read_server_started(mysql);
+  if (!(fp= fopen(path.c_str(), "r")))
+  {
+    if (errno != ENOENT)
+      print_log("ERROR: Could not read state file %s (%d)", path.c_str(), errno);
+    return false;
+  }
+  if (!fgets(line, sizeof(line), fp) ||
+      sscanf(line, "replication_booster_state %u", &version) != 1 ||
+      version != STATE_FILE_VERSION)
+  {
+    print_log("Ignoring state file %s: unknown format.", path.c_str());
+    fclose(fp);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    char *value, *nl= strchr(line, '\n');
+    if (!nl)
+      break;
+    *nl= '\0';
+    if (!(value= strpbrk(line, " \t")))
+      continue;
+    *value++= '\0';
+
+    if (!strcmp(line, "data_dir") || !strcmp(line, "relay_log_info"))
+    {
+      const char *current= !strcmp(line, "data_dir") ? data_dir :
+                                                      relay_log_info_path;
+      if (!current || strcmp(value, current))
+      {
+        print_log("Ignoring state file %s: it belongs to %s.", path.c_str(), value);
+        fclose(fp);
+        return false;
+      }
+    } else if (!strcmp(line, "server_started"))
+    {
+      saved_started= strtol(value, NULL, 10);
+      same_server= server_started &&
+        labs(saved_started - server_started) <= SERVER_START_TOLERANCE_SEC;
+    } else if (!strcmp(line, "server_id"))
+    {
+      if (same_server)
+        my_server_id= strtoul(value, NULL, 10);
+    } else if (!strcmp(line, "reader"))
+      has_reader= same_server && sscanf(value, "%u %lu", &reader_seq, &pos) == 2;
+    else if (!strcmp(line, "workers"))
+    {
+      uint workers= strtoul(value, NULL, 10);
+      if (opt_max_workers && workers >= opt_min_workers &&
+          workers <= opt_max_workers && workers != opt_workers)
+        resize_worker_pool(workers);
+    } else if (!strcmp(line, "throttle_rate"))
+    {
+      if (opt_throttle && same_server)
+        set_throttle_rate(strtod(value, NULL));
+    } else if (!strcmp(line, "select_latency_usec"))
+      select_latency_usec= strtod(value, NULL);
+    else if (!strcmp(line, "sql_apply_rate"))
+      sql_apply_rate= strtod(value, NULL);
+    else if (!strcmp(line, "table"))
+    {
+      char *table= strchr(value, '\t');
+      if (table && schemas && warmup_tables.size() < STATE_MAX_TABLES)
+      {
+        *table++= '\0';
+        warmup_tables.push_back(std::make_pair(std::string(value),
+                                               std::string(table)));
+      }
+    } else if (!strcmp(line, "plan"))
+    {
+      char *db, *tmpl;
+      plan_info_t plan;
+      int plan_class;
+      if (!plans || sscanf(value, "%d\t%lu\t", &plan_class, &plan.rows) != 2 ||
+          !(db= strchr(value, '\t')) || !(db= strchr(db + 1, '\t')) ||
+          !(tmpl= strchr(++db, '\t')) ||
+          plan_class < PLAN_UNKNOWN || plan_class > PLAN_SCAN)
+        continue;
+      plan.plan= (enum plan_class)plan_class;
+      std::string key(db, tmpl - db);
+      key.append(1, '\0');
+      key.append(tmpl + 1);
+      plans->put(key, plan);
+      restored_plans++;
+    }
+  }
+  fclose(fp);
+
+  print_log("Loaded state file %s: %s mysqld, %u plans, %lu tables.",
+            path.c_str(), same_server ? "same" : "restarted",
+            restored_plans, warmup_tables.size());
+  if (!warmup_tables.empty())
+  {
+    if (pthread_create(&warmup_thread_id, NULL, state_warmup_thread, NULL))
+      print_log("ERROR: Failed to create table definition loader thread!");
+    else
+      warmup_running= true;
+  }
+
+  if (!has_reader || reader_seq != relay_log_file_seq(sql_thread_relay_log_path) ||
+      pos <= sql_thread_pos)
+    return false;
+  /* pos must be an event boundary reached by walking from the SQL thread */
+  event_header_t header;
+  struct stat st;
+  skip_target_t target;
+  memset(&target, 0, sizeof(target));
+  target.bytes= pos - sql_thread_pos;
+  int fd= open_relay_log(sql_thread_relay_log_path);
+  bool valid= fd >= 0 && !fstat(fd, &st) &&
+              skip_relay_log_events(fd, reader_seq, sql_thread_pos, &target) == pos &&
+              read_event_header(fd, pos, &header) &&
+              pos + header.event_length <= (uint64_t)st.st_size;
+  if (fd >= 0)
+    close(fd);
+  if (valid)
+    *reader_pos= pos;
+  return valid;
+}
+
+static void write_state(FILE *fp)
+{
+  fprintf(fp, "replication_booster_state %d\n", STATE_FILE_VERSION);
+  fprintf(fp, "data_dir %s\n", data_dir);
+  fprintf(fp, "relay_log_info %s\n", relay_log_info_path);
+  fprintf(fp, "server_started %ld\n", (long)server_started);
+  fprintf(fp, "server_id %u\n", my_server_id);
+  pthread_mutex_lock(&reader_pos_mutex);
+  uint file_seq= reader_file_seq;
+  uint64_t pos= prefetch_position;
+  pthread_mutex_unlock(&reader_pos_mutex);
+  if (pos)
+    fprintf(fp, "reader %u %lu\n", file_seq, pos);
+  fprintf(fp, "workers %u\n", opt_workers);
+  if (opt_throttle)
+    fprintf(fp, "throttle_rate %.1f\n", get_throttle_rate());
+  fprintf(fp, "select_latency_usec %.1f\n", select_latency_usec);
+  fprintf(fp, "sql_apply_rate %.1f\n", sql_apply_rate);
+
+  if (schemas)
+  {
+    std::vector<std::pair<std::string, std::string> > tables;
+    schemas->get_tables(&tables);
+    for (size_t i= 0; i < tables.size() && i < STATE_MAX_TABLES; i++)
+    {
+      if (has_separator(tables[i].first) || has_separator(tables[i].second))
+        continue;
+      fprintf(fp, "table\t%s\t%s\n", tables[i].first.c_str(),
+              tables[i].second.c_str());
+    }
+  }
+  if (plans)
+  {
+    std::map<std::string, plan_info_t> all;
+    std::map<std::string, plan_info_t>::iterator it;
+    plans->get_all(&all);
+    for (it= all.begin(); it != all.end(); it++)
+    {
+      size_t sep= it->first.find('\0');
+      if (sep == std::string::npos || has_separator(it->first))
+        continue;
+      fprintf(fp, "plan\t%d\t%lu\t%s\t%s\n", it->second.plan, it->second.rows,
+              it->first.substr(0, sep).c_str(), it->first.c_str() + sep + 1);
+    }
+  }
+}
+
+/*
+  Written to a temporary file and renamed, like the status file. Unless
+  forced, at most every STATE_SAVE_INTERVAL_SEC, as the file can hold
+  thousands of tables and plans.
+*/
+int save_booster_state(bool force)
+{
+  static time_t last_saved= 0;
+  if (!opt_state_file_enabled || opt_replay_file || !data_dir)
+    return 0;
+  time_t now= time(NULL);
+  if (!force && now - last_saved < STATE_SAVE_INTERVAL_SEC)
+    return 0;
+  last_saved= now;
+  std::string path= state_file_path();
+  std::string tmp_path(dirname(strdupa(path.c_str())));
+  tmp_path.append("/replication_booster_state.XXXXXX");
+  char *tmp= strdupa(tmp_path.c_str());
+  int fd= mkstemp(tmp);
+  FILE *fp;
+  if (fd < 0 || !(fp= fdopen(fd, "w")))
+  {
+    print_log("ERROR: Could not write state file %s (%d)", path.c_str(), errno);
+    if (fd >= 0)
+    {
+      close(fd);
+      unlink(tmp);
+    }
+    return 1;
+  }
+  write_state(fp);
+  bool failed= fflush(fp) || ferror(fp);
+  if (fclose(fp) || failed || rename(tmp, path.c_str()))
+  {
+    print_log("ERROR: Could not write state file %s (%d)", path.c_str(), errno);
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Publishes statistics to a POSIX shared memory segment, see stats_shm.h.
+  A separate thread copies the counters every STATS_SHM_INTERVAL_MSEC, so
+  the relay log reader and the workers are not slowed down by readers.
+*/
+
+#include "replication_booster.h"
+#include "stats_shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATS_SHM_INTERVAL_MSEC 100
+
+static stats_segment_t *segment= NULL;
+static pthread_t publisher_thread_id;
+
+static void publish_stats()
+{
+  stats_segment_t *s= segment;
+
+  s->seq++;
+  __sync_synchronize();
+
+  s->updated_usec= now_usec();
+  s->workers= opt_workers;
+  pthread_mutex_lock(&relay_log_pos_mutex);
+  s->sql_thread_file_seq= sql_thread_file_seq;
+  s->sql_thread_pos= sql_thread_pos;
+  pthread_mutex_unlock(&relay_log_pos_mutex);
+  s->sql_thread_timestamp= sql_thread_timestamp;
+  s->prefetch_file_seq= reader_file_seq;
+  s->prefetch_pos= prefetch_position;
+  s->prefetch_timestamp= prefetch_timestamp;
+  s->is_sql_thread_running= is_sql_thread_running;
+  s->paused= prefetch_paused;
+  s->sql_apply_rate= sql_apply_rate;
+  s->select_latency_usec= select_latency_usec;
+
+  s->parsed_binlog_events= stat_parsed_binlog_events;
+  s->skipped_binlog_events= stat_skipped_binlog_events;
+  s->unrelated_binlog_events= stat_unrelated_binlog_events;
+  s->discarded_in_front_queries= stat_discarded_in_front_queries;
+  s->executed_in_front_queries= stat_executed_in_front_queries;
+  s->pushed_queries= stat_pushed_queries;
+  s->schema_loads= stat_schema_loads;
+  s->schema_invalidations= stat_schema_invalidations;
+  s->payload_events= stat_payload_events;
+  s->payload_errors= stat_payload_errors;
+  s->reached_ahead_relay_log= stat_reached_ahead_relay_log;
+  s->reached_end_of_relay_log= stat_reached_end_of_relay_log;
+
+  pthread_mutex_lock(&worker_mutex);
+  s->popped_queries= stat_popped_queries;
+  s->old_queries= stat_old_queries;
+  s->discarded_queries= stat_discarded_queries;
+  s->late_queries= stat_late_queries;
+  s->converted_queries= stat_converted_queries;
+  s->executed_selects= stat_executed_selects;
+  s->error_selects= stat_error_selects;
+  s->select_usec= stat_select_usec;
+  s->missing_table_queries= stat_missing_table_queries;
+  memcpy(s->select_latency_hist, stat_select_hist, sizeof(stat_select_hist));
+  pthread_mutex_unlock(&worker_mutex);
+
+  for (uint i= 0; i < STATS_SHM_MAX_WORKERS; i++)
+    s->queue_depth[i]= queue && i < opt_workers ? get_queue_depth(i) : 0;
+
+  __sync_synchronize();
+  s->seq++;
+}
+
+static void* publisher_thread(void*)
+{
+  while (!shutdown_program)
+  {
+    publish_stats();
+    usleep(STATS_SHM_INTERVAL_MSEC * 1000);
+  }
+  return NULL;
+}
+
+int start_stats_shm()
+{
+  int fd;
+  struct stat st;
+  if (!opt_stats_shm)
+    return 0;
+  /*
+    Readers open the segment read-only, so it is created 0644. A segment
+    left by a previous run is reused without truncating it, as shrinking
+    it would kill readers that still have it mapped with SIGBUS.
+  */
+  if ((fd= shm_open(opt_stats_shm, O_RDWR | O_CREAT, 0644)) < 0)
+    goto err;
+  if (fstat(fd, &st) ||
+      ((size_t)st.st_size < sizeof(stats_segment_t) &&
+       ftruncate(fd, sizeof(stats_segment_t))))
+  {
+    close(fd);
+    goto err;
+  }
+  segment= (stats_segment_t*)mmap(NULL, sizeof(stats_segment_t),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+  {
+    segment= NULL;
+    goto err;
+  }
+  memset(segment, 0, sizeof(stats_segment_t));
+  segment->size= sizeof(stats_segment_t);
+  segment->pid= getpid();
+  segment->started_usec= now_usec();
+  segment->version= STATS_SHM_VERSION;
+  __sync_synchronize();
+  segment->magic= STATS_SHM_MAGIC;
+
+  if (pthread_create(&publisher_thread_id, NULL, publisher_thread, NULL))
+  {
+    print_log("ERROR: Failed to create statistics publisher thread!");
+    return 1;
+  }
+  print_log("Publishing statistics to shared memory %s", opt_stats_shm);
+  return 0;
+
+err:
+  print_log("ERROR: Could not create shared memory segment %s: %d %s",
+            opt_stats_shm, errno, strerror(errno));
+  return 1;
+}
+
+/*
+  Called after the workers are stopped. The segment is left in place
+  after the final update, so that the final counters can still be read.
+  It is replaced at the next start.
+*/
+void stop_stats_shm()
+{
+  if (!segment)
+    return;
+  pthread_join(publisher_thread_id, NULL);
+  publish_stats();
+  munmap(segment, sizeof(stats_segment_t));
+  segment= NULL;
+}
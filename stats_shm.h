@@ -0,0 +1,133 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Layout of the shared memory statistics segment (--stats-shm). Shared by
+  replication_booster and replication_booster_stat, so it must not depend
+  on the Binlog API or MySQL headers.
+
+  The segment is a seqlock: the writer makes seq odd while it updates the
+  segment and even again when done. A reader copies the segment and
+  retries if seq was odd or changed during the copy. Fields are only ever
+  added at the end; size tells the reader how much of the layout the
+  writer knows about. version changes if existing fields change.
+*/
+
+#ifndef stats_shm_h
+#define stats_shm_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define STATS_SHM_MAGIC 0x52424f53  /* "RBOS" */
+#define STATS_SHM_VERSION 1
+#define STATS_SHM_DEFAULT_NAME "/replication_booster"
+/* Same as MAX_WORKERS */
+#define STATS_SHM_MAX_WORKERS 256
+/* SELECT latency buckets: [0,2), [2,4), [4,8) .. usec, last is open ended */
+#define STATS_HIST_BUCKETS 24
+
+typedef struct stats_segment
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  volatile uint32_t seq;
+  int32_t pid;
+  uint32_t workers;
+  uint64_t started_usec;
+  uint64_t updated_usec;
+
+  /* Positions */
+  uint32_t sql_thread_file_seq;
+  uint32_t sql_thread_timestamp;
+  uint64_t sql_thread_pos;
+  uint32_t prefetch_file_seq;
+  uint32_t prefetch_timestamp;
+  uint64_t prefetch_pos;
+  uint32_t is_sql_thread_running;
+  uint32_t paused;
+
+  /* Gauges */
+  double sql_apply_rate;
+  double select_latency_usec;
+
+  /* Counters, as in the status file */
+  uint64_t parsed_binlog_events;
+  uint64_t skipped_binlog_events;
+  uint64_t unrelated_binlog_events;
+  uint64_t discarded_in_front_queries;
+  uint64_t executed_in_front_queries;
+  uint64_t pushed_queries;
+  uint64_t popped_queries;
+  uint64_t old_queries;
+  uint64_t discarded_queries;
+  uint64_t late_queries;
+  uint64_t converted_queries;
+  uint64_t executed_selects;
+  uint64_t error_selects;
+  uint64_t select_usec;
+  uint64_t missing_table_queries;
+  uint64_t schema_loads;
+  uint64_t schema_invalidations;
+  uint64_t payload_events;
+  uint64_t payload_errors;
+  uint64_t reached_ahead_relay_log;
+  uint64_t reached_end_of_relay_log;
+
+  uint64_t select_latency_hist[STATS_HIST_BUCKETS];
+  uint32_t queue_depth[STATS_SHM_MAX_WORKERS];
+} stats_segment_t;
+
+static inline unsigned int stats_hist_bucket(uint64_t usec)
+{
+  unsigned int bucket= 0;
+  while (usec > 1 && bucket < STATS_HIST_BUCKETS - 1)
+  {
+    usec>>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/*
+  Copies a consistent snapshot of the segment. Returns false if the
+  writer kept changing it or the segment is not a known version.
+*/
+static inline bool read_stats_segment(const stats_segment_t *shm,
+                                      stats_segment_t *copy)
+{
+  for (int retry= 0; retry < 1000; retry++)
+  {
+    uint32_t seq= shm->seq;
+    if (seq & 1)
+      continue;
+    __sync_synchronize();
+    memcpy(copy, (const void*)shm, sizeof(stats_segment_t));
+    __sync_synchronize();
+    if (shm->seq == seq)
+      return copy->magic == STATS_SHM_MAGIC &&
+             copy->version == STATS_SHM_VERSION;
+  }
+  return false;
+}
+
+#endif
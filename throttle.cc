@@ -0,0 +1,251 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  --throttle: when the disk is saturated, prefetch reads queue at the
+  device ahead of the SQL thread's own reads. Workers take a token per
+  SELECT from a bucket whose rate is halved while the server or the disk
+  holding the data directory is overloaded, and raised again by a
+  quarter while it is not, until it is unlimited.
+*/
+
+#include "replication_booster.h"
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <strings.h>
+#include <algorithm>
+
+/* Lowest rate the throttle goes down to, in SELECTs per second */
+#define THROTTLE_MIN_RATE 10.0
+
+/* Selects per second, 0 when not throttling */
+static double throttle_rate= 0;
+static double tokens= 0;
+static uint64_t last_refill_usec= 0;
+static pthread_mutex_t throttle_mutex= PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t stat_throttle_wait_usec= 0;
+uint64_t stat_throttle_decreases= 0;
+
+/* Last sampled load signals, -1 if not available */
+static long pending_reads= -1;
+static long free_pages= -1;
+static long total_pages= -1;
+static double disk_util= -1;
+
+typedef struct load_sample
+{
+  uint64_t usec;
+  uint64_t wait_free;
+  uint64_t io_ticks;
+  uint64_t selects;
+  bool has_wait_free;
+  bool has_io_ticks;
+} load_sample_t;
+
+static load_sample_t last_sample;
+
+/* io_ticks (milliseconds the device was busy) of the data directory's disk */
+static bool read_io_ticks(uint64_t *io_ticks)
+{
+  static dev_t dev= 0;
+  static bool checked= false;
+  char line[512];
+  FILE *fp;
+  bool found= false;
+
+  if (!checked)
+  {
+    struct stat st;
+    checked= true;
+    if (data_dir && !stat(data_dir, &st))
+      dev= st.st_dev;
+  }
+  if (!dev || !(fp= fopen("/proc/diskstats", "r")))
+    return false;
+  while (fgets(line, sizeof(line), fp))
+  {
+    unsigned int dev_major, dev_minor;
+    unsigned long long v[10];
+    if (sscanf(line, "%u %u %*s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &dev_major, &dev_minor, &v[0], &v[1], &v[2], &v[3], &v[4],
+               &v[5], &v[6], &v[7], &v[8], &v[9]) != 12)
+      continue;
+    if (dev_major == major(dev) && dev_minor == minor(dev))
+    {
+      *io_ticks= v[9];
+      found= true;
+      break;
+    }
+  }
+  fclose(fp);
+  return found;
+}
+
+static void read_innodb_status(MYSQL *mysql, load_sample_t *sample)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  if (mysql_query(mysql, "SHOW GLOBAL STATUS WHERE Variable_name IN "
+                  "('Innodb_data_pending_reads', 'Innodb_buffer_pool_pages_free', "
+                  "'Innodb_buffer_pool_pages_total', 'Innodb_buffer_pool_wait_free')") ||
+      !(result= mysql_store_result(mysql)))
+    return;
+  while ((row= mysql_fetch_row(result)))
+  {
+    if (!row[0] || !row[1])
+      continue;
+    if (!strcasecmp(row[0], "Innodb_data_pending_reads"))
+      pending_reads= strtol(row[1], NULL, 10);
+    else if (!strcasecmp(row[0], "Innodb_buffer_pool_pages_free"))
+      free_pages= strtol(row[1], NULL, 10);
+    else if (!strcasecmp(row[0], "Innodb_buffer_pool_pages_total"))
+      total_pages= strtol(row[1], NULL, 10);
+    else if (!strcasecmp(row[0], "Innodb_buffer_pool_wait_free"))
+    {
+      sample->wait_free= strtoull(row[1], NULL, 10);
+      sample->has_wait_free= true;
+    }
+  }
+  mysql_free_result(result);
+}
+
+/*
+  Called by the relay log info thread every time it checks SHOW SLAVE
+  STATUS. Overloaded means InnoDB has more pending reads than
+  --throttle-pending-reads, had to wait for a free buffer pool page, or
+  the disk was busier than --throttle-util percent of the interval.
+*/
+void update_throttle(MYSQL *mysql)
+{
+  load_sample_t sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.usec= now_usec();
+  read_innodb_status(mysql, &sample);
+  sample.has_io_ticks= read_io_ticks(&sample.io_ticks);
+  /*
+    One token per prefetch. A failed HANDLER read falls back to a SELECT,
+    which is counted already.
+  */
+  pthread_mutex_lock(&worker_mutex);
+  sample.selects= stat_executed_selects + stat_error_selects +
+                  stat_handler_reads;
+  pthread_mutex_unlock(&worker_mutex);
+
+  if (!last_sample.usec)
+  {
+    last_sample= sample;
+    return;
+  }
+  double elapsed= (sample.usec - last_sample.usec) / 1e6;
+  if (elapsed <= 0)
+    return;
+  bool waited_free= sample.has_wait_free && last_sample.has_wait_free &&
+                    sample.wait_free > last_sample.wait_free;
+  if (sample.has_io_ticks && last_sample.has_io_ticks)
+    disk_util= (sample.io_ticks - last_sample.io_ticks) / (elapsed * 10.0);
+  double select_rate= (sample.selects - last_sample.selects) / elapsed;
+  last_sample= sample;
+
+  bool overloaded= waited_free ||
+    (opt_throttle_pending_reads && pending_reads > (long)opt_throttle_pending_reads) ||
+    (disk_util >= 0 && disk_util > opt_throttle_util);
+
+  pthread_mutex_lock(&throttle_mutex);
+  if (overloaded)
+  {
+    double base= throttle_rate ? throttle_rate : select_rate;
+    throttle_rate= std::max(base / 2, THROTTLE_MIN_RATE);
+    stat_throttle_decreases++;
+  } else if (throttle_rate)
+  {
+    throttle_rate*= 1.25;
+    /* Unlimited again once the bucket no longer limits the workers */
+    if (throttle_rate > 2 * select_rate)
+      throttle_rate= 0;
+  }
+  pthread_mutex_unlock(&throttle_mutex);
+}
+
+/*
+  Takes one token before a worker executes a SELECT. A worker that finds
+  the bucket empty reserves the next token and sleeps until it is due,
+  so waiting workers are served in order. Returns true if it slept.
+*/
+bool throttle_wait()
+{
+  uint64_t wait_usec= 0;
+  pthread_mutex_lock(&throttle_mutex);
+  if (throttle_rate)
+  {
+    uint64_t now= now_usec();
+    double burst= std::max(throttle_rate / 10, 1.0);
+    if (last_refill_usec)
+      tokens= std::min(tokens + (now - last_refill_usec) * throttle_rate / 1e6, burst);
+    last_refill_usec= now;
+    tokens-= 1;
+    if (tokens < 0)
+    {
+      wait_usec= -tokens / throttle_rate * 1e6;
+      stat_throttle_wait_usec+= wait_usec;
+    }
+  } else
+  {
+    tokens= 0;
+    last_refill_usec= 0;
+  }
+  pthread_mutex_unlock(&throttle_mutex);
+  for (uint64_t slept= 0; slept < wait_usec && !shutdown_program; slept+= 100000)
+    usleep(std::min(wait_usec - slept, (uint64_t)100000));
+  return wait_usec > 0;
+}
+
+double get_throttle_rate()
+{
+  pthread_mutex_lock(&throttle_mutex);
+  double rate= throttle_rate;
+  pthread_mutex_unlock(&throttle_mutex);
+  return rate;
+}
+
+/* Restores a rate from the state file, the next check adjusts it */
+void set_throttle_rate(double rate)
+{
+  pthread_mutex_lock(&throttle_mutex);
+  throttle_rate= rate > 0 ? std::max(rate, THROTTLE_MIN_RATE) : 0;
+  pthread_mutex_unlock(&throttle_mutex);
+}
+
+void print_throttle(FILE *stream)
+{
+  pthread_mutex_lock(&throttle_mutex);
+  double rate= throttle_rate;
+  uint64_t wait_usec= stat_throttle_wait_usec;
+  pthread_mutex_unlock(&throttle_mutex);
+  if (rate)
+    fprintf(stream, " Prefetch throttle: %.0f SELECTs/sec\n", rate);
+  else
+    fprintf(stream, " Prefetch throttle: unlimited\n");
+  fprintf(stream, " Throttle decreases/wait time: %lu/%.3f seconds\n",
+          stat_throttle_decreases, wait_usec / 1e6);
+  fprintf(stream, " InnoDB pending reads: %ld, free pages: %ld/%ld, disk utilization: %.0f%%\n",
+          pending_reads, free_pages, total_pages, disk_util);
+}
@@ -0,0 +1,242 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+#include "replication_booster.h"
+#include "trace.h"
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+bool tracing= false;
+
+typedef struct trace_ring
+{
+  char name[16];
+  trace_record_t *records;
+  /* Power of two */
+  uint32_t size;
+  /* Records written so far, only the owning thread writes */
+  volatile uint64_t head;
+} trace_ring_t;
+
+static trace_ring_t *rings[TRACE_MAX_RINGS];
+static uint ring_count= 0;
+static pthread_mutex_t ring_mutex= PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_ring_t *thread_ring= NULL;
+
+static pthread_t dump_thread_id;
+static bool dump_thread_running= false;
+static bool stop_dump_thread= false;
+
+static inline uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+  Gives the calling thread a ring. A thread that replaces one with the
+  same name, e.g. a worker restarted by the pool, continues its ring; the
+  previous owner has exited by then.
+*/
+void trace_register_thread(const char *name)
+{
+  if (!tracing)
+    return;
+  pthread_mutex_lock(&ring_mutex);
+  for (uint i= 0; i < ring_count; i++)
+  {
+    if (!strncmp(rings[i]->name, name, sizeof(rings[i]->name) - 1))
+    {
+      thread_ring= rings[i];
+      pthread_mutex_unlock(&ring_mutex);
+      return;
+    }
+  }
+  if (ring_count < TRACE_MAX_RINGS)
+  {
+    trace_ring_t *ring= new trace_ring_t;
+    memset(ring, 0, sizeof(trace_ring_t));
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    ring->size= 1;
+    while (ring->size < opt_trace_records)
+      ring->size<<= 1;
+    ring->records= new trace_record_t[ring->size];
+    memset(ring->records, 0, sizeof(trace_record_t) * ring->size);
+    rings[ring_count++]= ring;
+    thread_ring= ring;
+  }
+  pthread_mutex_unlock(&ring_mutex);
+}
+
+void trace_record(uint8_t type, uint32_t file_seq, uint64_t pos, uint16_t arg)
+{
+  trace_ring_t *ring= thread_ring;
+  if (!ring)
+    return;
+  uint64_t head= ring->head;
+  trace_record_t *record= &ring->records[head & (ring->size - 1)];
+  record->ns= monotonic_ns();
+  record->pos= pos;
+  record->file_seq= file_seq;
+  record->arg= arg;
+  record->type= type;
+  __sync_synchronize();
+  ring->head= head + 1;
+}
+
+/*
+  Copies the records of a ring that are not being overwritten. Records
+  written while copying may have replaced the oldest copied ones, so those
+  are dropped, as is the slot of the record a writer may be writing now.
+*/
+static void copy_ring(trace_ring_t *ring, std::vector<trace_record_t> *out)
+{
+  uint64_t head= ring->head;
+  __sync_synchronize();
+  uint64_t first= head > ring->size ? head - ring->size : 0;
+  out->clear();
+  for (uint64_t i= first; i < head; i++)
+    out->push_back(ring->records[i & (ring->size - 1)]);
+  __sync_synchronize();
+  uint64_t head_after= ring->head;
+  uint64_t overwritten= head_after >= ring->size ?
+                        head_after - ring->size + 1 : 0;
+  if (overwritten > first)
+    out->erase(out->begin(),
+               out->begin() + std::min(overwritten - first, (uint64_t)out->size()));
+}
+
+int dump_trace(const char **path)
+{
+  std::string tmp_path(opt_trace_file);
+  std::vector<trace_record_t> records;
+  trace_file_header_t header;
+  struct timespec ts;
+  FILE *fp;
+
+  *path= opt_trace_file;
+  if (!tracing)
+    return 1;
+  tmp_path.append(".tmp");
+  /* Also keeps a signal and a control socket dump from sharing tmp_path */
+  pthread_mutex_lock(&ring_mutex);
+  if (!(fp= fopen(tmp_path.c_str(), "w")))
+  {
+    pthread_mutex_unlock(&ring_mutex);
+    print_log("ERROR: Could not open trace file %s: %d %s", tmp_path.c_str(),
+              errno, strerror(errno));
+    return 1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version= TRACE_VERSION;
+  header.record_size= sizeof(trace_record_t);
+  header.ring_count= ring_count;
+  header.pid= getpid();
+  header.dump_monotonic_ns= monotonic_ns();
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.dump_realtime_usec= (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  fwrite(&header, sizeof(header), 1, fp);
+  for (uint i= 0; i < ring_count; i++)
+  {
+    trace_ring_header_t ring_header;
+    copy_ring(rings[i], &records);
+    memset(&ring_header, 0, sizeof(ring_header));
+    memcpy(ring_header.name, rings[i]->name, sizeof(ring_header.name));
+    ring_header.record_count= records.size();
+    fwrite(&ring_header, sizeof(ring_header), 1, fp);
+    if (!records.empty())
+      fwrite(&records[0], sizeof(trace_record_t), records.size(), fp);
+  }
+  bool failed= fclose(fp) || rename(tmp_path.c_str(), opt_trace_file);
+  pthread_mutex_unlock(&ring_mutex);
+
+  if (failed)
+  {
+    print_log("ERROR: Could not write trace file %s: %d %s", opt_trace_file,
+              errno, strerror(errno));
+    return 1;
+  }
+  print_log("Wrote trace to %s", opt_trace_file);
+  return 0;
+}
+
+/* SIGUSR1 is blocked in all other threads and taken here with sigwait() */
+static void* dump_thread(void*)
+{
+  sigset_t set;
+  int sig;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  while (1)
+  {
+    if (sigwait(&set, &sig))
+      continue;
+    if (stop_dump_thread)
+      break;
+    const char *path;
+    dump_trace(&path);
+  }
+  return NULL;
+}
+
+/* Must be called before any other thread is created */
+int start_tracing()
+{
+  sigset_t set;
+  if (!opt_trace_records)
+    return 0;
+  tracing= true;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  if (pthread_create(&dump_thread_id, NULL, dump_thread, NULL))
+  {
+    print_log("ERROR: Failed to create trace dump thread!");
+    return 1;
+  }
+  dump_thread_running= true;
+  print_log("Tracing %u events per thread. Send SIGUSR1 to write them to %s",
+            opt_trace_records, opt_trace_file);
+  return 0;
+}
+
+/* Called after the traced threads have exited */
+void stop_tracing()
+{
+  if (!dump_thread_running)
+    return;
+  stop_dump_thread= true;
+  pthread_kill(dump_thread_id, SIGUSR1);
+  pthread_join(dump_thread_id, NULL);
+  dump_thread_running= false;
+  tracing= false;
+  for (uint i= 0; i < ring_count; i++)
+  {
+    delete[] rings[i]->records;
+    delete rings[i];
+  }
+  ring_count= 0;
+}
@@ -0,0 +1,111 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Pipeline tracing (--trace). Every thread that records gets its own ring
+  of fixed size records which only that thread writes, so recording is a
+  clock read and a few stores. The rings are written to a file on SIGUSR1
+  or the control socket "trace" command, and replication_booster_trace
+  converts the file to the Chrome trace event format (chrome://tracing,
+  Perfetto).
+
+  File format, little endian:
+    trace_file_header_t
+    ring_count * (trace_ring_header_t, record_count * trace_record_t)
+
+  This header is shared with the converter and must not depend on the
+  Binlog API or MySQL headers.
+*/
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "RBTRACE"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RECORDS 16384
+#define TRACE_MAX_RINGS 300
+
+enum trace_type
+{
+  /* Reader parsed the event at pos */
+  TRACE_READ= 1,
+  /* Reader queued a query to worker arg */
+  TRACE_PUSH,
+  TRACE_POP,
+  /* Worker dropped the query: SQL thread already executed it */
+  TRACE_DROP_OLD,
+  /* Worker dropped the query: SQL thread would pass it first */
+  TRACE_DROP_LATE,
+  /* Rewrite done, arg is 1 if it produced a SELECT */
+  TRACE_REWRITE,
+  TRACE_EXECUTE_BEGIN,
+  /* arg is 1 if the SELECT failed */
+  TRACE_EXECUTE_END,
+  /* SQL thread position seen by the relay log info reader */
+  TRACE_SQL_POSITION,
+};
+
+typedef struct trace_record
+{
+  uint64_t ns;        /* CLOCK_MONOTONIC */
+  uint64_t pos;       /* Relay log position */
+  uint32_t file_seq;  /* Relay log file number */
+  uint16_t arg;
+  uint8_t type;
+  uint8_t reserved;
+} trace_record_t;
+
+typedef struct trace_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t ring_count;
+  int32_t pid;
+  /* The same instant on both clocks, to convert ns to wall clock time */
+  uint64_t dump_monotonic_ns;
+  uint64_t dump_realtime_usec;
+} trace_file_header_t;
+
+typedef struct trace_ring_header
+{
+  char name[16];
+  uint32_t record_count;
+  uint32_t reserved;
+} trace_ring_header_t;
+
+#ifndef TRACE_FORMAT_ONLY
+extern bool tracing;
+
+void trace_register_thread(const char *name);
+void trace_record(uint8_t type, uint32_t file_seq, uint64_t pos, uint16_t arg);
+int start_tracing();
+void stop_tracing();
+int dump_trace(const char **path);
+
+/* Costs one branch when --trace is not given */
+#define TRACE(type, file_seq, pos, arg) \
+  do { if (tracing) trace_record(type, file_seq, pos, arg); } while (0)
+#endif
+
+#endif
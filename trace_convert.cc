@@ -0,0 +1,290 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  replication_booster_trace: converts a --trace file to the Chrome trace
+  event format, or prints the timeline of one relay log event.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#define TRACE_FORMAT_ONLY
+#include "trace.h"
+
+typedef struct ring
+{
+  std::string name;
+  std::vector<trace_record_t> records;
+} ring_t;
+
+typedef struct timeline_entry
+{
+  uint64_t ns;
+  const char *thread;
+  const trace_record_t *record;
+} timeline_entry_t;
+
+static const char *type_name(uint8_t type)
+{
+  switch (type)
+  {
+  case TRACE_READ: return "read";
+  case TRACE_PUSH: return "push";
+  case TRACE_POP: return "pop";
+  case TRACE_DROP_OLD: return "drop old";
+  case TRACE_DROP_LATE: return "drop late";
+  case TRACE_REWRITE: return "rewrite";
+  case TRACE_EXECUTE_BEGIN:
+  case TRACE_EXECUTE_END: return "select";
+  case TRACE_SQL_POSITION: return "sql thread";
+  }
+  return "unknown";
+}
+
+static void convert_usage()
+{
+  printf("Usage: \n");
+  printf(" replication_booster_trace [OPTIONS] trace_file\n\n");
+  printf("Writes the trace as Chrome trace event JSON to stdout, for chrome://tracing or\n");
+  printf("https://ui.perfetto.dev.\n\n");
+  printf("Options:\n");
+  printf(" -e, --event=file:pos  :Print the timeline of the event at relay log file number\n");
+  printf("                        and position instead, up to the SQL thread passing it.\n");
+  exit(1);
+}
+
+static bool read_trace(const char *path, trace_file_header_t *header,
+                       std::vector<ring_t> *rings)
+{
+  FILE *fp= fopen(path, "r");
+  if (!fp)
+  {
+    fprintf(stderr, "Could not open %s\n", path);
+    return false;
+  }
+  if (fread(header, sizeof(*header), 1, fp) != 1 ||
+      memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(trace_record_t))
+  {
+    fprintf(stderr, "%s is not a trace file of this version\n", path);
+    fclose(fp);
+    return false;
+  }
+  for (uint32_t i= 0; i < header->ring_count; i++)
+  {
+    trace_ring_header_t ring_header;
+    ring_t ring;
+    if (fread(&ring_header, sizeof(ring_header), 1, fp) != 1)
+      break;
+    ring.name.assign(ring_header.name,
+                     strnlen(ring_header.name, sizeof(ring_header.name)));
+    ring.records.resize(ring_header.record_count);
+    if (ring_header.record_count &&
+        fread(&ring.records[0], sizeof(trace_record_t),
+              ring_header.record_count, fp) != ring_header.record_count)
+    {
+      fprintf(stderr, "%s is truncated\n", path);
+      fclose(fp);
+      return false;
+    }
+    rings->push_back(ring);
+  }
+  fclose(fp);
+  return true;
+}
+
+static void write_json(const trace_file_header_t *header,
+                       const std::vector<ring_t> &rings)
+{
+  uint64_t begin_ns= header->dump_monotonic_ns;
+  for (size_t i= 0; i < rings.size(); i++)
+  {
+    if (!rings[i].records.empty())
+      begin_ns= std::min(begin_ns, rings[i].records[0].ns);
+  }
+
+  printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"pid\":%d,"
+         "\"dump_realtime_usec\":%lu},\"traceEvents\":[\n", header->pid,
+         (unsigned long)header->dump_realtime_usec);
+  bool first= true;
+  for (size_t i= 0; i < rings.size(); i++)
+  {
+    printf("%s{\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"name\":\"thread_name\","
+           "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n",
+           (unsigned long)i, rings[i].name.c_str());
+    first= false;
+    for (size_t j= 0; j < rings[i].records.size(); j++)
+    {
+      const trace_record_t &r= rings[i].records[j];
+      double ts= (r.ns - begin_ns) / 1000.0;
+      const char *phase= "i";
+      if (r.type == TRACE_EXECUTE_BEGIN)
+        phase= "B";
+      else if (r.type == TRACE_EXECUTE_END)
+        phase= "E";
+
+      /* Positions as counters show how far the reader is ahead */
+      if (r.type == TRACE_READ || r.type == TRACE_SQL_POSITION)
+        printf(",\n{\"ph\":\"C\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,"
+               "\"name\":\"%s position\",\"args\":{\"pos\":%lu}}",
+               (unsigned long)i, ts,
+               r.type == TRACE_READ ? "reader" : "sql thread",
+               (unsigned long)r.pos);
+      if (r.type == TRACE_SQL_POSITION)
+        continue;
+      printf(",\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,"
+             "\"name\":\"%s\",%s\"args\":{\"file\":%u,\"pos\":%lu,\"arg\":%u}}",
+             phase, (unsigned long)i, ts, type_name(r.type),
+             phase[0] == 'i' ? "\"s\":\"t\"," : "", r.file_seq,
+             (unsigned long)r.pos, r.arg);
+    }
+  }
+  printf("\n]}\n");
+}
+
+static bool by_time(const timeline_entry_t &a, const timeline_entry_t &b)
+{
+  return a.ns < b.ns;
+}
+
+/* Everything recorded for one event, and when the SQL thread passed it */
+static int print_timeline(const std::vector<ring_t> &rings, uint32_t file_seq,
+                          uint64_t pos)
+{
+  std::vector<timeline_entry_t> timeline;
+  for (size_t i= 0; i < rings.size(); i++)
+  {
+    for (size_t j= 0; j < rings[i].records.size(); j++)
+    {
+      const trace_record_t &r= rings[i].records[j];
+      if (r.type == TRACE_SQL_POSITION)
+        continue;
+      if (r.file_seq == file_seq && r.pos == pos)
+      {
+        timeline_entry_t entry= { r.ns, rings[i].name.c_str(), &r };
+        timeline.push_back(entry);
+      }
+    }
+  }
+  if (timeline.empty())
+  {
+    fprintf(stderr, "Event %u:%lu is not in the trace\n", file_seq,
+            (unsigned long)pos);
+    return 1;
+  }
+  std::sort(timeline.begin(), timeline.end(), by_time);
+
+  /* First SQL thread position past the event */
+  const timeline_entry_t *passed= NULL;
+  timeline_entry_t sql_entry;
+  for (size_t i= 0; i < rings.size(); i++)
+  {
+    for (size_t j= 0; j < rings[i].records.size(); j++)
+    {
+      const trace_record_t &r= rings[i].records[j];
+      if (r.type != TRACE_SQL_POSITION ||
+          (r.file_seq < file_seq || (r.file_seq == file_seq && r.pos <= pos)))
+        continue;
+      if (!passed || r.ns < passed->ns)
+      {
+        sql_entry.ns= r.ns;
+        sql_entry.thread= rings[i].name.c_str();
+        sql_entry.record= &r;
+        passed= &sql_entry;
+      }
+    }
+  }
+  if (passed)
+  {
+    timeline.push_back(*passed);
+    std::sort(timeline.begin(), timeline.end(), by_time);
+  }
+
+  uint64_t begin= timeline[0].ns, last= begin;
+  printf("Event %u:%lu\n", file_seq, (unsigned long)pos);
+  for (size_t i= 0; i < timeline.size(); i++)
+  {
+    const timeline_entry_t &e= timeline[i];
+    const char *what= type_name(e.record->type);
+    char detail[64]= "";
+    if (e.record->type == TRACE_EXECUTE_BEGIN)
+      what= "select begin";
+    else if (e.record->type == TRACE_EXECUTE_END)
+      what= e.record->arg ? "select failed" : "select end";
+    else if (e.record->type == TRACE_PUSH)
+      snprintf(detail, sizeof(detail), " to worker %u", e.record->arg);
+    else if (e.record->type == TRACE_REWRITE && !e.record->arg)
+      snprintf(detail, sizeof(detail), " (not convertible)");
+    else if (e.record->type == TRACE_SQL_POSITION)
+      snprintf(detail, sizeof(detail), " passed, now at %u:%lu",
+               e.record->file_seq, (unsigned long)e.record->pos);
+    printf("  %+12.3f ms  (+%10.3f ms)  %-12s %s%s\n",
+           (e.ns - begin) / 1e6, (e.ns - last) / 1e6, e.thread, what, detail);
+    last= e.ns;
+  }
+  if (!passed)
+    printf("  SQL thread had not passed the event when the trace was written\n");
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  static struct option convert_options[]=
+  {
+    {"help", no_argument, 0, '?'},
+    {"event", required_argument, 0, 'e'},
+    {0,0,0,0}
+  };
+  int c, opt_ind= 0;
+  const char *event= NULL;
+  trace_file_header_t header;
+  std::vector<ring_t> rings;
+
+  while ((c= getopt_long(argc, argv, "?e:", convert_options, &opt_ind)) != EOF)
+  {
+    switch (c)
+    {
+      case 'e': event= optarg; break;
+      default: convert_usage(); break;
+    }
+  }
+  if (optind != argc - 1)
+    convert_usage();
+  if (!read_trace(argv[optind], &header, &rings))
+    return 1;
+
+  if (event)
+  {
+    const char *colon= strchr(event, ':');
+    if (!colon)
+      convert_usage();
+    return print_timeline(rings, strtoul(event, NULL, 10),
+                          strtoull(colon + 1, NULL, 10));
+  }
+  write_json(&header, rings);
+  return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Transaction_payload_event (MySQL 8.0.20+, binlog_transaction_compression).
+  The Binlog API does not know this event, so the event is read from the
+  relay log file directly. The body is a list of (type, length, value)
+  fields terminated by an end mark, followed by the payload: the events of
+  the transaction, without checksums, compressed as one zstd frame.
+*/
+
+#include "replication_booster.h"
+#include <streambuf>
+#include <istream>
+#include <vector>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+enum payload_field
+{
+  PAYLOAD_HEADER_END_MARK= 0,
+  PAYLOAD_SIZE_FIELD= 1,
+  PAYLOAD_COMPRESSION_TYPE_FIELD= 2,
+  PAYLOAD_UNCOMPRESSED_SIZE_FIELD= 3,
+};
+
+enum payload_compression { PAYLOAD_ZSTD= 0, PAYLOAD_NONE= 255, };
+
+/* Decompressed events are parsed from here, grown to the largest event */
+#define PAYLOAD_BUFFER_SIZE (256*1024)
+
+uint64_t stat_payload_events= 0;
+uint64_t stat_payload_inner_events= 0;
+uint64_t stat_payload_errors= 0;
+uint64_t stat_payload_compressed_bytes= 0;
+uint64_t stat_payload_uncompressed_bytes= 0;
+uint64_t stat_payload_decompress_usec= 0;
+
+static std::string raw_event;
+static std::vector<char> payload_buffer;
+#ifdef HAVE_ZSTD
+static ZSTD_DCtx *dctx= NULL;
+#endif
+
+class memory_buf : public std::streambuf
+{
+public:
+  memory_buf(char *begin, char *end)
+  {
+    setg(begin, begin, end);
+  }
+};
+
+/* Length encoded integer, as net_field_length_ll() */
+static bool read_packed_integer(const unsigned char **p, const unsigned char *end,
+                                uint64_t *value)
+{
+  uint bytes;
+  if (*p >= end)
+    return false;
+  switch (**p)
+  {
+  case 251: *value= 0; (*p)++; return true;
+  case 252: bytes= 2; break;
+  case 253: bytes= 3; break;
+  case 254: bytes= 8; break;
+  default: *value= **p; (*p)++; return true;
+  }
+  if (*p + 1 + bytes > end)
+    return false;
+  *value= 0;
+  for (uint i= 0; i < bytes; i++)
+    *value|= (uint64_t)(*p)[1 + i] << (8 * i);
+  *p+= 1 + bytes;
+  return true;
+}
+
+/*
+  Parses and dispatches complete events in buf[0, *filled). A trailing
+  partial event is moved to the front of the buffer. Returns false if an
+  event header is corrupt.
+*/
+static bool dispatch_inner_events(Binary_log_driver *drv, char *buf,
+                                  size_t *filled, size_t *needed,
+                                  payload_event_handler handler, void *arg)
+{
+  size_t offset= 0;
+  *needed= 0;
+  while (*filled - offset >= EVENT_HEADER_LENGTH)
+  {
+    event_header_t raw;
+    parse_event_header(buf + offset, &raw);
+    if (raw.event_length < EVENT_HEADER_LENGTH)
+      return false;
+    if (raw.event_length > *filled - offset)
+    {
+      *needed= raw.event_length;
+      break;
+    }
+    mysql::Log_event_header header;
+    header.marker= 0;
+    header.timestamp= raw.timestamp;
+    header.type_code= raw.type_code;
+    header.server_id= raw.server_id;
+    header.event_length= raw.event_length;
+    header.next_position= raw.next_position;
+    header.flags= raw.flags;
+
+    memory_buf body(buf + offset + EVENT_HEADER_LENGTH,
+                    buf + offset + raw.event_length);
+    std::istream is(&body);
+    Binary_log_event *event= drv->parse_event(is, &header);
+    stat_payload_inner_events++;
+    if (event && !handler(event, arg))
+      delete event;
+    offset+= raw.event_length;
+  }
+  if (offset)
+  {
+    memmove(buf, buf + offset, *filled - offset);
+    *filled-= offset;
+  }
+  return true;
+}
+
+#ifdef HAVE_ZSTD
+static bool decompress_payload(Binary_log_driver *drv, const char *payload,
+                               size_t payload_size,
+                               payload_event_handler handler, void *arg)
+{
+  ZSTD_inBuffer in= { payload, payload_size, 0 };
+  size_t filled= 0, needed= 0, ret= 1;
+
+  if (!dctx && !(dctx= ZSTD_createDCtx()))
+    return false;
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  if (payload_buffer.size() < PAYLOAD_BUFFER_SIZE)
+    payload_buffer.resize(PAYLOAD_BUFFER_SIZE);
+
+  while (in.pos < in.size || ret != 0)
+  {
+    if (needed > payload_buffer.size())
+      payload_buffer.resize(needed);
+    ZSTD_outBuffer out= { &payload_buffer[0] + filled,
+                          payload_buffer.size() - filled, 0 };
+    ret= ZSTD_decompressStream(dctx, &out, &in);
+    if (ZSTD_isError(ret))
+    {
+      print_log("ERROR: Failed to decompress transaction payload: %s",
+                ZSTD_getErrorName(ret));
+      return false;
+    }
+    filled+= out.pos;
+    stat_payload_uncompressed_bytes+= out.pos;
+    if (!dispatch_inner_events(drv, &payload_buffer[0], &filled, &needed,
+                               handler, arg))
+      return false;
+    /* No progress possible: truncated frame */
+    if (out.pos == 0 && in.pos == in.size && ret != 0)
+      return false;
+  }
+  return filled == 0;
+}
+#endif
+
+/*
+  Reads the Transaction_payload_event at pos and calls handler for each
+  event in it. The handler returns true if it took ownership of the event.
+*/
+bool decode_transaction_payload(Binary_log_driver *drv, int fd, uint64_t pos,
+                                uint32_t length, payload_event_handler handler,
+                                void *arg)
+{
+  uint64_t type, field_length, payload_size= 0;
+  uint64_t compression= PAYLOAD_NONE, uncompressed_size= 0;
+  const unsigned char *p, *end;
+  struct timeval t0, t1;
+  bool ok= false;
+
+  stat_payload_events++;
+  if (fd < 0 || !read_relay_log(fd, pos, length, &raw_event))
+    goto end;
+  p= (const unsigned char*)raw_event.data() + EVENT_HEADER_LENGTH;
+  end= (const unsigned char*)raw_event.data() + raw_event.length();
+  while (1)
+  {
+    if (!read_packed_integer(&p, end, &type))
+      goto end;
+    if (type == PAYLOAD_HEADER_END_MARK)
+      break;
+    if (!read_packed_integer(&p, end, &field_length))
+      goto end;
+    switch (type)
+    {
+    case PAYLOAD_SIZE_FIELD:
+      if (!read_packed_integer(&p, end, &payload_size))
+        goto end;
+      break;
+    case PAYLOAD_COMPRESSION_TYPE_FIELD:
+      if (!read_packed_integer(&p, end, &compression))
+        goto end;
+      break;
+    case PAYLOAD_UNCOMPRESSED_SIZE_FIELD:
+      if (!read_packed_integer(&p, end, &uncompressed_size))
+        goto end;
+      break;
+    default:
+      p+= field_length;
+      break;
+    }
+  }
+  /* Anything after the payload is the event checksum */
+  if (p + payload_size > end)
+    goto end;
+  stat_payload_compressed_bytes+= payload_size;
+  DBUG_PRINT("Transaction payload: size %lu, compression %lu, uncompressed %lu",
+             payload_size, compression, uncompressed_size);
+
+  gettimeofday(&t0, 0);
+  if (compression == PAYLOAD_NONE)
+  {
+    size_t filled= payload_size, needed;
+    payload_buffer.assign((const char*)p, (const char*)p + payload_size);
+    stat_payload_uncompressed_bytes+= payload_size;
+    ok= payload_size == 0 ||
+        (dispatch_inner_events(drv, &payload_buffer[0], &filled, &needed,
+                               handler, arg) && filled == 0);
+  }
+#ifdef HAVE_ZSTD
+  else if (compression == PAYLOAD_ZSTD)
+    ok= decompress_payload(drv, (const char*)p, payload_size, handler, arg);
+#endif
+  else
+  {
+    static bool warned= false;
+    if (!warned)
+      print_log("WARN: Unsupported transaction payload compression type %lu. "
+                "Compressed transactions are not prefetched.", compression);
+    warned= true;
+  }
+  gettimeofday(&t1, 0);
+  stat_payload_decompress_usec+= (t1.tv_sec - t0.tv_sec) * 1000000 +
+                                 (t1.tv_usec - t0.tv_usec);
+
+end:
+  if (!ok)
+    stat_payload_errors++;
+  return ok;
+}
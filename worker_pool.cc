@@ -0,0 +1,338 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  Worker threads and their queues. Queues are allocated for all
+  MAX_WORKERS slots up front, so that the relay log reader can keep
+  indexing queue[] while workers are added or retired. Workers 0 ..
+  opt_workers-1 are the active ones that receive queries.
+*/
+
+#include "replication_booster.h"
+
+/* Pool controller, see pool_controller() */
+#define POOL_CHECK_INTERVAL_SEC 1
+/* Queued queries per worker above which the pool grows */
+#define POOL_GROW_QUEUE_DEPTH 16
+/* Share of popped queries that were already applied or too late */
+#define POOL_GROW_LATE_RATIO 0.10
+#define POOL_SHRINK_LATE_RATIO 0.01
+/* Quiet intervals before a worker is retired */
+#define POOL_SHRINK_INTERVALS 10
+/* SELECT latency growth since the last resize that means MySQL is saturated */
+#define POOL_SATURATED_LATENCY_RATIO 1.5
+
+uint64_t stat_pool_grows= 0;
+uint64_t stat_pool_shrinks= 0;
+
+/*
+  Held shared by the reader while it picks a worker and pushes to it, and
+  exclusively while opt_workers changes, so that nothing is pushed to a
+  worker after its shutdown request.
+*/
+pthread_rwlock_t worker_dispatch_lock= PTHREAD_RWLOCK_INITIALIZER;
+
+static pthread_t worker_thread_ids[MAX_WORKERS];
+static bool worker_running[MAX_WORKERS];
+/* Sent a shutdown request by resize_worker_pool(), not joined yet */
+static bool worker_retiring[MAX_WORKERS];
+static pthread_mutex_t pool_mutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_t controller_thread_id;
+static bool controller_running= false;
+
+static void push_shutdown(uint worker_id)
+{
+  query_t *query= new query_t;
+  memset(query, 0, sizeof(query_t));
+  query->shutdown= true;
+  queue[worker_id]->push(query);
+}
+
+/* Must be called with pool_mutex held */
+static int start_worker(uint worker_id)
+{
+  worker_info_t *info= new worker_info_t;
+  memset(info, 0, sizeof(worker_info_t));
+  info->worker_id= worker_id;
+  if (pthread_create(&(info->ptid), NULL, prefetch_worker, info))
+  {
+    print_log("ERROR: Failed to create worker thread %u!", worker_id);
+    delete info;
+    return 1;
+  }
+  worker_thread_ids[worker_id]= info->ptid;
+  worker_running[worker_id]= true;
+  return 0;
+}
+
+int init_worker_pool()
+{
+  queue= new query_queue*[MAX_WORKERS];
+  for (uint i= 0; i < MAX_WORKERS; i++)
+    queue[i]= new query_queue();
+  pthread_mutex_lock(&pool_mutex);
+  for (uint i= 0; i < opt_workers; i++)
+  {
+    if (start_worker(i))
+    {
+      pthread_mutex_unlock(&pool_mutex);
+      return 1;
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return 0;
+}
+
+/*
+  Changes the number of active workers. New workers start with empty
+  queues. Retired workers finish what is queued (queued requests are
+  served before shutdown requests) and exit. They are joined without
+  pool_mutex, as that can take as long as a slow SELECT; the pool does
+  not grow into their slots until then.
+*/
+int resize_worker_pool(uint workers)
+{
+  int rc= 0;
+  std::vector<uint> retired;
+  if (workers < 1)
+    workers= 1;
+  if (workers > MAX_WORKERS)
+    workers= MAX_WORKERS;
+
+  pthread_mutex_lock(&pool_mutex);
+  uint old_workers= opt_workers;
+  if (workers > old_workers)
+  {
+    for (uint i= old_workers; i < workers; i++)
+    {
+      if (worker_retiring[i])
+      {
+        workers= i;
+        break;
+      }
+      if (worker_running[i])
+        continue;
+      if ((rc= start_worker(i)))
+      {
+        workers= i;
+        break;
+      }
+    }
+    pthread_rwlock_wrlock(&worker_dispatch_lock);
+    opt_workers= workers;
+    pthread_rwlock_unlock(&worker_dispatch_lock);
+  } else if (workers < old_workers)
+  {
+    /* Stop dispatching to the retired workers first */
+    pthread_rwlock_wrlock(&worker_dispatch_lock);
+    opt_workers= workers;
+    pthread_rwlock_unlock(&worker_dispatch_lock);
+    for (uint i= workers; i < old_workers; i++)
+    {
+      worker_retiring[i]= true;
+      push_shutdown(i);
+      retired.push_back(i);
+    }
+  }
+  if (workers != old_workers)
+    print_log("Number of worker threads changed from %u to %u.",
+              old_workers, workers);
+  pthread_mutex_unlock(&pool_mutex);
+
+  for (size_t i= 0; i < retired.size(); i++)
+    pthread_join(worker_thread_ids[retired[i]], NULL);
+  if (!retired.empty())
+  {
+    pthread_mutex_lock(&pool_mutex);
+    for (size_t i= 0; i < retired.size(); i++)
+    {
+      /* A shutdown request pushed again by clear_worker_queues() */
+      queue[retired[i]]->clear();
+      worker_running[retired[i]]= false;
+      worker_retiring[retired[i]]= false;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+  }
+  return rc;
+}
+
+/*
+  Called by a worker that got a shutdown request while it is not active
+  any more. Nothing is pushed to it after that request, but anything left
+  in its queue goes to the remaining workers.
+*/
+void retire_worker(uint worker_id)
+{
+  query_t *query;
+  uint n= 0;
+  pthread_rwlock_rdlock(&worker_dispatch_lock);
+  while (queue[worker_id]->try_pop(&query))
+  {
+    if (query->shutdown)
+    {
+      delete query;
+      continue;
+    }
+    queue[n++ % opt_workers]->push(query);
+  }
+  pthread_rwlock_unlock(&worker_dispatch_lock);
+  DBUG_PRINT("Worker %u retired, moved %u queries.", worker_id, n);
+}
+
+/* Retiring workers get their shutdown requests back */
+void clear_worker_queues()
+{
+  pthread_mutex_lock(&pool_mutex);
+  for (uint i= 0; i < MAX_WORKERS; i++)
+  {
+    queue[i]->clear();
+    if (worker_retiring[i])
+      push_shutdown(i);
+  }
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+uint get_queue_depth(uint worker_id)
+{
+  return queue[worker_id]->get_size();
+}
+
+/*
+  Grows the pool while queries back up or arrive late at the workers, and
+  shrinks it one worker at a time after POOL_SHRINK_INTERVALS quiet
+  intervals. Growth stops while SELECT latency is much higher than at the
+  last resize: more workers would only add load to a saturated server.
+*/
+static void* pool_controller(void*)
+{
+  uint64_t last_popped= 0, last_late= 0;
+  double resize_latency= 0;
+  uint quiet_intervals= 0;
+
+  while (!shutdown_program)
+  {
+    sleep(POOL_CHECK_INTERVAL_SEC);
+    if (shutdown_program)
+      break;
+
+    uint64_t popped, late;
+    double latency;
+    pthread_mutex_lock(&worker_mutex);
+    popped= stat_popped_queries;
+    late= stat_old_queries + stat_late_queries;
+    latency= select_latency_usec;
+    pthread_mutex_unlock(&worker_mutex);
+
+    uint workers= opt_workers;
+    uint64_t queued= 0;
+    for (uint i= 0; i < workers; i++)
+      queued+= get_queue_depth(i);
+    double depth= (double)queued / workers;
+    double late_ratio= popped > last_popped ?
+      (double)(late - last_late) / (popped - last_popped) : 0;
+    last_popped= popped;
+    last_late= late;
+
+    bool backlog= depth > POOL_GROW_QUEUE_DEPTH ||
+                  late_ratio > POOL_GROW_LATE_RATIO;
+    bool saturated= resize_latency > 0 &&
+                    latency > resize_latency * POOL_SATURATED_LATENCY_RATIO;
+    uint target= workers;
+    if (backlog && !saturated && workers < opt_max_workers)
+    {
+      /* Grow by a quarter, so that large pools catch up quickly */
+      target= workers + (workers + 3) / 4;
+      if (target > opt_max_workers)
+        target= opt_max_workers;
+      quiet_intervals= 0;
+    } else if (!backlog && depth < 1 && late_ratio < POOL_SHRINK_LATE_RATIO &&
+               workers > opt_min_workers)
+    {
+      if (++quiet_intervals >= POOL_SHRINK_INTERVALS)
+      {
+        target= workers - 1;
+        quiet_intervals= 0;
+      }
+    } else
+      quiet_intervals= 0;
+
+    if (target == workers)
+      continue;
+    DBUG_PRINT("Pool: depth %.1f late %.2f latency %.0f usec, %u -> %u workers",
+               depth, late_ratio, latency, workers, target);
+    if (target > workers)
+      stat_pool_grows++;
+    else
+      stat_pool_shrinks++;
+    resize_worker_pool(target);
+    resize_latency= latency;
+  }
+  return NULL;
+}
+
+int start_pool_controller()
+{
+  if (!opt_max_workers)
+    return 0;
+  if (pthread_create(&controller_thread_id, NULL, pool_controller, NULL))
+  {
+    print_log("ERROR: Failed to create worker pool controller thread!");
+    return 1;
+  }
+  controller_running= true;
+  print_log("Worker threads are adjusted between %u and %u.",
+            opt_min_workers, opt_max_workers);
+  return 0;
+}
+
+void stop_pool_controller()
+{
+  if (!controller_running)
+    return;
+  pthread_join(controller_thread_id, NULL);
+  controller_running= false;
+}
+
+void shutdown_worker_pool()
+{
+  pthread_mutex_lock(&pool_mutex);
+  for (uint i= 0; i < MAX_WORKERS; i++)
+  {
+    if (worker_running[i])
+      push_shutdown(i);
+  }
+  for (uint i= 0; i < MAX_WORKERS; i++)
+  {
+    if (worker_running[i])
+    {
+      pthread_join(worker_thread_ids[i], NULL);
+      worker_running[i]= false;
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  for (uint i= 0; i < MAX_WORKERS; i++)
+  {
+    queue[i]->clear();
+    delete queue[i];
+  }
+  delete[] queue;
+  queue= NULL;
+}
@@ -0,0 +1,804 @@
+/**
+ *   Replication Booster -- A Tool for Prefetching MySQL Slave Relay Logs
+ *   Copyright (C) 2011 DeNA Co.,Ltd.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+**/
+
+/*
+  End-to-end replication lag benchmark. Generates a synthetic workload on
+  a local master while the replica's SQL thread is stopped, then starts
+  the SQL thread and measures how fast it applies the backlog, once
+  without Replication Booster and once for every combination of
+  --threads and --seconds-prefetch given. Each run is printed as one JSON
+  object per line.
+*/
+
+#include "replication_booster.h"
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+
+enum key_distribution { DIST_UNIFORM= 0, DIST_ZIPF= 1, DIST_HOTSPOT= 2, };
+enum statement_type
+{
+  STMT_UPDATE_PK= 0, STMT_UPDATE_RANGE, STMT_UPDATE_SECONDARY,
+  STMT_DELETE_PK, STMT_INSERT, STMT_TYPES
+};
+
+static const char *statement_names[STMT_TYPES]=
+  { "update_pk", "update_range", "update_secondary", "delete_pk", "insert" };
+
+typedef struct server
+{
+  const char *host;
+  int port;
+  const char *socket;
+} server_t;
+
+static server_t wl_master= { "127.0.0.1", 3306, NULL };
+static server_t wl_replica= { "127.0.0.1", 3307, NULL };
+static const char *wl_user= "root";
+static const char *wl_password= "";
+static const char *wl_db= "replication_booster_bench";
+static uint wl_tables= 4;
+static uint wl_rows= 1000000;
+static uint wl_row_size= 200;
+static uint64_t wl_statements= 100000;
+static uint wl_range_size= 20;
+static enum key_distribution wl_distribution= DIST_UNIFORM;
+static double wl_zipf_theta= 0.99;
+static double wl_hot_fraction= 0.01;
+static double wl_hot_probability= 0.9;
+static uint wl_mix[STMT_TYPES]= { 70, 5, 10, 5, 10 };
+static const char *wl_binlog_format= "STATEMENT";
+static const char *wl_booster= "replication_booster";
+static const char *wl_booster_args= NULL;
+static const char *wl_cold_command= NULL;
+static std::vector<uint> wl_threads;
+static std::vector<uint> wl_lookahead;
+static bool wl_prepare= true;
+static bool wl_baseline= true;
+static uint64_t wl_seed= 42;
+
+/* Random numbers and key distributions */
+
+static uint64_t rand_state;
+
+static inline uint64_t next_rand()
+{
+  rand_state^= rand_state << 13;
+  rand_state^= rand_state >> 7;
+  rand_state^= rand_state << 17;
+  return rand_state;
+}
+
+static inline double next_double()
+{
+  return (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double zipf_zetan, zipf_eta, zipf_alpha;
+
+static void init_zipf(uint64_t n, double theta)
+{
+  double zeta2= 0;
+  zipf_zetan= 0;
+  for (uint64_t i= 1; i <= n; i++)
+  {
+    zipf_zetan+= 1.0 / pow((double)i, theta);
+    if (i == 2)
+      zeta2= zipf_zetan;
+  }
+  zipf_alpha= 1.0 / (1.0 - theta);
+  zipf_eta= (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf_zetan);
+}
+
+/* Gray et al., "Quickly Generating Billion-Record Synthetic Databases" */
+static uint64_t next_zipf(uint64_t n, double theta)
+{
+  double u= next_double();
+  double uz= u * zipf_zetan;
+  if (uz < 1.0)
+    return 0;
+  if (uz < 1.0 + pow(0.5, theta))
+    return 1;
+  return (uint64_t)(n * pow(zipf_eta * u - zipf_eta + 1, zipf_alpha)) % n;
+}
+
+static uint64_t next_key()
+{
+  switch (wl_distribution)
+  {
+  case DIST_ZIPF:
+    /* Scatter the hot keys over the table rather than the first pages */
+    return (next_zipf(wl_rows, wl_zipf_theta) * 2654435761ULL) % wl_rows + 1;
+  case DIST_HOTSPOT:
+    {
+      uint64_t hot= (uint64_t)(wl_rows * wl_hot_fraction);
+      if (hot < 1)
+        hot= 1;
+      if (next_double() < wl_hot_probability)
+        return next_rand() % hot + 1;
+      return next_rand() % wl_rows + 1;
+    }
+  default:
+    return next_rand() % wl_rows + 1;
+  }
+}
+
+static std::string random_string(uint length)
+{
+  static const char chars[]= "abcdefghijklmnopqrstuvwxyz0123456789";
+  std::string str(length, ' ');
+  for (uint i= 0; i < length; i++)
+    str[i]= chars[next_rand() % (sizeof(chars) - 1)];
+  return str;
+}
+
+/* MySQL helpers */
+
+/* Seconds to wait for the servers to accept connections after --cold-command */
+#define COLD_CONNECT_TIMEOUT_SEC 600
+
+static MYSQL *connect_server(server_t *server, const char *db,
+                             bool report= true)
+{
+  MYSQL *mysql= mysql_init(NULL);
+  if (!mysql)
+    return NULL;
+  mysql_options(mysql, MYSQL_READ_DEFAULT_GROUP, "client");
+  if (!mysql_real_connect(mysql, server->socket ? NULL : server->host,
+                          wl_user, wl_password, db, server->port,
+                          server->socket, 0))
+  {
+    if (report)
+      print_log("ERROR: Failed to connect to %s:%d: %d, %s",
+                server->host, server->port, mysql_errno(mysql), mysql_error(mysql));
+    mysql_close(mysql);
+    return NULL;
+  }
+  return mysql;
+}
+
+/*
+  Replaces the connection after --cold-command, which may have restarted
+  the server. Waits until the server accepts connections again.
+*/
+static bool reconnect_server(server_t *server, MYSQL **mysql)
+{
+  mysql_close(*mysql);
+  *mysql= NULL;
+  for (uint i= 0; i < COLD_CONNECT_TIMEOUT_SEC && !shutdown_program; i++)
+  {
+    if ((*mysql= connect_server(server, NULL, false)))
+      return true;
+    sleep(1);
+  }
+  *mysql= connect_server(server, NULL);
+  return *mysql != NULL;
+}
+
+static bool run_sql(MYSQL *mysql, const std::string &sql)
+{
+  if (mysql_real_query(mysql, sql.c_str(), sql.length()))
+  {
+    print_log("ERROR: Query failed: %d %s. query:%.200s",
+              mysql_errno(mysql), mysql_error(mysql), sql.c_str());
+    return false;
+  }
+  MYSQL_RES *result= mysql_store_result(mysql);
+  if (result)
+    mysql_free_result(result);
+  return true;
+}
+
+typedef struct slave_status
+{
+  bool sql_running;
+  long seconds_behind_master;
+  std::string master_log_file;
+  uint64_t read_master_log_pos;
+  std::string relay_master_log_file;
+  uint64_t exec_master_log_pos;
+} slave_status_t;
+
+static bool get_slave_status(MYSQL *mysql, slave_status_t *st)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  MYSQL_FIELD *fields;
+  if (mysql_query(mysql, "SHOW SLAVE STATUS") ||
+      !(result= mysql_store_result(mysql)))
+  {
+    print_log("ERROR: SHOW SLAVE STATUS failed: %d %s",
+              mysql_errno(mysql), mysql_error(mysql));
+    return false;
+  }
+  if (!(row= mysql_fetch_row(result)))
+  {
+    print_log("ERROR: The replica is not configured as a slave.");
+    mysql_free_result(result);
+    return false;
+  }
+  fields= mysql_fetch_fields(result);
+  for (uint i= 0; i < mysql_num_fields(result); i++)
+  {
+    const char *name= fields[i].name;
+    const char *value= row[i] ? row[i] : "";
+    if (!strcmp(name, "Slave_SQL_Running"))
+      st->sql_running= !strcmp(value, "Yes");
+    else if (!strcmp(name, "Seconds_Behind_Master"))
+      st->seconds_behind_master= row[i] ? atol(value) : -1;
+    else if (!strcmp(name, "Master_Log_File"))
+      st->master_log_file= value;
+    else if (!strcmp(name, "Read_Master_Log_Pos"))
+      st->read_master_log_pos= strtoull(value, NULL, 10);
+    else if (!strcmp(name, "Relay_Master_Log_File"))
+      st->relay_master_log_file= value;
+    else if (!strcmp(name, "Exec_Master_Log_Pos"))
+      st->exec_master_log_pos= strtoull(value, NULL, 10);
+  }
+  mysql_free_result(result);
+  return true;
+}
+
+static bool get_master_position(MYSQL *mysql, std::string *file, uint64_t *pos)
+{
+  MYSQL_RES *result;
+  MYSQL_ROW row;
+  if (mysql_query(mysql, "SHOW MASTER STATUS") ||
+      !(result= mysql_store_result(mysql)))
+    return false;
+  row= mysql_fetch_row(result);
+  if (row)
+  {
+    *file= row[0];
+    *pos= strtoull(row[1], NULL, 10);
+  }
+  mysql_free_result(result);
+  return row != NULL;
+}
+
+/* Waits until the replica has received (or applied) everything */
+static bool wait_for_replica(MYSQL *master, MYSQL *replica, bool applied)
+{
+  std::string file;
+  uint64_t pos;
+  slave_status_t st;
+  if (!get_master_position(master, &file, &pos))
+    return false;
+  while (!shutdown_program)
+  {
+    if (!get_slave_status(replica, &st))
+      return false;
+    if (applied ? (st.relay_master_log_file == file && st.exec_master_log_pos >= pos)
+                : (st.master_log_file == file && st.read_master_log_pos >= pos))
+      return true;
+    usleep(100000);
+  }
+  return false;
+}
+
+/* Workload */
+
+static std::string table_name(uint n)
+{
+  char buf[32];
+  sprintf(buf, "sbtest%u", n + 1);
+  return buf;
+}
+
+static bool prepare_tables(MYSQL *master)
+{
+  char buf[256];
+  std::string sql;
+
+  print_log("Preparing %u tables with %u rows each.", wl_tables, wl_rows);
+  sql= "DROP DATABASE IF EXISTS ";
+  sql.append(wl_db);
+  if (!run_sql(master, sql))
+    return false;
+  sql= "CREATE DATABASE ";
+  sql.append(wl_db);
+  if (!run_sql(master, sql) || mysql_select_db(master, wl_db))
+    return false;
+  for (uint t= 0; t < wl_tables; t++)
+  {
+    sprintf(buf, "CREATE TABLE %s (id INT UNSIGNED NOT NULL PRIMARY KEY, "
+            "k INT UNSIGNED NOT NULL, c CHAR(60) NOT NULL, "
+            "pad VARCHAR(%u) NOT NULL, KEY k (k)) ENGINE=InnoDB",
+            table_name(t).c_str(), wl_row_size);
+    if (!run_sql(master, buf))
+      return false;
+    for (uint id= 1; id <= wl_rows; )
+    {
+      sql= "INSERT INTO ";
+      sql.append(table_name(t));
+      sql.append(" VALUES ");
+      for (uint n= 0; n < 1000 && id <= wl_rows; n++, id++)
+      {
+        sprintf(buf, "%s(%u,%lu,'%s','", n ? "," : "", id,
+                next_rand() % wl_rows + 1, random_string(60).c_str());
+        sql.append(buf);
+        sql.append(random_string(wl_row_size));
+        sql.append("')");
+      }
+      if (!run_sql(master, sql))
+        return false;
+    }
+  }
+  return true;
+}
+
+static enum statement_type next_statement_type()
+{
+  uint total= 0, r;
+  for (uint i= 0; i < STMT_TYPES; i++)
+    total+= wl_mix[i];
+  r= next_rand() % total;
+  for (uint i= 0; i < STMT_TYPES; i++)
+  {
+    if (r < wl_mix[i])
+      return (enum statement_type)i;
+    r-= wl_mix[i];
+  }
+  return STMT_UPDATE_PK;
+}
+
+static std::string make_statement(enum statement_type type)
+{
+  char buf[512];
+  std::string table= table_name(next_rand() % wl_tables);
+  uint64_t key= next_key();
+  switch (type)
+  {
+  case STMT_UPDATE_RANGE:
+    sprintf(buf, "UPDATE %s SET k=k+1 WHERE id BETWEEN %lu AND %lu",
+            table.c_str(), key, key + wl_range_size);
+    break;
+  case STMT_UPDATE_SECONDARY:
+    sprintf(buf, "UPDATE %s SET c='%s' WHERE k=%lu",
+            table.c_str(), random_string(60).c_str(), key);
+    break;
+  case STMT_DELETE_PK:
+    sprintf(buf, "DELETE FROM %s WHERE id=%lu", table.c_str(), key);
+    break;
+  case STMT_INSERT:
+    sprintf(buf, "INSERT IGNORE INTO %s VALUES (%lu,%lu,'%s','')",
+            table.c_str(), key, next_rand() % wl_rows + 1,
+            random_string(60).c_str());
+    break;
+  default:
+    sprintf(buf, "UPDATE %s SET k=k+1, c='%s' WHERE id=%lu",
+            table.c_str(), random_string(60).c_str(), key);
+    break;
+  }
+  return buf;
+}
+
+static bool generate_workload(MYSQL *master, uint64_t *counts)
+{
+  std::string sql("SET SESSION binlog_format=");
+  sql.append(wl_binlog_format);
+  if (!run_sql(master, sql) || mysql_select_db(master, wl_db))
+    return false;
+  memset(counts, 0, sizeof(uint64_t) * STMT_TYPES);
+  for (uint64_t i= 0; i < wl_statements && !shutdown_program; i++)
+  {
+    enum statement_type type= next_statement_type();
+    if (!run_sql(master, make_statement(type)))
+      return false;
+    counts[type]++;
+  }
+  return true;
+}
+
+/* Replication Booster process control */
+
+static pid_t start_booster(uint threads, uint lookahead)
+{
+  std::vector<std::string> args;
+  char buf[64];
+  args.push_back(wl_booster);
+  sprintf(buf, "--threads=%u", threads);
+  args.push_back(buf);
+  sprintf(buf, "--seconds-prefetch=%u", lookahead);
+  args.push_back(buf);
+  args.push_back(std::string("--user=") + wl_user);
+  args.push_back(std::string("--password=") + wl_password);
+  if (wl_replica.socket)
+    args.push_back(std::string("--socket=") + wl_replica.socket);
+  else
+  {
+    args.push_back(std::string("--host=") + wl_replica.host);
+    sprintf(buf, "--port=%d", wl_replica.port);
+    args.push_back(buf);
+  }
+  args.push_back("--status-freq=0");
+  if (wl_booster_args)
+  {
+    char *extra= strdupa(wl_booster_args);
+    char *save= NULL;
+    for (char *tok= strtok_r(extra, " ", &save); tok; tok= strtok_r(NULL, " ", &save))
+      args.push_back(tok);
+  }
+
+  pid_t pid= fork();
+  if (pid == 0)
+  {
+    std::vector<char*> argv;
+    for (size_t i= 0; i < args.size(); i++)
+      argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+    execvp(argv[0], &argv[0]);
+    fprintf(stderr, "ERROR: Could not execute %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  if (pid < 0)
+    print_log("ERROR: fork failed: %s", strerror(errno));
+  return pid;
+}
+
+static void stop_booster(pid_t pid)
+{
+  int status;
+  if (pid <= 0)
+    return;
+  kill(pid, SIGTERM);
+  waitpid(pid, &status, 0);
+}
+
+/*
+  One measurement: apply the generated backlog on the replica. The tables
+  are prepared again first, since the previous run changed them and the
+  same statements must run against the same data.
+*/
+
+static bool run_once(MYSQL **master_conn, MYSQL **replica_conn, bool booster,
+                     uint threads, uint lookahead)
+{
+  MYSQL *master= *master_conn, *replica= *replica_conn;
+  uint64_t counts[STMT_TYPES];
+  slave_status_t st;
+  struct timeval t0, t1;
+  long max_lag= 0;
+  double lag_sum= 0;
+  uint samples= 0;
+  pid_t pid= 0;
+
+  rand_state= wl_seed ^ 0x9e3779b97f4a7c15ULL;
+  if (wl_prepare &&
+      (!prepare_tables(master) || !wait_for_replica(master, replica, true)))
+    return false;
+  if (wl_cold_command)
+  {
+    if (system(wl_cold_command))
+      print_log("WARN: --cold-command returned non-zero status.");
+    if (!reconnect_server(&wl_master, master_conn) ||
+        !reconnect_server(&wl_replica, replica_conn))
+      return false;
+    master= *master_conn;
+    replica= *replica_conn;
+    /* A restarted replica may come up without its replication threads */
+    if (!run_sql(replica, "START SLAVE IO_THREAD"))
+      return false;
+  }
+  if (!run_sql(replica, "STOP SLAVE SQL_THREAD"))
+    return false;
+  rand_state= wl_seed;
+  if (!generate_workload(master, counts) ||
+      !wait_for_replica(master, replica, false))
+    return false;
+
+  if (booster)
+  {
+    pid= start_booster(threads, lookahead);
+    if (pid < 0)
+      return false;
+    /* Let the booster connect and read ahead before the SQL thread starts */
+    sleep(2);
+  }
+
+  gettimeofday(&t0, 0);
+  if (!run_sql(replica, "START SLAVE SQL_THREAD"))
+  {
+    stop_booster(pid);
+    return false;
+  }
+  std::string file;
+  uint64_t pos;
+  get_master_position(master, &file, &pos);
+  while (!shutdown_program)
+  {
+    if (!get_slave_status(replica, &st))
+      break;
+    if (st.seconds_behind_master > max_lag)
+      max_lag= st.seconds_behind_master;
+    if (st.seconds_behind_master >= 0)
+    {
+      lag_sum+= st.seconds_behind_master;
+      samples++;
+    }
+    if (st.relay_master_log_file == file && st.exec_master_log_pos >= pos)
+      break;
+    if (!st.sql_running)
+    {
+      print_log("ERROR: SQL thread stopped during the benchmark.");
+      break;
+    }
+    usleep(200000);
+  }
+  gettimeofday(&t1, 0);
+  stop_booster(pid);
+
+  double seconds= (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) * 1e-6;
+  printf("{\"booster\":%s,\"threads\":%u,\"seconds_prefetch\":%u,"
+         "\"binlog_format\":\"%s\",\"distribution\":\"%s\","
+         "\"tables\":%u,\"rows\":%u,\"statements\":%lu,",
+         booster ? "true" : "false", threads, lookahead, wl_binlog_format,
+         wl_distribution == DIST_ZIPF ? "zipf" :
+         wl_distribution == DIST_HOTSPOT ? "hotspot" : "uniform",
+         wl_tables, wl_rows, wl_statements);
+  for (uint i= 0; i < STMT_TYPES; i++)
+    printf("\"%s\":%lu,", statement_names[i], counts[i]);
+  printf("\"apply_seconds\":%.3f,\"apply_rate\":%.1f,"
+         "\"max_seconds_behind_master\":%ld,\"avg_seconds_behind_master\":%.1f}\n",
+         seconds, seconds > 0 ? wl_statements / seconds : 0,
+         max_lag, samples ? lag_sum / samples : 0);
+  fflush(stdout);
+  return true;
+}
+
+/* Options */
+
+static void parse_list(const char *arg, std::vector<uint> *list)
+{
+  char *buf= strdupa(arg);
+  char *save= NULL;
+  list->clear();
+  for (char *tok= strtok_r(buf, ",", &save); tok; tok= strtok_r(NULL, ",", &save))
+    list->push_back(atoi(tok));
+}
+
+static void parse_mix(const char *arg)
+{
+  char *buf= strdupa(arg);
+  char *save= NULL;
+  memset(wl_mix, 0, sizeof(wl_mix));
+  for (char *tok= strtok_r(buf, ",", &save); tok; tok= strtok_r(NULL, ",", &save))
+  {
+    char *sep= strchr(tok, ':');
+    if (!sep)
+      continue;
+    *sep= '\0';
+    for (uint i= 0; i < STMT_TYPES; i++)
+    {
+      if (!strcmp(tok, statement_names[i]))
+        wl_mix[i]= atoi(sep + 1);
+    }
+  }
+}
+
+static void parse_server(const char *arg, server_t *server)
+{
+  char *buf= strdup(arg);
+  if (buf[0] == '/')
+  {
+    server->socket= buf;
+    return;
+  }
+  char *sep= strrchr(buf, ':');
+  if (sep)
+  {
+    *sep= '\0';
+    server->port= atoi(sep + 1);
+  }
+  server->host= buf;
+}
+
+static void workload_usage()
+{
+  printf("Usage: \n");
+  printf(" replication_booster_workload [OPTIONS]\n\n");
+  printf("Options:\n");
+  printf("     --master=host:port|socket   :Local master. Default is 127.0.0.1:3306.\n");
+  printf("     --replica=host:port|socket  :Local replica of the master. Default is 127.0.0.1:3307.\n");
+  printf(" -u, --user=mysql_user           :User on both servers, also passed to replication_booster (default: root)\n");
+  printf(" -p, --password=mysql_pwd        :Password (default: empty)\n");
+  printf("     --db=name                   :Database created for the benchmark (default: replication_booster_bench)\n");
+  printf("     --tables=N                  :Number of tables. Default is 4.\n");
+  printf("     --rows=N                    :Rows per table. Default is 1000000.\n");
+  printf("     --row-size=N                :Padding bytes per row. Default is 200.\n");
+  printf("     --statements=N              :Statements generated per run. Default is 100000.\n");
+  printf("     --distribution=name         :Key distribution: uniform, zipf or hotspot. Default is uniform.\n");
+  printf("     --zipf-theta=X              :Skew of the zipf distribution. Default is 0.99.\n");
+  printf("     --hotspot=fraction:prob     :prob of accesses go to fraction of the keys. Default is 0.01:0.9.\n");
+  printf("     --mix=type:weight,...       :Statement mix of update_pk, update_range, update_secondary,\n");
+  printf("                                  delete_pk and insert. Default is 70,5,10,5,10.\n");
+  printf("     --binlog-format=format      :STATEMENT, ROW or MIXED. Default is STATEMENT.\n");
+  printf("     --booster=path              :replication_booster executable. Default is replication_booster in PATH.\n");
+  printf("     --booster-args=\"args\"       :Extra arguments for replication_booster.\n");
+  printf(" -t, --threads=N[,N..]           :--threads values to run replication_booster with. Default is 10.\n");
+  printf(" -s, --seconds-prefetch=N[,N..]  :--seconds-prefetch values to run replication_booster with. Default is 3.\n");
+  printf("     --cold-command=cmd          :Shell command run before each measurement, e.g. to restart the replica\n");
+  printf("                                  with a cold buffer pool. Runs after the tables are prepared. The\n");
+  printf("                                  servers are connected to again afterwards.\n");
+  printf("     --no-prepare                :Do not prepare the tables before each measurement. Measurements are\n");
+  printf("                                  only comparable if --cold-command restores the tables.\n");
+  printf("     --no-baseline               :Do not measure the SQL thread without replication_booster.\n");
+  printf("     --seed=N                    :Random seed. Each run replays the same statements. Default is 42.\n");
+  exit(1);
+}
+
+enum workload_option_codes
+{
+  WL_MASTER= 256, WL_REPLICA, WL_DB, WL_TABLES, WL_ROWS, WL_ROW_SIZE,
+  WL_STATEMENTS, WL_DISTRIBUTION, WL_ZIPF_THETA, WL_HOTSPOT, WL_MIX,
+  WL_BINLOG_FORMAT, WL_BOOSTER, WL_BOOSTER_ARGS, WL_COLD_COMMAND,
+  WL_NO_PREPARE, WL_NO_BASELINE, WL_SEED,
+};
+
+static void get_workload_options(int argc, char **argv)
+{
+  static struct option options[]=
+  {
+    {"help", no_argument, 0, '?'},
+    {"master", required_argument, 0, WL_MASTER},
+    {"replica", required_argument, 0, WL_REPLICA},
+    {"user", required_argument, 0, 'u'},
+    {"password", required_argument, 0, 'p'},
+    {"db", required_argument, 0, WL_DB},
+    {"tables", required_argument, 0, WL_TABLES},
+    {"rows", required_argument, 0, WL_ROWS},
+    {"row-size", required_argument, 0, WL_ROW_SIZE},
+    {"statements", required_argument, 0, WL_STATEMENTS},
+    {"distribution", required_argument, 0, WL_DISTRIBUTION},
+    {"zipf-theta", required_argument, 0, WL_ZIPF_THETA},
+    {"hotspot", required_argument, 0, WL_HOTSPOT},
+    {"mix", required_argument, 0, WL_MIX},
+    {"binlog-format", required_argument, 0, WL_BINLOG_FORMAT},
+    {"booster", required_argument, 0, WL_BOOSTER},
+    {"booster-args", required_argument, 0, WL_BOOSTER_ARGS},
+    {"threads", required_argument, 0, 't'},
+    {"seconds-prefetch", required_argument, 0, 's'},
+    {"cold-command", required_argument, 0, WL_COLD_COMMAND},
+    {"no-prepare", no_argument, 0, WL_NO_PREPARE},
+    {"no-baseline", no_argument, 0, WL_NO_BASELINE},
+    {"seed", required_argument, 0, WL_SEED},
+    {0,0,0,0}
+  };
+  int c, opt_ind= 0;
+
+  parse_list("10", &wl_threads);
+  parse_list("3", &wl_lookahead);
+  while ((c= getopt_long(argc, argv, "?u:p:t:s:", options, &opt_ind)) != EOF)
+  {
+    switch (c)
+    {
+      case WL_MASTER: parse_server(optarg, &wl_master); break;
+      case WL_REPLICA: parse_server(optarg, &wl_replica); break;
+      case 'u': wl_user= optarg; break;
+      case 'p': wl_password= optarg; break;
+      case WL_DB: wl_db= optarg; break;
+      case WL_TABLES: wl_tables= atoi(optarg) < 1 ? 1 : atoi(optarg); break;
+      case WL_ROWS: wl_rows= atoi(optarg) < 1 ? 1 : atoi(optarg); break;
+      case WL_ROW_SIZE: wl_row_size= atoi(optarg); break;
+      case WL_STATEMENTS: wl_statements= strtoull(optarg, NULL, 10); break;
+      case WL_DISTRIBUTION:
+        if (!strcmp(optarg, "zipf"))
+          wl_distribution= DIST_ZIPF;
+        else if (!strcmp(optarg, "hotspot"))
+          wl_distribution= DIST_HOTSPOT;
+        else if (!strcmp(optarg, "uniform"))
+          wl_distribution= DIST_UNIFORM;
+        else
+          workload_usage();
+        break;
+      case WL_ZIPF_THETA: wl_zipf_theta= atof(optarg); break;
+      case WL_HOTSPOT:
+        wl_hot_fraction= atof(optarg);
+        if (strchr(optarg, ':'))
+          wl_hot_probability= atof(strchr(optarg, ':') + 1);
+        break;
+      case WL_MIX: parse_mix(optarg); break;
+      case WL_BINLOG_FORMAT: wl_binlog_format= optarg; break;
+      case WL_BOOSTER: wl_booster= optarg; break;
+      case WL_BOOSTER_ARGS: wl_booster_args= optarg; break;
+      case 't': parse_list(optarg, &wl_threads); break;
+      case 's': parse_list(optarg, &wl_lookahead); break;
+      case WL_COLD_COMMAND: wl_cold_command= optarg; break;
+      case WL_NO_PREPARE: wl_prepare= false; break;
+      case WL_NO_BASELINE: wl_baseline= false; break;
+      case WL_SEED: wl_seed= strtoull(optarg, NULL, 10); break;
+      default: workload_usage(); break;
+    }
+  }
+  uint total= 0;
+  for (uint i= 0; i < STMT_TYPES; i++)
+    total+= wl_mix[i];
+  if (!total || (wl_distribution == DIST_ZIPF && wl_zipf_theta >= 1.0))
+    workload_usage();
+  if (strcasecmp(wl_binlog_format, "STATEMENT") &&
+      strcasecmp(wl_binlog_format, "ROW") &&
+      strcasecmp(wl_binlog_format, "MIXED"))
+    workload_usage();
+}
+
+extern "C" {
+  static void workload_shutdown(int);
+}
+
+static void workload_shutdown(int)
+{
+  shutdown_program= true;
+}
+
+int main(int argc, char **argv)
+{
+  MYSQL *master, *replica;
+  int rc= 1;
+
+  get_workload_options(argc, argv);
+  signal(SIGINT, workload_shutdown);
+  signal(SIGTERM, workload_shutdown);
+  if (mysql_library_init(0, NULL, NULL))
+  {
+    print_log("Could not initialize MySQL library.");
+    return 1;
+  }
+  if (wl_distribution == DIST_ZIPF)
+    init_zipf(wl_rows, wl_zipf_theta);
+
+  master= connect_server(&wl_master, NULL);
+  replica= connect_server(&wl_replica, NULL);
+  if (!master || !replica)
+    goto end;
+
+  if (!wl_prepare && !wl_cold_command &&
+      wl_threads.size() * wl_lookahead.size() + wl_baseline > 1)
+    print_log("WARN: With --no-prepare and without a --cold-command that "
+              "restores the tables, each run starts from data changed by "
+              "the runs before it.");
+
+  if (wl_baseline && !run_once(&master, &replica, false, 0, 0))
+    goto end;
+  for (size_t t= 0; t < wl_threads.size() && !shutdown_program; t++)
+  {
+    for (size_t s= 0; s < wl_lookahead.size() && !shutdown_program; s++)
+    {
+      if (!run_once(&master, &replica, true, wl_threads[t], wl_lookahead[s]))
+        goto end;
+    }
+  }
+  rc= 0;
+
+end:
+  if (replica)
+  {
+    run_sql(replica, "START SLAVE SQL_THREAD");
+    mysql_close(replica);
+  }
+  if (master)
+    mysql_close(master);
+  mysql_library_end();
+  return rc;
+}